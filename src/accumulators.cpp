@@ -12,11 +12,65 @@
 #include "spork.h"
 #include "xlibzchain.h"
 
+#include <atomic>
+#include <deque>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 using namespace libzerocoin;
 
-std::map<uint32_t, CBigNum> mapAccumulatorValues;
+/** Number of accumulator values kept in memory, others are read from the zerocoin database when needed */
+static const unsigned int MAX_ACCUMULATOR_VALUE_CACHE = 4096;
+
+static CCriticalSection cs_accumulatorValues;
+//! Recently used accumulator values by checksum, with their position in listAccumulatorValuesLRU
+static std::map<uint32_t, std::pair<CBigNum, std::list<uint32_t>::iterator> > mapAccumulatorValues;
+//! Checksums in mapAccumulatorValues, most recently used first
+static std::list<uint32_t> listAccumulatorValuesLRU;
 std::list<uint256> listAccCheckpointsNoDB;
 
+static bool GetCachedAccumulatorValue(uint32_t nChecksum, CBigNum& bnValue)
+{
+    LOCK(cs_accumulatorValues);
+    auto it = mapAccumulatorValues.find(nChecksum);
+    if (it == mapAccumulatorValues.end())
+        return false;
+
+    listAccumulatorValuesLRU.splice(listAccumulatorValuesLRU.begin(), listAccumulatorValuesLRU, it->second.second);
+    bnValue = it->second.first;
+    return true;
+}
+
+static void CacheAccumulatorValue(uint32_t nChecksum, const CBigNum& bnValue)
+{
+    LOCK(cs_accumulatorValues);
+    auto it = mapAccumulatorValues.find(nChecksum);
+    if (it != mapAccumulatorValues.end()) {
+        listAccumulatorValuesLRU.splice(listAccumulatorValuesLRU.begin(), listAccumulatorValuesLRU, it->second.second);
+        it->second.first = bnValue;
+        return;
+    }
+
+    if (mapAccumulatorValues.size() >= MAX_ACCUMULATOR_VALUE_CACHE) {
+        mapAccumulatorValues.erase(listAccumulatorValuesLRU.back());
+        listAccumulatorValuesLRU.pop_back();
+    }
+    listAccumulatorValuesLRU.push_front(nChecksum);
+    mapAccumulatorValues.insert(make_pair(nChecksum, make_pair(bnValue, listAccumulatorValuesLRU.begin())));
+}
+
+static void UncacheAccumulatorValue(uint32_t nChecksum)
+{
+    LOCK(cs_accumulatorValues);
+    auto it = mapAccumulatorValues.find(nChecksum);
+    if (it == mapAccumulatorValues.end())
+        return;
+
+    listAccumulatorValuesLRU.erase(it->second.second);
+    mapAccumulatorValues.erase(it);
+}
+
 uint32_t ParseChecksum(uint256 nChecksum, CoinDenomination denomination)
 {
     //shift to the beginning bit of this denomination and trim any remaining bits by returning 32 bits only
@@ -62,17 +116,17 @@ int GetChecksumHeight(uint32_t nChecksum, CoinDenomination denomination)
 
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue)
 {
-    if (mapAccumulatorValues.count(nChecksum)) {
-        bnAccValue = mapAccumulatorValues.at(nChecksum);
+    if (GetCachedAccumulatorValue(nChecksum, bnAccValue))
         return true;
-    }
 
     if (fMemoryOnly)
         return false;
 
-    if (!zerocoinDB->ReadAccumulatorValue(nChecksum, bnAccValue)) {
+    // Values are loaded on first use rather than all at startup
+    if (zerocoinDB->ReadAccumulatorValue(nChecksum, bnAccValue))
+        CacheAccumulatorValue(nChecksum, bnAccValue);
+    else
         bnAccValue = 0;
-    }
 
     return true;
 }
@@ -87,7 +141,7 @@ void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue)
 {
     //if (chainActive.Height() >= Params().Zerocoin_StartHeight()) {
         zerocoinDB->WriteAccumulatorValue(nChecksum, bnValue);
-        mapAccumulatorValues.insert(make_pair(nChecksum, bnValue));
+        CacheAccumulatorValue(nChecksum, bnValue);
     //}
 }
 
@@ -105,7 +159,7 @@ void DatabaseChecksums(AccumulatorMap& mapAccumulators)
 bool EraseChecksum(uint32_t nChecksum)
 {
     //erase from both memory and database
-    mapAccumulatorValues.erase(nChecksum);
+    UncacheAccumulatorValue(nChecksum);
     return zerocoinDB->EraseAccumulatorValue(nChecksum);
 }
 
@@ -126,24 +180,6 @@ bool EraseAccumulatorValues(const uint256& nCheckpointErase, const uint256& nChe
     return true;
 }
 
-bool LoadAccumulatorValuesFromDB(const uint256 nCheckpoint)
-{
-    for (auto& denomination : zerocoinDenomList) {
-        uint32_t nChecksum = ParseChecksum(nCheckpoint, denomination);
-
-        //if read is not successful then we are not in a state to verify zerocoin transactions
-        CBigNum bnValue;
-        if (!zerocoinDB->ReadAccumulatorValue(nChecksum, bnValue)) {
-            if (!count(listAccCheckpointsNoDB.begin(), listAccCheckpointsNoDB.end(), nCheckpoint))
-                listAccCheckpointsNoDB.push_back(nCheckpoint);
-            LogPrint("zero", "%s : Missing databased value for checksum %d\n", __func__, nChecksum);
-            return false;
-        }
-        mapAccumulatorValues.insert(make_pair(nChecksum, bnValue));
-    }
-    return true;
-}
-
 //Erase accumulator checkpoints for a certain block range
 bool EraseCheckpoints(int nStartHeight, int nEndHeight)
 {
@@ -226,9 +262,10 @@ bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, Accumulat
             return false;
 
         //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
+        boost::shared_ptr<const CBlock> pblock;
+        if(!ReadBlockFromDiskCached(pblock, pindex))
             return error("%s: failed to read block from disk", __func__);
+        const CBlock& block = *pblock;
 
         std::list<PublicCoin> listPubcoins;
         if (!BlockToPubcoinList(block, listPubcoins))
@@ -297,51 +334,6 @@ void RandomizeSecurityLevel(int& nSecurityLevel)
     }
 }
 
-//Compute how many coins were added to an accumulator up to the end height
-int ComputeAccumulatedCoins(int nHeightEnd, libzerocoin::CoinDenomination denom)
-{
-    CBlockIndex* pindex = chainActive.Genesis();
-    int n = 0;
-    while (pindex->nHeight < nHeightEnd) {
-        n += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-        pindex = chainActive.Next(pindex);
-    }
-
-    return n;
-}
-
-int AddBlockMintsToAccumulator(
-    const libzerocoin::PublicCoin& coin, const int nHeightMintAdded, const CBlockIndex* pindex,
-    libzerocoin::Accumulator* accumulator, bool isWitness)
-{
-    // if this block contains mints of the denomination that is being spent, then add them to the witness
-    int nMintsAdded = 0;
-    if (pindex->MintedDenomination(coin.getDenomination())) {
-        //grab mints from this block
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex))
-            return error("%s: failed to read block from disk while adding pubcoins to witness", __func__);
-
-        list<PublicCoin> listPubcoins;
-        if(!BlockToPubcoinList(block, listPubcoins))
-            return error("%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
-
-        //add the mints to the witness
-        for (const PublicCoin& pubcoin : listPubcoins) {
-            if (pubcoin.getDenomination() != coin.getDenomination())
-                continue;
-
-            if (isWitness && pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
-                continue;
-
-            accumulator->increment(pubcoin.getValue());
-            ++nMintsAdded;
-        }
-    }
-
-    return nMintsAdded;
-}
-
 bool GetAccumulatorValue(int& nHeight, const libzerocoin::CoinDenomination denom, CBigNum& bnAccValue)
 {
     if (nHeight > chainActive.Height())
@@ -355,22 +347,20 @@ bool GetAccumulatorValue(int& nHeight, const libzerocoin::CoinDenomination denom
         return true;
 }
 
-bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, CBlockIndex* pindexCheckpoint)
+// The blocks whose mints go into the witness of one coin
+struct CWitnessRange {
+    int nHeightMintAdded;
+    //! height the witness starts accumulating from
+    int nAccStartHeight;
+    //! first height not added to the witness
+    int nHeightEnd;
+    //! mints of the denomination accumulated before nAccStartHeight
+    int nMintsBefore;
+};
+
+// Find the blocks to add to the witness of coin, and set accumulator to the checkpoint the spend is made against
+static bool GetWitnessRange(const PublicCoin& coin, Accumulator& accumulator, Accumulator& witnessAccumulator, int nSecurityLevel, CBlockIndex* pindexCheckpoint, CWitnessRange& range)
 {
-    LogPrint("zero", "%s: generating\n", __func__);
-    int nLockAttempts = 0;
-    while (nLockAttempts < 100) {
-        TRY_LOCK(cs_main, lockMain);
-        if(!lockMain) {
-            MilliSleep(50);
-            nLockAttempts++;
-            continue;
-        }
-        break;
-    }
-    if (nLockAttempts == 100)
-        return error("%s: could not get lock on cs_main", __func__);
-    LogPrint("zero", "%s: after lock\n", __func__);
     uint256 txid;
     if (!zerocoinDB->ReadCoinMint(coin.getValue(), txid))
         return error("%s failed to read mint from db", __func__);
@@ -384,20 +374,19 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     if (!IsTransactionInChain(txid, nHeightTest))
         return error("%s: mint tx %s is not in chain", __func__, txid.GetHex());
 
-    int nHeightMintAdded = mapBlockIndex[hashBlock]->nHeight;
+    range.nHeightMintAdded = mapBlockIndex[hashBlock]->nHeight;
 
     //get the checkpoint added at the next multiple of 10
-    int nHeightCheckpoint = nHeightMintAdded + (10 - (nHeightMintAdded % 10));
+    int nHeightCheckpoint = range.nHeightMintAdded + (10 - (range.nHeightMintAdded % 10));
 
     //the height to start accumulating coins to add to witness
-    int nAccStartHeight = nHeightMintAdded - (nHeightMintAdded % 10);
+    range.nAccStartHeight = range.nHeightMintAdded - (range.nHeightMintAdded % 10);
 
     //Get the accumulator that is right before the cluster of blocks containing our mint was added to the accumulator
     CBigNum bnAccValue = 0;
-    if (GetAccumulatorValue(nHeightCheckpoint, coin.getDenomination(), bnAccValue)) {
-            accumulator.setValue(bnAccValue);
-            witness.resetValue(accumulator, coin);
-    }
+    if (GetAccumulatorValue(nHeightCheckpoint, coin.getDenomination(), bnAccValue))
+        accumulator.setValue(bnAccValue);
+    witnessAccumulator = accumulator;
 
     //add the pubcoins from the blockchain up to the next checksum starting from the block
     CBlockIndex* pindex = chainActive[nHeightCheckpoint - 10];
@@ -409,14 +398,12 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     if (pindexCheckpoint)
         nHeightStop = pindexCheckpoint->nHeight - 10;
 
-    //Iterate through the chain and calculate the witness
+    //Walk the chain to where the witness stops
     int nCheckpointsAdded = 0;
-    nMintsAdded = 0;
     RandomizeSecurityLevel(nSecurityLevel); //make security level not always the same and predictable
-    libzerocoin::Accumulator witnessAccumulator = accumulator;
-
+    range.nHeightEnd = nChainHeight + 1;
     while (pindex) {
-        if (pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
+        if (pindex->nHeight != range.nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
             ++nCheckpointsAdded;
 
         //If the security level is satisfied, or the stop height is reached, then initialize the accumulator from here
@@ -428,69 +415,279 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
                 return error("%s : failed to find checksum in database for accumulator", __func__);
 
             accumulator.setValue(bnAccValue);
+            range.nHeightEnd = pindex->nHeight;
             break;
         }
 
-        nMintsAdded += AddBlockMintsToAccumulator(coin, nHeightMintAdded, pindex, &witnessAccumulator, true);
-
         pindex = chainActive.Next(pindex);
     }
 
-    witness.resetValue(witnessAccumulator, coin);
-    if (!witness.VerifyWitness(accumulator, coin))
-        return error("%s: failed to verify witness", __func__);
+    return true;
+}
 
-    // A certain amount of accumulated coins are required
-    if (nMintsAdded < Params().Zerocoin_RequiredAccumulation()) {
-        strError = _(strprintf("Less than %d mints added, unable to create spend", Params().Zerocoin_RequiredAccumulation()).c_str());
-        return error("%s : %s", __func__, strError);
+// Accumulate the witnesses of the coins, taken in turn by each worker thread
+static void AccumulateWitnesses(const vector<PublicCoin>& vCoins, const vector<CWitnessRange>& vRanges, const map<int, list<PublicCoin> >& mapBlockPubcoins,
+    const vector<Accumulator>& vAccumulators, vector<Accumulator>& vWitnessAccumulators, vector<AccumulatorWitness>& vWitnesses,
+    vector<int>& vMintsAdded, vector<string>& vError, std::atomic<size_t>& nNext)
+{
+    for (size_t i = nNext++; i < vCoins.size(); i = nNext++) {
+        const PublicCoin& coin = vCoins[i];
+        const CWitnessRange& range = vRanges[i];
+        try {
+            int nMintsAdded = 0;
+            map<int, list<PublicCoin> >::const_iterator it = mapBlockPubcoins.lower_bound(range.nAccStartHeight);
+            for (; it != mapBlockPubcoins.end() && it->first < range.nHeightEnd; it++) {
+                for (const PublicCoin& pubcoin : it->second) {
+                    if (pubcoin.getDenomination() != coin.getDenomination())
+                        continue;
+
+                    if (it->first == range.nHeightMintAdded && pubcoin.getValue() == coin.getValue())
+                        continue;
+
+                    vWitnessAccumulators[i].increment(pubcoin.getValue());
+                    ++nMintsAdded;
+                }
+            }
+
+            vWitnesses[i].resetValue(vWitnessAccumulators[i], coin);
+            if (!vWitnesses[i].VerifyWitness(vAccumulators[i], coin)) {
+                vError[i] = "failed to verify witness";
+                continue;
+            }
+
+            // A certain amount of accumulated coins are required
+            if (nMintsAdded < Params().Zerocoin_RequiredAccumulation()) {
+                vError[i] = _(strprintf("Less than %d mints added, unable to create spend", Params().Zerocoin_RequiredAccumulation()).c_str());
+                continue;
+            }
+
+            // add how many mints of this denomination existed in the accumulator we initialized
+            vMintsAdded[i] = nMintsAdded + range.nMintsBefore;
+        } catch (const std::exception& e) {
+            vError[i] = e.what();
+        }
+    }
+}
+
+bool GenerateAccumulatorWitnesses(const vector<PublicCoin>& vCoins, vector<Accumulator>& vAccumulators, vector<AccumulatorWitness>& vWitnesses, int nSecurityLevel, vector<int>& vMintsAdded, string& strError, CBlockIndex* pindexCheckpoint)
+{
+    LogPrint("zero", "%s: generating %u witnesses\n", __func__, vCoins.size());
+    int nLockAttempts = 0;
+    while (nLockAttempts < 100) {
+        TRY_LOCK(cs_main, lockMain);
+        if(!lockMain) {
+            MilliSleep(50);
+            nLockAttempts++;
+            continue;
+        }
+        break;
+    }
+    if (nLockAttempts == 100)
+        return error("%s: could not get lock on cs_main", __func__);
+    LogPrint("zero", "%s: after lock\n", __func__);
+
+    vector<CWitnessRange> vRanges(vCoins.size());
+    vector<Accumulator> vWitnessAccumulators(vAccumulators);
+    int nHeightBegin = std::numeric_limits<int>::max();
+    int nHeightEnd = 0;
+    for (unsigned int i = 0; i < vCoins.size(); i++) {
+        if (!GetWitnessRange(vCoins[i], vAccumulators[i], vWitnessAccumulators[i], nSecurityLevel, pindexCheckpoint, vRanges[i]))
+            return false;
+        nHeightBegin = std::min(nHeightBegin, vRanges[i].nAccStartHeight);
+        nHeightEnd = std::max(nHeightEnd, vRanges[i].nHeightEnd);
+    }
+
+    // Count the mints accumulated before each witness starts, in one pass from the genesis block
+    vector<pair<int, size_t> > vByStart;
+    map<CoinDenomination, int> mapMintCount;
+    for (size_t i = 0; i < vCoins.size(); i++) {
+        vByStart.push_back(make_pair(vRanges[i].nAccStartHeight, i));
+        mapMintCount[vCoins[i].getDenomination()] = 0;
+    }
+    sort(vByStart.begin(), vByStart.end());
+    CBlockIndex* pindex = chainActive.Genesis();
+    for (const pair<int, size_t>& start : vByStart) {
+        while (pindex && pindex->nHeight < start.first) {
+            for (auto& denomCount : mapMintCount)
+                denomCount.second += pindex->GetMintCount(denomCount.first);
+            pindex = chainActive.Next(pindex);
+        }
+        vRanges[start.second].nMintsBefore = mapMintCount[vCoins[start.second].getDenomination()];
+    }
+
+    // Read each block with mints that go into any of the witnesses once
+    map<int, list<PublicCoin> > mapBlockPubcoins;
+    for (int nHeight = nHeightBegin; nHeight < nHeightEnd && nHeight <= chainActive.Height(); nHeight++) {
+        pindex = chainActive[nHeight];
+        bool fNeeded = false;
+        for (unsigned int i = 0; i < vCoins.size() && !fNeeded; i++)
+            fNeeded = nHeight >= vRanges[i].nAccStartHeight && nHeight < vRanges[i].nHeightEnd && pindex->MintedDenomination(vCoins[i].getDenomination());
+        if (!fNeeded)
+            continue;
+
+        boost::shared_ptr<const CBlock> pblock;
+        if (!ReadBlockFromDiskCached(pblock, pindex))
+            return error("%s: failed to read block from disk while adding pubcoins to witness", __func__);
+
+        if (!BlockToPubcoinList(*pblock, mapBlockPubcoins[nHeight]))
+            return error("%s: failed to get zerocoin mintlist from block %d\n", __func__, nHeight);
     }
 
-    // calculate how many mints of this denomination existed in the accumulator we initialized
-    nMintsAdded += ComputeAccumulatedCoins(nAccStartHeight, coin.getDenomination());
-    LogPrint("zero", "%s : %d mints added to witness\n", __func__, nMintsAdded);
+    // Accumulating is the expensive part, each witness is done on a worker thread
+    vMintsAdded.assign(vCoins.size(), 0);
+    vector<string> vError(vCoins.size());
+    std::atomic<size_t> nNext(0);
+    int nThreads = std::min(std::max(1, nScriptCheckThreads), (int)vCoins.size());
+    if (nThreads <= 1) {
+        AccumulateWitnesses(vCoins, vRanges, mapBlockPubcoins, vAccumulators, vWitnessAccumulators, vWitnesses, vMintsAdded, vError, nNext);
+    } else {
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&AccumulateWitnesses, boost::cref(vCoins), boost::cref(vRanges), boost::cref(mapBlockPubcoins), boost::cref(vAccumulators),
+                boost::ref(vWitnessAccumulators), boost::ref(vWitnesses), boost::ref(vMintsAdded), boost::ref(vError), boost::ref(nNext)));
+        threadGroup.join_all();
+    }
+
+    for (unsigned int i = 0; i < vCoins.size(); i++) {
+        if (!vError[i].empty()) {
+            strError = vError[i];
+            return error("%s : %s", __func__, strError);
+        }
+        LogPrint("zero", "%s : %d mints added to witness\n", __func__, vMintsAdded[i]);
+    }
 
     return true;
 }
 
-map<CoinDenomination, int> GetMintMaturityHeight()
+/**
+ * Mint maturity. A mint is mature once Zerocoin_RequiredAccumulation mints of its
+ * denomination have been added in blocks at least Zerocoin_MintRequiredConfirmations
+ * deep. For every denomination the recent blocks with mints of it are kept with their
+ * counts, updated as blocks are connected and disconnected, and the heights are
+ * published in atomics so readers take no lock and walk no chain.
+ */
+static CCriticalSection cs_mintMaturity;
+//! Per denomination the height and mint count of recent blocks with such mints, oldest first
+static std::deque<pair<int, int> > vRecentMints[ZEROCOIN_DENOM_COUNT];
+//! Tip vRecentMints is up to date with, NULL until it has been loaded
+static const CBlockIndex* pindexRecentMints = NULL;
+//! Whether older blocks than those in vRecentMints have mints of the denomination
+static bool fRecentMintsPruned[ZEROCOIN_DENOM_COUNT];
+static std::atomic<int> nMintMaturityHeight[ZEROCOIN_DENOM_COUNT];
+
+//! Blocks are kept until they can't be needed again after a reorganization
+static int GetMintPruneDepth()
 {
-    map<CoinDenomination, pair<int, int > > mapDenomMaturity;
-    for (auto denom : libzerocoin::zerocoinDenomList)
-        mapDenomMaturity.insert(make_pair(denom, make_pair(0, 0)));
+    return GetArg("-maxreorg", Params().MaxReorganizationDepth());
+}
 
-    int nConfirmedHeight = chainActive.Height() - Params().Zerocoin_MintRequiredConfirmations();
+static int GetMintConfirmedHeight(int nTipHeight)
+{
+    return nTipHeight - Params().Zerocoin_MintRequiredConfirmations();
+}
 
+// Walking back from nConfirmedHeight, the height at which enough mints have been added, 0 if there is none
+static int GetRecentMintMaturityHeight(const std::deque<pair<int, int> >& vMints, int nConfirmedHeight)
+{
     // A mint need to get to at least the min maturity height before it will spend.
     int nMinimumMaturityHeight = nConfirmedHeight - (nConfirmedHeight % 10);
-    CBlockIndex* pindex = chainActive[nConfirmedHeight];
+    int nCount = 0;
+    for (std::deque<pair<int, int> >::const_reverse_iterator it = vMints.rbegin(); it != vMints.rend(); ++it) {
+        if (it->first > nConfirmedHeight)
+            continue;
+        nCount += it->second;
+        if (nCount >= Params().Zerocoin_RequiredAccumulation())
+            return std::min(it->first, nMinimumMaturityHeight);
+    }
+    return 0;
+}
 
-    while (pindex) {
-        bool isFinished = true;
-        for (auto denom : libzerocoin::zerocoinDenomList) {
-            //If the denom has not already had a mint added to it, then see if it has a mint added on this block
-            if (mapDenomMaturity.at(denom).first < Params().Zerocoin_RequiredAccumulation()) {
-                mapDenomMaturity.at(denom).first += count(pindex->vMintDenominationsInBlock.begin(),
-                                                          pindex->vMintDenominationsInBlock.end(), denom);
-
-                //if mint was found then record this block as the first block that maturity occurs.
-                if (mapDenomMaturity.at(denom).first >= Params().Zerocoin_RequiredAccumulation())
-                    mapDenomMaturity.at(denom).second = std::min(pindex->nHeight, nMinimumMaturityHeight);
-
-                //Signal that we are finished
-                isFinished = false;
+// Drop the oldest blocks that are no longer needed, even if the chain is reorganized. Requires cs_mintMaturity.
+static void PruneRecentMints(int i, int nTipHeight)
+{
+    int nKeepAbove = GetMintConfirmedHeight(nTipHeight - GetMintPruneDepth());
+    std::deque<pair<int, int> >& vMints = vRecentMints[i];
+    int nCount = 0;
+    for (unsigned int j = 0; j < vMints.size() && vMints[j].first <= nKeepAbove; j++)
+        nCount += vMints[j].second;
+    while (!vMints.empty() && vMints.front().first <= nKeepAbove && nCount - vMints.front().second >= Params().Zerocoin_RequiredAccumulation()) {
+        nCount -= vMints.front().second;
+        vMints.pop_front();
+        fRecentMintsPruned[i] = true;
+    }
+}
+
+// Read the recent mints back from the block index. Requires cs_main and cs_mintMaturity.
+static void LoadRecentMints(const CBlockIndex* pindexTip)
+{
+    int nKeepAbove = GetMintConfirmedHeight((pindexTip ? pindexTip->nHeight : 0) - GetMintPruneDepth());
+    int nCount[ZEROCOIN_DENOM_COUNT] = {};
+    for (int i = 0; i < ZEROCOIN_DENOM_COUNT; i++) {
+        vRecentMints[i].clear();
+        fRecentMintsPruned[i] = false;
+    }
+
+    for (const CBlockIndex* pindex = pindexTip; pindex; pindex = pindex->pprev) {
+        bool fFinished = true;
+        for (int i = 0; i < ZEROCOIN_DENOM_COUNT; i++) {
+            if (nCount[i] >= Params().Zerocoin_RequiredAccumulation()) {
+                fRecentMintsPruned[i] = true;
+                continue;
             }
+            fFinished = false;
+            int nMints = pindex->GetMintCount(libzerocoin::zerocoinDenomList[i]);
+            if (nMints == 0)
+                continue;
+            vRecentMints[i].push_front(make_pair(pindex->nHeight, nMints));
+            if (pindex->nHeight <= nKeepAbove)
+                nCount[i] += nMints;
         }
-
-        if (isFinished)
+        if (fFinished)
             break;
-        pindex = chainActive[pindex->nHeight - 1];
     }
+    pindexRecentMints = pindexTip;
+}
 
-    //Generate final map
-    map<CoinDenomination, int> mapRet;
-    for (auto denom : libzerocoin::zerocoinDenomList)
-        mapRet.insert(make_pair(denom, mapDenomMaturity.at(denom).second));
+void UpdateMintMaturityHeight(const CBlockIndex* pindexTip)
+{
+    LOCK(cs_mintMaturity);
+    if (pindexTip && pindexRecentMints && pindexTip->pprev == pindexRecentMints) {
+        // A block was connected
+        for (int i = 0; i < ZEROCOIN_DENOM_COUNT; i++) {
+            int nMints = pindexTip->GetMintCount(libzerocoin::zerocoinDenomList[i]);
+            if (nMints > 0)
+                vRecentMints[i].push_back(make_pair(pindexTip->nHeight, nMints));
+        }
+        pindexRecentMints = pindexTip;
+    } else if (pindexTip && pindexRecentMints && pindexRecentMints->pprev == pindexTip) {
+        // A block was disconnected
+        for (int i = 0; i < ZEROCOIN_DENOM_COUNT; i++) {
+            if (!vRecentMints[i].empty() && vRecentMints[i].back().first == pindexRecentMints->nHeight)
+                vRecentMints[i].pop_back();
+        }
+        pindexRecentMints = pindexTip;
+    } else if (pindexTip != pindexRecentMints) {
+        LoadRecentMints(pindexTip);
+    }
 
+    int nTipHeight = pindexTip ? pindexTip->nHeight : -1;
+    int nConfirmedHeight = GetMintConfirmedHeight(nTipHeight);
+    for (int i = 0; i < ZEROCOIN_DENOM_COUNT; i++) {
+        int nHeight = GetRecentMintMaturityHeight(vRecentMints[i], nConfirmedHeight);
+        if (nHeight == 0 && fRecentMintsPruned[i]) {
+            // Disconnected further back than the blocks that were kept
+            LoadRecentMints(pindexTip);
+            nHeight = GetRecentMintMaturityHeight(vRecentMints[i], nConfirmedHeight);
+        }
+        nMintMaturityHeight[i] = nHeight;
+        PruneRecentMints(i, nTipHeight);
+    }
+}
+
+map<CoinDenomination, int> GetMintMaturityHeight()
+{
+    map<CoinDenomination, int> mapRet;
+    for (int i = 0; i < ZEROCOIN_DENOM_COUNT; i++)
+        mapRet.insert(make_pair(libzerocoin::zerocoinDenomList[i], nMintMaturityHeight[i].load()));
     return mapRet;
 }
@@ -16,14 +16,22 @@
 
 class CBlockIndex;
 
+/** Height each denomination's mints have to be below to be spendable, at the current tip */
 std::map<libzerocoin::CoinDenomination, int> GetMintMaturityHeight();
-bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, CBlockIndex* pindexCheckpoint = nullptr);
+//! Update the mint maturity heights for a new tip, one block connected to or disconnected from the last one. Requires cs_main.
+void UpdateMintMaturityHeight(const CBlockIndex* pindexTip);
+/**
+ * Generate the witnesses for spending several coins at once. The blocks with
+ * mints that go into the witnesses are read in one pass over the chain, and the
+ * witnesses are accumulated on worker threads. vAccumulators and vWitnesses
+ * hold one entry per coin, of the coin's denomination.
+ */
+bool GenerateAccumulatorWitnesses(const std::vector<libzerocoin::PublicCoin>& vCoins, std::vector<libzerocoin::Accumulator>& vAccumulators, std::vector<libzerocoin::AccumulatorWitness>& vWitnesses, int nSecurityLevel, std::vector<int>& vMintsAdded, std::string& strError, CBlockIndex* pindexCheckpoint = nullptr);
 bool GetAccumulatorValueFromDB(uint256 nCheckpoint, libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue);
 void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue, bool fMemoryOnly);
 bool CalculateAccumulatorCheckpoint(int nHeight, uint256& nCheckpoint, AccumulatorMap& mapAccumulators);
 void DatabaseChecksums(AccumulatorMap& mapAccumulators);
-bool LoadAccumulatorValuesFromDB(const uint256 nCheckpoint);
 bool EraseAccumulatorValues(const uint256& nCheckpointErase, const uint256& nCheckpointPrevious);
 uint32_t ParseChecksum(uint256 nChecksum, libzerocoin::CoinDenomination denomination);
 uint32_t GetChecksum(const CBigNum &bnValue);
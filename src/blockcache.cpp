@@ -0,0 +1,74 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "clientversion.h"
+#include "serialize.h"
+
+CBlockCache blockCache;
+
+void CBlockCache::EvictLocked()
+{
+    while (nSize > nMaxSize && !listUsed.empty()) {
+        boost::unordered_map<uint256, CEntry, CHasher>::iterator it = mapBlocks.find(listUsed.back());
+        nSize -= it->second.nSize;
+        mapBlocks.erase(it);
+        listUsed.pop_back();
+    }
+}
+
+boost::shared_ptr<const CBlock> CBlockCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    boost::unordered_map<uint256, CEntry, CHasher>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end()) {
+        nMisses++;
+        return boost::shared_ptr<const CBlock>();
+    }
+    nHits++;
+    listUsed.splice(listUsed.begin(), listUsed, it->second.itUsed);
+    return it->second.pblock;
+}
+
+void CBlockCache::Insert(const boost::shared_ptr<const CBlock>& pblock)
+{
+    uint256 hash = pblock->GetHash();
+    size_t nBlockSize = ::GetSerializeSize(*pblock, SER_NETWORK, CLIENT_VERSION);
+    LOCK(cs);
+    if (nBlockSize > nMaxSize || mapBlocks.count(hash))
+        return;
+    listUsed.push_front(hash);
+    CEntry& entry = mapBlocks[hash];
+    entry.pblock = pblock;
+    entry.nSize = nBlockSize;
+    entry.itUsed = listUsed.begin();
+    nSize += nBlockSize;
+    EvictLocked();
+}
+
+void CBlockCache::SetMaxSize(size_t nMaxSizeIn)
+{
+    LOCK(cs);
+    nMaxSize = nMaxSizeIn;
+    EvictLocked();
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    mapBlocks.clear();
+    listUsed.clear();
+    nSize = 0;
+}
+
+void CBlockCache::GetStats(size_t& nEntries, size_t& nSizeOut, size_t& nMaxSizeOut, uint64_t& nHitsOut, uint64_t& nMissesOut) const
+{
+    LOCK(cs);
+    nEntries = mapBlocks.size();
+    nSizeOut = nSize;
+    nMaxSizeOut = nMaxSize;
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
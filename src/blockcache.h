@@ -0,0 +1,68 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBERTY_BLOCKCACHE_H
+#define LIBERTY_BLOCKCACHE_H
+
+#include "primitives/block.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
+/** Default for -blockcachesize, the serialized size of decoded blocks kept in memory (MiB) */
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 32;
+
+/**
+ * Recently connected or read blocks, decoded and shared between readers, so
+ * the blocks the wallet, zerocoin and RPC code keep going back to aren't read
+ * and deserialized again each time. Bounded by the serialized size of the
+ * blocks, the least recently used ones are dropped first.
+ *
+ * Cached blocks are shared between threads and must not be modified. As
+ * CBlock keeps its merkle tree in a mutable member, code that builds it
+ * (CheckBlock, SetMerkleBranch) has to work on a copy.
+ */
+class CBlockCache
+{
+private:
+    struct CEntry {
+        boost::shared_ptr<const CBlock> pblock;
+        size_t nSize;
+        std::list<uint256>::iterator itUsed;
+    };
+
+    struct CHasher {
+        size_t operator()(const uint256& hash) const { return hash.GetLow64(); }
+    };
+
+    mutable CCriticalSection cs;
+    boost::unordered_map<uint256, CEntry, CHasher> mapBlocks;
+    //! hashes from most to least recently used
+    std::list<uint256> listUsed;
+    size_t nSize;
+    size_t nMaxSize;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void EvictLocked();
+
+public:
+    CBlockCache(size_t nMaxSizeIn = DEFAULT_BLOCK_CACHE_SIZE << 20) : nSize(0), nMaxSize(nMaxSizeIn), nHits(0), nMisses(0) {}
+
+    //! The cached block with this hash, or NULL
+    boost::shared_ptr<const CBlock> Get(const uint256& hash);
+    void Insert(const boost::shared_ptr<const CBlock>& pblock);
+    void SetMaxSize(size_t nMaxSizeIn);
+    void Clear();
+
+    void GetStats(size_t& nEntries, size_t& nSizeOut, size_t& nMaxSizeOut, uint64_t& nHitsOut, uint64_t& nMissesOut) const;
+};
+
+extern CBlockCache blockCache;
+
+#endif // LIBERTY_BLOCKCACHE_H
@@ -0,0 +1,207 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "hash.h"
+#include "random.h"
+#include "sync.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <limits>
+
+#include <boost/foreach.hpp>
+#include <boost/unordered_map.hpp>
+
+static CCriticalSection cs_compactBlockStats;
+static CCompactBlockStats compactBlockStats;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) : header(block.GetBlockHeader()),
+                                                                              nonce(GetRand(std::numeric_limits<uint64_t>::max())),
+                                                                              vchBlockSig(block.vchBlockSig)
+{
+    // The coinbase and the coinstake are never in anybody's mempool
+    size_t nPrefill = block.IsProofOfStake() ? 2 : 1;
+    uint64_t k0, k1;
+    GetShortIDKeys(k0, k1);
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        if (i < nPrefill)
+            prefilledtxn.push_back(CPrefilledTransaction(i, block.vtx[i]));
+        else
+            shorttxids.push_back(GetShortID(k0, k1, block.vtx[i].GetHash()));
+    }
+}
+
+void CBlockHeaderAndShortTxIDs::GetShortIDKeys(uint64_t& k0, uint64_t& k1) const
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << header << nonce;
+    uint256 hash = ss.GetHash();
+    k0 = hash.GetLow64();
+    k1 = (hash >> 64).GetLow64();
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(uint64_t k0, uint64_t k1, const uint256& txhash)
+{
+    return SipHashUint256(k0, k1, txhash) & 0xffffffffffffULL;
+}
+
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool)
+{
+    if (cmpctblock.header.IsNull() || cmpctblock.BlockTxCount() == 0)
+        return READ_STATUS_INVALID;
+    if (cmpctblock.BlockTxCount() > std::numeric_limits<uint16_t>::max())
+        return READ_STATUS_INVALID;
+
+    size_t nTxCount = cmpctblock.BlockTxCount();
+    vtxAvailable.assign(nTxCount, CTransaction());
+    vHave.assign(nTxCount, false);
+    nPrefilled = 0;
+    nFromMempool = 0;
+
+    // Prefilled transactions have to come in increasing index order
+    int nLastIndex = -1;
+    BOOST_FOREACH (const CPrefilledTransaction& prefilled, cmpctblock.prefilledtxn) {
+        if ((int)prefilled.index <= nLastIndex || prefilled.index >= nTxCount)
+            return READ_STATUS_INVALID;
+        nLastIndex = prefilled.index;
+        vtxAvailable[prefilled.index] = prefilled.tx;
+        vHave[prefilled.index] = true;
+        nPrefilled++;
+    }
+
+    // Map every short id to the index of its transaction
+    boost::unordered_map<uint64_t, uint16_t> mapShortIDs;
+    size_t nShortID = 0;
+    for (size_t i = 0; i < nTxCount; i++) {
+        if (vHave[i])
+            continue;
+        // Two transactions with the same short id can't be told apart
+        if (!mapShortIDs.insert(std::make_pair(cmpctblock.shorttxids[nShortID++], i)).second)
+            return READ_STATUS_FAILED;
+    }
+
+    uint64_t k0, k1;
+    cmpctblock.GetShortIDKeys(k0, k1);
+
+    std::vector<bool> vCollision(nTxCount, false);
+    {
+        LOCK(pool.cs);
+        for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it) {
+            boost::unordered_map<uint64_t, uint16_t>::const_iterator itID = mapShortIDs.find(CBlockHeaderAndShortTxIDs::GetShortID(k0, k1, it->first));
+            if (itID == mapShortIDs.end())
+                continue;
+
+            uint16_t index = itID->second;
+            if (vCollision[index])
+                continue;
+            if (vHave[index]) {
+                // More than one mempool transaction matches, request it instead of guessing
+                vtxAvailable[index] = CTransaction();
+                vHave[index] = false;
+                vCollision[index] = true;
+                nFromMempool--;
+                continue;
+            }
+            vtxAvailable[index] = it->second.GetTx();
+            vHave[index] = true;
+            nFromMempool++;
+        }
+    }
+
+    header = cmpctblock.header;
+    vchBlockSig = cmpctblock.vchBlockSig;
+    LogPrint("net", "Initialized compact block %s: %u prefilled, %u from mempool, %u missing\n",
+        header.GetHash().ToString(), nPrefilled, nFromMempool, nTxCount - nPrefilled - nFromMempool);
+    return READ_STATUS_OK;
+}
+
+bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const
+{
+    assert(!IsNull());
+    return index < vHave.size() && vHave[index];
+}
+
+void PartiallyDownloadedBlock::GetMissing(std::vector<uint16_t>& vIndexesOut) const
+{
+    vIndexesOut.clear();
+    for (size_t i = 0; i < vHave.size(); i++) {
+        if (!vHave[i])
+            vIndexesOut.push_back(i);
+    }
+}
+
+ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing)
+{
+    assert(!IsNull());
+    block = CBlock(header);
+    block.vchBlockSig = vchBlockSig;
+    block.vtx.resize(vtxAvailable.size());
+
+    size_t nMissing = 0;
+    for (size_t i = 0; i < vtxAvailable.size(); i++) {
+        if (vHave[i]) {
+            block.vtx[i] = vtxAvailable[i];
+        } else {
+            if (nMissing >= vtxMissing.size())
+                return READ_STATUS_INVALID;
+            block.vtx[i] = vtxMissing[nMissing++];
+        }
+    }
+
+    // Only one block can be built from the data
+    header.SetNull();
+    vtxAvailable.clear();
+    vHave.clear();
+
+    if (nMissing != vtxMissing.size())
+        return READ_STATUS_INVALID;
+
+    // A wrong mempool match (short id collision) shows up as a merkle root mismatch
+    bool fMutated = false;
+    if (block.BuildMerkleTree(&fMutated) != block.hashMerkleRoot || fMutated)
+        return READ_STATUS_FAILED;
+
+    return READ_STATUS_OK;
+}
+
+CCompactBlockStats::CCompactBlockStats() : nSent(0), nReceived(0), nReconstructed(0), nRoundTrips(0), nFailed(0),
+                                           nTxPrefilled(0), nTxFromMempool(0), nTxRequested(0),
+                                           nBytesReceived(0), nBytesFullBlocks(0)
+{
+}
+
+void RecordCompactBlockSent()
+{
+    LOCK(cs_compactBlockStats);
+    compactBlockStats.nSent++;
+}
+
+void RecordCompactBlockReceived(const PartiallyDownloadedBlock& partialBlock, size_t nRequested, uint64_t nBytesReceived, uint64_t nFullSize)
+{
+    LOCK(cs_compactBlockStats);
+    compactBlockStats.nReceived++;
+    if (nFullSize == 0) {
+        compactBlockStats.nFailed++;
+        return;
+    }
+
+    if (nRequested == 0)
+        compactBlockStats.nReconstructed++;
+    else
+        compactBlockStats.nRoundTrips++;
+    compactBlockStats.nTxPrefilled += partialBlock.nPrefilled;
+    compactBlockStats.nTxFromMempool += partialBlock.nFromMempool;
+    compactBlockStats.nTxRequested += nRequested;
+    compactBlockStats.nBytesReceived += nBytesReceived;
+    compactBlockStats.nBytesFullBlocks += nFullSize;
+}
+
+void GetCompactBlockStats(CCompactBlockStats& statsOut)
+{
+    LOCK(cs_compactBlockStats);
+    statsOut = compactBlockStats;
+}
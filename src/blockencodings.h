@@ -0,0 +1,224 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBERTY_BLOCKENCODINGS_H
+#define LIBERTY_BLOCKENCODINGS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <stdint.h>
+
+class CTxMemPool;
+
+/** Blocks deeper than this are always sent in full, even when a compact block is requested */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Only answer getblocktxn for blocks at most this deep */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Version of the compact block protocol announced in sendcmpct */
+static const uint64_t CMPCTBLOCK_VERSION = 1;
+
+/** A transaction sent along with a compact block because the receiver can't have it (coinbase, coinstake) */
+class CPrefilledTransaction
+{
+public:
+    uint16_t index;
+    CTransaction tx;
+
+    CPrefilledTransaction() : index(0) {}
+    CPrefilledTransaction(uint16_t indexIn, const CTransaction& txIn) : index(indexIn), tx(txIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(index);
+        READWRITE(tx);
+    }
+};
+
+/** Serializes short transaction ids as 6 byte little endian numbers */
+class CShortTxIDs
+{
+public:
+    static const int SHORTTXIDS_LENGTH = 6;
+
+    CShortTxIDs(std::vector<uint64_t>& vShortIDsIn) : vShortIDs(vShortIDsIn) {}
+
+    unsigned int GetSerializeSize(int, int) const
+    {
+        return GetSizeOfCompactSize(vShortIDs.size()) + vShortIDs.size() * SHORTTXIDS_LENGTH;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int, int) const
+    {
+        WriteCompactSize(s, vShortIDs.size());
+        for (size_t i = 0; i < vShortIDs.size(); i++) {
+            unsigned char buf[SHORTTXIDS_LENGTH];
+            for (int j = 0; j < SHORTTXIDS_LENGTH; j++)
+                buf[j] = (vShortIDs[i] >> (8 * j)) & 0xff;
+            s.write((const char*)buf, SHORTTXIDS_LENGTH);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int, int)
+    {
+        uint64_t nCount = ReadCompactSize(s);
+        vShortIDs.clear();
+        // Don't trust the announced count for the allocation
+        vShortIDs.reserve(std::min(nCount, (uint64_t)MAX_BLOCK_SIZE_CURRENT / 64));
+        for (uint64_t i = 0; i < nCount; i++) {
+            unsigned char buf[SHORTTXIDS_LENGTH];
+            s.read((char*)buf, SHORTTXIDS_LENGTH);
+            uint64_t nShortID = 0;
+            for (int j = 0; j < SHORTTXIDS_LENGTH; j++)
+                nShortID |= (uint64_t)buf[j] << (8 * j);
+            vShortIDs.push_back(nShortID);
+        }
+    }
+
+private:
+    std::vector<uint64_t>& vShortIDs;
+};
+
+/**
+ * A block announced as its header, a 6 byte short id for every transaction the
+ * receiver is expected to have in its mempool and the transactions it can't
+ * have in full.
+ *
+ * Short ids are SipHash-2-4 of the txid, keyed from the header and a random
+ * nonce picked by the sender, so collisions can't be precomputed.
+ */
+class CBlockHeaderAndShortTxIDs
+{
+public:
+    CBlockHeader header;
+    uint64_t nonce;
+    std::vector<uint64_t> shorttxids;
+    std::vector<CPrefilledTransaction> prefilledtxn;
+    std::vector<unsigned char> vchBlockSig;
+
+    CBlockHeaderAndShortTxIDs() : nonce(0) {}
+    explicit CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    //! SipHash keys for the short ids of this block and nonce
+    void GetShortIDKeys(uint64_t& k0, uint64_t& k1) const;
+    //! Short id of a transaction given the keys from GetShortIDKeys
+    static uint64_t GetShortID(uint64_t k0, uint64_t k1, const uint256& txhash);
+
+    //! Number of transactions in the block
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(header);
+        READWRITE(nonce);
+        READWRITE(REF(CShortTxIDs(shorttxids)));
+        READWRITE(prefilledtxn);
+        READWRITE(vchBlockSig);
+    }
+};
+
+/** Request for the transactions of a compact block that couldn't be found in the mempool */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<uint16_t> indexes;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        READWRITE(indexes);
+    }
+};
+
+/** Reply to a CBlockTransactionsRequest, transactions in the requested order */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> txn;
+
+    CBlockTransactions() {}
+    explicit CBlockTransactions(const CBlockTransactionsRequest& req) : blockhash(req.blockhash) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(blockhash);
+        READWRITE(txn);
+    }
+};
+
+enum ReadStatus {
+    READ_STATUS_OK,
+    READ_STATUS_INVALID, //!< Malformed data, the peer misbehaved
+    READ_STATUS_FAILED,  //!< Could not be reconstructed (e.g. short id collision), fetch the full block
+};
+
+/** A block being rebuilt from a compact block, the mempool and a getblocktxn round-trip */
+class PartiallyDownloadedBlock
+{
+public:
+    CBlockHeader header;
+    std::vector<unsigned char> vchBlockSig;
+
+    //! Where the transactions came from, for the statistics
+    int nPrefilled;
+    int nFromMempool;
+
+    PartiallyDownloadedBlock() : nPrefilled(0), nFromMempool(0) {}
+
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool);
+    bool IsNull() const { return header.IsNull(); }
+    bool IsTxAvailable(size_t index) const;
+    //! Indexes of the transactions that still have to be fetched
+    void GetMissing(std::vector<uint16_t>& vIndexesOut) const;
+    //! Build the block from what we have and vtxMissing, in the order given by GetMissing
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing);
+
+private:
+    std::vector<CTransaction> vtxAvailable;
+    std::vector<bool> vHave;
+};
+
+/** Compact block relay statistics since startup */
+struct CCompactBlockStats {
+    uint64_t nSent;
+    uint64_t nReceived;
+    uint64_t nReconstructed;  //!< Rebuilt without a round-trip
+    uint64_t nRoundTrips;     //!< Needed a getblocktxn round-trip
+    uint64_t nFailed;         //!< Fell back to downloading the full block
+    uint64_t nTxPrefilled;
+    uint64_t nTxFromMempool;
+    uint64_t nTxRequested;
+    uint64_t nBytesReceived;  //!< cmpctblock and blocktxn bytes of rebuilt blocks
+    uint64_t nBytesFullBlocks; //!< Size those blocks would have had in full
+
+    CCompactBlockStats();
+};
+
+/** Record a compact block we sent */
+void RecordCompactBlockSent();
+/** Record a compact block we received. nFullSize is 0 when it couldn't be rebuilt. */
+void RecordCompactBlockReceived(const PartiallyDownloadedBlock& partialBlock, size_t nRequested, uint64_t nBytesReceived, uint64_t nFullSize);
+/** Get a copy of the compact block statistics */
+void GetCompactBlockStats(CCompactBlockStats& statsOut);
+
+#endif // LIBERTY_BLOCKENCODINGS_H
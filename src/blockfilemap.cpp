@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "compat.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+CMappedBlockFiles mappedBlockFiles;
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    munmap((void*)pdata, nSize);
+#endif
+}
+
+boost::shared_ptr<CMappedBlockFile> CMappedBlockFiles::GetFile(int nFile)
+{
+    LOCK(cs);
+    std::map<int, std::pair<boost::shared_ptr<CMappedBlockFile>, std::list<int>::iterator> >::iterator it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        listUsed.splice(listUsed.begin(), listUsed, it->second.second);
+        return it->second.first;
+    }
+
+    boost::shared_ptr<CMappedBlockFile> file;
+#ifndef WIN32
+    if (nMaxFiles == 0)
+        return file;
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return file;
+    struct stat st;
+    void* pdata = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        pdata = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pdata == MAP_FAILED) {
+        LogPrint("bench", "%s : could not map %s\n", __func__, path.string());
+        return file;
+    }
+    file.reset(new CMappedBlockFile((const char*)pdata, st.st_size));
+
+    if (mapFiles.size() >= nMaxFiles) {
+        // Readers still holding the dropped file keep it mapped until they are done
+        mapFiles.erase(listUsed.back());
+        listUsed.pop_back();
+    }
+    listUsed.push_front(nFile);
+    mapFiles[nFile] = std::make_pair(file, listUsed.begin());
+    LogPrint("bench", "Mapped %s (%u files mapped)\n", path.filename().string(), (unsigned int)mapFiles.size());
+#endif
+    return file;
+}
+
+bool CMappedBlockFiles::Open(const CDiskBlockPos& pos, CMappedBlockReader& reader)
+{
+    boost::shared_ptr<CMappedBlockFile> file = GetFile(pos.nFile);
+    if (!file)
+        return false;
+
+    // Blocks are stored after the network magic and their size
+    if (pos.nPos < 8 || pos.nPos >= file->nSize)
+        return false;
+    unsigned int nBlockSize = ReadLE32((const unsigned char*)file->pdata + pos.nPos - 4);
+    size_t nEnd = std::min(file->nSize, (size_t)pos.nPos + nBlockSize);
+
+#ifndef WIN32
+    // Fault the whole block in at once, and when blocks are read in the order
+    // they are stored (rescans, reindexing, witness generation) the ones after it.
+    size_t nPageSize = sysconf(_SC_PAGESIZE);
+    size_t nAdviseBegin = pos.nPos / nPageSize * nPageSize;
+    size_t nAdviseEnd = nEnd;
+    size_t nLastReadEnd = file->nLastReadEnd.exchange(nEnd);
+    if (pos.nPos >= nLastReadEnd && pos.nPos - nLastReadEnd < nPageSize)
+        nAdviseEnd = std::min(file->nSize, nEnd + BLOCK_FILE_READAHEAD);
+    madvise((void*)(file->pdata + nAdviseBegin), nAdviseEnd - nAdviseBegin, MADV_WILLNEED);
+#endif
+
+    reader.Init(file, file->pdata + pos.nPos, file->pdata + nEnd);
+    return true;
+}
+
+void CMappedBlockFiles::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+    listUsed.clear();
+}
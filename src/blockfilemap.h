@@ -0,0 +1,127 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBERTY_BLOCKFILEMAP_H
+#define LIBERTY_BLOCKFILEMAP_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <string.h>
+
+#include <boost/shared_ptr.hpp>
+
+struct CDiskBlockPos;
+
+/** Maximum number of block files kept mapped at once (none on 32-bit, where address space is short) */
+static const size_t MAX_MAPPED_BLOCK_FILES = sizeof(void*) > 4 ? 64 : 0;
+/** Amount of a block file read ahead when blocks are read in file order */
+static const size_t BLOCK_FILE_READAHEAD = 4 << 20;
+
+/** Read-only mapping of a whole block file, unmapped when the last reader lets go of it */
+class CMappedBlockFile
+{
+public:
+    const char* pdata;
+    size_t nSize;
+    //! end of the last read, to recognize reads in file order. Readers of the file update it concurrently.
+    std::atomic<size_t> nLastReadEnd;
+
+    CMappedBlockFile(const char* pdataIn, size_t nSizeIn) : pdata(pdataIn), nSize(nSizeIn), nLastReadEnd(0) {}
+    ~CMappedBlockFile();
+
+private:
+    CMappedBlockFile(const CMappedBlockFile&);
+    void operator=(const CMappedBlockFile&);
+};
+
+/**
+ * Deserializes one block straight out of a mapped block file. Reads past the
+ * end of the block throw, like reads past the end of a CAutoFile.
+ */
+class CMappedBlockReader
+{
+private:
+    boost::shared_ptr<CMappedBlockFile> file;
+    const char* pbegin;
+    const char* pend;
+    int nType;
+    int nVersion;
+
+public:
+    CMappedBlockReader(int nTypeIn, int nVersionIn) : pbegin(NULL), pend(NULL), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    void Init(const boost::shared_ptr<CMappedBlockFile>& fileIn, const char* pbeginIn, const char* pendIn)
+    {
+        file = fileIn;
+        pbegin = pbeginIn;
+        pend = pendIn;
+    }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+
+    CMappedBlockReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pbegin))
+            throw std::ios_base::failure("CMappedBlockReader::read : end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+        return *this;
+    }
+
+    CMappedBlockReader& ignore(size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pbegin))
+            throw std::ios_base::failure("CMappedBlockReader::ignore : end of data");
+        pbegin += nSize;
+        return *this;
+    }
+
+    template <typename T>
+    CMappedBlockReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/**
+ * Memory mappings of finished block files, so blocks and transactions are
+ * deserialized from the page cache instead of going through fopen, fseek and
+ * fread on every read. At most MAX_MAPPED_BLOCK_FILES are mapped; the least
+ * recently used one is dropped to make room. Files still being appended to
+ * are never mapped, their reads go through the regular file functions.
+ */
+class CMappedBlockFiles
+{
+private:
+    CCriticalSection cs;
+    size_t nMaxFiles;
+    std::map<int, std::pair<boost::shared_ptr<CMappedBlockFile>, std::list<int>::iterator> > mapFiles;
+    //! files from most to least recently used
+    std::list<int> listUsed;
+
+    boost::shared_ptr<CMappedBlockFile> GetFile(int nFile);
+
+public:
+    CMappedBlockFiles(size_t nMaxFilesIn = MAX_MAPPED_BLOCK_FILES) : nMaxFiles(nMaxFilesIn) {}
+
+    /**
+     * Point reader at the block stored at pos in a finished block file.
+     * Returns false if the file can't be mapped, and the caller reads it the
+     * regular way.
+     */
+    bool Open(const CDiskBlockPos& pos, CMappedBlockReader& reader);
+
+    //! Unmap all files (once the last reader lets go of them)
+    void Clear();
+};
+
+extern CMappedBlockFiles mappedBlockFiles;
+
+#endif // LIBERTY_BLOCKFILEMAP_H
@@ -0,0 +1,161 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockpipeline.h"
+
+#include "net.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+CBlockPipeline blockPipeline;
+
+CBlockPipeline::CBlockPipeline() : fRunning(false), nTimeCheckTotal(0), nTimeConnectTotal(0), nBlocksConnected(0)
+{
+}
+
+void CBlockPipeline::Start(boost::thread_group& threadGroup, int nCheckThreads, CheckHandler checkIn, ConnectHandler connectIn)
+{
+    assert(!fRunning && nCheckThreads > 0);
+    check = checkIn;
+    connect = connectIn;
+
+    for (int i = 0; i < nCheckThreads; i++) {
+        boost::function<void()> fn = boost::bind(&CBlockPipeline::CheckLoop, this);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "blockcheck", fn));
+    }
+    boost::function<void()> fn = boost::bind(&CBlockPipeline::ConnectLoop, this);
+    threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "blockconnect", fn));
+    fRunning = true;
+}
+
+bool CBlockPipeline::Push(CNode* pnode, CBlock& block)
+{
+    if (!fRunning)
+        return false;
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (queue.size() >= MAX_BLOCK_PIPELINE_QUEUE)
+            return false;
+
+        {
+            LOCK(cs_vNodes);
+            pnode->AddRef();
+        }
+        boost::shared_ptr<Item> item(new Item(pnode));
+        item->block = CBlock(block.GetBlockHeader());
+        item->block.vtx.swap(block.vtx);
+        item->block.vchBlockSig.swap(block.vchBlockSig);
+        item->nTimeQueued = GetTimeMicros();
+        queue.push_back(item);
+        hashLastQueued = item->block.GetHash();
+    }
+    condCheck.notify_one();
+    return true;
+}
+
+bool CBlockPipeline::IsLastQueued(const uint256& hash) const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return fRunning && hashLastQueued != 0 && hash == hashLastQueued;
+}
+
+size_t CBlockPipeline::Size() const
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return queue.size();
+}
+
+void CBlockPipeline::CheckLoop()
+{
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        boost::shared_ptr<Item> item;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!item) {
+                for (std::deque<boost::shared_ptr<Item> >::iterator it = queue.begin(); it != queue.end(); ++it) {
+                    if (!(*it)->fClaimed) {
+                        item = *it;
+                        break;
+                    }
+                }
+                if (!item)
+                    condCheck.wait(lock);
+            }
+            item->fClaimed = true;
+        }
+
+        int64_t nTimeStart = GetTimeMicros();
+        bool fChecked = check(item->block);
+        int64_t nTimeEnd = GetTimeMicros();
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            item->fChecked = fChecked;
+            item->fDone = true;
+            item->nTimeChecked = nTimeEnd;
+            nTimeCheckTotal += nTimeEnd - nTimeStart;
+        }
+        condConnect.notify_one();
+    }
+}
+
+void CBlockPipeline::ConnectLoop()
+{
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        boost::shared_ptr<Item> item;
+        size_t nQueued;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Blocks are connected in the order they arrived, however fast they were checked
+            while (queue.empty() || !queue.front()->fDone)
+                condConnect.wait(lock);
+            item = queue.front();
+            queue.pop_front();
+            nQueued = queue.size();
+        }
+
+        int64_t nTimeStart = GetTimeMicros();
+        try {
+            connect(item->pnode, item->block, item->fChecked);
+        } catch (...) {
+            LOCK(cs_vNodes);
+            item->pnode->Release();
+            throw;
+        }
+        int64_t nTimeEnd = GetTimeMicros();
+
+        {
+            LOCK(cs_vNodes);
+            item->pnode->Release();
+        }
+
+        {
+            // Once connected the block is in mapBlockIndex, or it was rejected
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (queue.empty() && hashLastQueued == item->block.GetHash())
+                hashLastQueued = 0;
+        }
+
+        int64_t nTimeCheckTotalCopy, nTimeConnectTotalCopy;
+        uint64_t nBlocks;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nTimeConnectTotal += nTimeEnd - nTimeStart;
+            nBlocks = ++nBlocksConnected;
+            nTimeCheckTotalCopy = nTimeCheckTotal;
+            nTimeConnectTotalCopy = nTimeConnectTotal;
+        }
+        LogPrint("bench", "- Pipeline block %s: checked after %.2fms, waited %.2fms, connect %.2fms [%u blocks, %.2fs checking, %.2fs connecting, %u queued]\n",
+            item->block.GetHash().ToString(), (item->nTimeChecked - item->nTimeQueued) * 0.001, (nTimeStart - item->nTimeChecked) * 0.001,
+            (nTimeEnd - nTimeStart) * 0.001, nBlocks, nTimeCheckTotalCopy * 0.000001, nTimeConnectTotalCopy * 0.000001, nQueued);
+    }
+}
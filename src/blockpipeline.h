@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBERTY_BLOCKPIPELINE_H
+#define LIBERTY_BLOCKPIPELINE_H
+
+#include "primitives/block.h"
+
+#include <deque>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CNode;
+
+namespace boost
+{
+class thread_group;
+} // namespace boost
+
+/** Default number of threads checking blocks during initial sync (0 = no pipeline, blocks are handled on the message handler thread) */
+static const int DEFAULT_BLOCK_CHECK_THREADS = 0;
+/** Maximum number of block check threads */
+static const int MAX_BLOCK_CHECK_THREADS = 16;
+/** Maximum number of blocks in the pipeline, Push refuses more */
+static const unsigned int MAX_BLOCK_PIPELINE_QUEUE = 64;
+
+/**
+ * Two stage pipeline for blocks received during initial sync.
+ *
+ * Check threads run the context-free block checks (merkle root, signatures,
+ * zerocoin proofs) on whatever blocks are waiting, in any order. A single
+ * connect thread then hands the blocks to validation in the order they
+ * arrived, so storing and connecting them no longer happens on the message
+ * handler thread. A queued block holds a reference to its node until it has
+ * been connected.
+ */
+class CBlockPipeline
+{
+public:
+    //! Context-free checks, returns whether the block passed
+    typedef boost::function<bool(const CBlock&)> CheckHandler;
+    //! Store and connect a block, fChecked tells whether it passed the checks
+    typedef boost::function<void(CNode*, CBlock&, bool)> ConnectHandler;
+
+    CBlockPipeline();
+
+    //! Start nCheckThreads check threads and the connect thread
+    void Start(boost::thread_group& threadGroup, int nCheckThreads, CheckHandler checkIn, ConnectHandler connectIn);
+
+    bool IsRunning() const { return fRunning; }
+
+    /**
+     * Queue a block received from pnode. On success the contents of block are
+     * taken over. Returns false when the pipeline isn't running or is full, a
+     * block refused while running has to be downloaded again.
+     */
+    bool Push(CNode* pnode, CBlock& block);
+
+    //! Whether hash is the last block queued, so the next one can be queued before it is connected
+    bool IsLastQueued(const uint256& hash) const;
+
+    //! Number of blocks waiting to be checked or connected
+    size_t Size() const;
+
+private:
+    struct Item {
+        CNode* pnode;
+        CBlock block;
+        bool fClaimed;
+        bool fDone;
+        bool fChecked;
+        int64_t nTimeQueued;
+        int64_t nTimeChecked;
+
+        Item(CNode* pnodeIn) : pnode(pnodeIn), fClaimed(false), fDone(false), fChecked(false), nTimeQueued(0), nTimeChecked(0) {}
+    };
+
+    mutable boost::mutex mutex;
+    boost::condition_variable condCheck;
+    boost::condition_variable condConnect;
+    std::deque<boost::shared_ptr<Item> > queue;
+    bool fRunning;
+    //! hash of the last block queued, until it has been connected
+    uint256 hashLastQueued;
+
+    CheckHandler check;
+    ConnectHandler connect;
+
+    //! Total time spent in each stage, in microseconds, protected by mutex
+    int64_t nTimeCheckTotal;
+    int64_t nTimeConnectTotal;
+    uint64_t nBlocksConnected;
+
+    void CheckLoop();
+    void ConnectLoop();
+};
+
+extern CBlockPipeline blockPipeline;
+
+#endif // LIBERTY_BLOCKPIPELINE_H
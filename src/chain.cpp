@@ -6,6 +6,8 @@
 
 #include "chain.h"
 
+#include <new>
+
 using namespace std;
 
 /**
@@ -77,4 +79,44 @@ uint256 CBlockIndex::GetBlockTrust() const
         uint256 bnPoWTrust = ((~uint256(0) >> 20) / (bnTarget + 1));
         return bnPoWTrust > 1 ? bnPoWTrust : 1;
     }
-}
\ No newline at end of file
+}
+/**
+ * CBlockIndexArena implementation
+ */
+void* CBlockIndexArena::Reserve()
+{
+    if (nUsed == CHUNK_SIZE) {
+        vChunks.push_back(static_cast<CBlockIndex*>(::operator new(CHUNK_SIZE * sizeof(CBlockIndex))));
+        nUsed = 0;
+    }
+    return vChunks.back() + nUsed++;
+}
+
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    return new (Reserve()) CBlockIndex();
+}
+
+CBlockIndex* CBlockIndexArena::Allocate(const CBlock& block)
+{
+    return new (Reserve()) CBlockIndex(block);
+}
+
+void CBlockIndexArena::Clear()
+{
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        size_t nEntries = (i + 1 == vChunks.size()) ? nUsed : CHUNK_SIZE;
+        for (size_t j = 0; j < nEntries; j++)
+            vChunks[i][j].~CBlockIndex();
+        ::operator delete(vChunks[i]);
+    }
+    vChunks.clear();
+    nUsed = CHUNK_SIZE;
+}
+
+size_t CBlockIndexArena::Size() const
+{
+    if (vChunks.empty())
+        return 0;
+    return (vChunks.size() - 1) * CHUNK_SIZE + nUsed;
+}
@@ -14,6 +14,8 @@
 #include "util.h"
 #include "libzerocoin/Denominations.h"
 
+#include <stdexcept>
+#include <string.h>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -177,9 +179,9 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
     
-    //! zerocoin specific fields
-    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
-    std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+    //! zerocoin specific fields, indexed by position in libzerocoin::zerocoinDenomList
+    int64_t nZerocoinSupply[libzerocoin::ZEROCOIN_DENOM_COUNT];
+    uint32_t nMintDenominationsInBlock[libzerocoin::ZEROCOIN_DENOM_COUNT];
     
     void SetNull()
     {
@@ -211,10 +213,8 @@ public:
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
         // Start supply of each denomination with 0s
-        for (auto& denom : libzerocoin::zerocoinDenomList) {
-            mapZerocoinSupply.insert(make_pair(denom, 0));
-        }
-        vMintDenominationsInBlock.clear();
+        memset(nZerocoinSupply, 0, sizeof(nZerocoinSupply));
+        ClearMints();
     }
 
     CBlockIndex()
@@ -288,18 +288,65 @@ public:
         return block;
     }
 
+    //! Position of denom in the zerocoin arrays, throws like std::map::at for an invalid denomination
+    static int DenomIndex(libzerocoin::CoinDenomination denom)
+    {
+        int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (nIndex < 0)
+            throw std::out_of_range(strprintf("invalid zerocoin denomination %d", denom));
+        return nIndex;
+    }
+
     int64_t GetZerocoinSupply() const
     {
         int64_t nTotal = 0;
         for (auto& denom : libzerocoin::zerocoinDenomList) {
-            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * mapZerocoinSupply.at(denom);
+            nTotal += libzerocoin::ZerocoinDenominationToAmount(denom) * GetZerocoinSupply(denom);
         }
         return nTotal;
     }
 
+    //! Number of coins of denom in circulation as of this block
+    int64_t GetZerocoinSupply(libzerocoin::CoinDenomination denom) const
+    {
+        return nZerocoinSupply[DenomIndex(denom)];
+    }
+
+    void SetZerocoinSupply(libzerocoin::CoinDenomination denom, int64_t nSupply)
+    {
+        nZerocoinSupply[DenomIndex(denom)] = nSupply;
+    }
+
+    void AddZerocoinSupply(libzerocoin::CoinDenomination denom, int64_t nCoins)
+    {
+        nZerocoinSupply[DenomIndex(denom)] += nCoins;
+    }
+
+    //! Start from the supply of pindexPrev
+    void CopyZerocoinSupply(const CBlockIndex* pindexPrev)
+    {
+        memcpy(nZerocoinSupply, pindexPrev->nZerocoinSupply, sizeof(nZerocoinSupply));
+    }
+
+    //! Number of coins of denom minted in this block
+    int GetMintCount(libzerocoin::CoinDenomination denom) const
+    {
+        return nMintDenominationsInBlock[DenomIndex(denom)];
+    }
+
+    void AddMint(libzerocoin::CoinDenomination denom)
+    {
+        nMintDenominationsInBlock[DenomIndex(denom)]++;
+    }
+
+    void ClearMints()
+    {
+        memset(nMintDenominationsInBlock, 0, sizeof(nMintDenominationsInBlock));
+    }
+
     bool MintedDenomination(libzerocoin::CoinDenomination denom) const
     {
-        return std::find(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom) != vMintDenominationsInBlock.end();
+        return GetMintCount(denom) > 0;
     }
 
     uint256 GetBlockHash() const
@@ -418,6 +465,142 @@ public:
     const CBlockIndex* GetAncestor(int height) const;
 };
 
+/**
+ * Serializes the per denomination supply array of a block index entry in the
+ * std::map<CoinDenomination, int64_t> format of the block index database.
+ */
+class CZerocoinSupplyRef
+{
+public:
+    CZerocoinSupplyRef(int64_t* pSupplyIn) : pSupply(pSupplyIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return GetSizeOfCompactSize(libzerocoin::ZEROCOIN_DENOM_COUNT) +
+               libzerocoin::ZEROCOIN_DENOM_COUNT * (::GetSerializeSize(libzerocoin::ZQ_ONE, nType, nVersion) + sizeof(int64_t));
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, libzerocoin::ZEROCOIN_DENOM_COUNT);
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOM_COUNT; i++) {
+            ::Serialize(s, libzerocoin::zerocoinDenomList[i], nType, nVersion);
+            ::Serialize(s, pSupply[i], nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        memset(pSupply, 0, sizeof(int64_t) * libzerocoin::ZEROCOIN_DENOM_COUNT);
+        uint64_t nCount = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nCount; i++) {
+            libzerocoin::CoinDenomination denom;
+            int64_t nSupply;
+            ::Unserialize(s, denom, nType, nVersion);
+            ::Unserialize(s, nSupply, nType, nVersion);
+            int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+            if (nIndex < 0)
+                throw std::ios_base::failure("CZerocoinSupplyRef::Unserialize : invalid denomination");
+            pSupply[nIndex] = nSupply;
+        }
+    }
+
+private:
+    int64_t* pSupply;
+};
+
+/**
+ * Serializes the per denomination mint counts of a block index entry as the
+ * std::vector<CoinDenomination> of the block index database, one entry per mint.
+ */
+class CZerocoinMintsRef
+{
+public:
+    CZerocoinMintsRef(uint32_t* pMintsIn) : pMints(pMintsIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        uint64_t nCount = Count();
+        return GetSizeOfCompactSize(nCount) + nCount * ::GetSerializeSize(libzerocoin::ZQ_ONE, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        WriteCompactSize(s, Count());
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOM_COUNT; i++) {
+            for (uint32_t j = 0; j < pMints[i]; j++)
+                ::Serialize(s, libzerocoin::zerocoinDenomList[i], nType, nVersion);
+        }
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        memset(pMints, 0, sizeof(uint32_t) * libzerocoin::ZEROCOIN_DENOM_COUNT);
+        uint64_t nCount = ReadCompactSize(s);
+        for (uint64_t i = 0; i < nCount; i++) {
+            libzerocoin::CoinDenomination denom;
+            ::Unserialize(s, denom, nType, nVersion);
+            int nIndex = libzerocoin::ZerocoinDenominationToIndex(denom);
+            if (nIndex < 0)
+                throw std::ios_base::failure("CZerocoinMintsRef::Unserialize : invalid denomination");
+            pMints[nIndex]++;
+        }
+    }
+
+private:
+    uint32_t* pMints;
+
+    uint64_t Count() const
+    {
+        uint64_t nCount = 0;
+        for (int i = 0; i < libzerocoin::ZEROCOIN_DENOM_COUNT; i++)
+            nCount += pMints[i];
+        return nCount;
+    }
+};
+
+/**
+ * Block index entries are never freed one by one while the node runs, so they
+ * are allocated from large contiguous chunks instead of one heap node each.
+ * This saves the allocator overhead per entry and keeps entries that were
+ * loaded together close in memory. Not thread safe, callers hold cs_main or
+ * otherwise serialize access.
+ */
+class CBlockIndexArena
+{
+public:
+    CBlockIndexArena() : nUsed(CHUNK_SIZE) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    CBlockIndex* Allocate();
+    CBlockIndex* Allocate(const CBlock& block);
+
+    //! Destroy all entries, pointers handed out before are invalid afterwards
+    void Clear();
+
+    //! Number of entries allocated
+    size_t Size() const;
+    //! Bytes reserved for entries
+    size_t DynamicMemoryUsage() const { return vChunks.size() * CHUNK_SIZE * sizeof(CBlockIndex); }
+
+private:
+    static const size_t CHUNK_SIZE = 4096;
+
+    std::vector<CBlockIndex*> vChunks;
+    //! Entries used in the last chunk
+    size_t nUsed;
+
+    //! Raw memory for the next entry
+    void* Reserve();
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    CBlockIndexArena& operator=(const CBlockIndexArena&);
+};
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
@@ -478,8 +661,8 @@ public:
         READWRITE(nNonce);
         if(this->nVersion > 3) {
             READWRITE(nAccumulatorCheckpoint);
-            READWRITE(mapZerocoinSupply);
-            READWRITE(vMintDenominationsInBlock);
+            READWRITE(REF(CZerocoinSupplyRef(nZerocoinSupply)));
+            READWRITE(REF(CZerocoinMintsRef(nMintDenominationsInBlock)));
         }
 
     }
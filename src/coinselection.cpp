@@ -0,0 +1,111 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinselection.h"
+
+#include "random.h"
+
+#include <limits>
+
+bool SelectCoinsBnB(const std::vector<CAmount>& vValue, const CAmount& nTarget, const CAmount& nCostOfChange, std::vector<char>& vfBest, CAmount& nBest, size_t nMaxTries)
+{
+    CAmount nAvailable = 0;
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        nAvailable += vValue[i];
+    if (nAvailable < nTarget)
+        return false;
+
+    // vfCurr holds the decisions on the coins so far, one per coin in order
+    std::vector<char> vfCurr;
+    vfCurr.reserve(vValue.size());
+    CAmount nCurr = 0;
+    CAmount nBestExcess = std::numeric_limits<CAmount>::max();
+    vfBest.clear();
+
+    for (size_t nTries = 0; nTries < nMaxTries; nTries++) {
+        bool fBacktrack = false;
+        if (nCurr + nAvailable < nTarget || nCurr > nTarget + nCostOfChange) {
+            // Can't reach the target anymore, or already past the window
+            fBacktrack = true;
+        } else if (nCurr >= nTarget) {
+            if (nCurr - nTarget < nBestExcess) {
+                nBestExcess = nCurr - nTarget;
+                vfBest = vfCurr;
+                if (nBestExcess == 0)
+                    break;
+            }
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            // Go back to the last coin taken, and try the branch without it
+            while (!vfCurr.empty() && !vfCurr.back()) {
+                vfCurr.pop_back();
+                nAvailable += vValue[vfCurr.size()];
+            }
+            if (vfCurr.empty())
+                break; // every branch has been searched
+            vfCurr.back() = false;
+            nCurr -= vValue[vfCurr.size() - 1];
+        } else {
+            CAmount nValue = vValue[vfCurr.size()];
+            nAvailable -= nValue;
+            // Taking this coin after leaving out an equal one would only repeat that branch
+            if (!vfCurr.empty() && !vfCurr.back() && nValue == vValue[vfCurr.size() - 1]) {
+                vfCurr.push_back(false);
+            } else {
+                vfCurr.push_back(true);
+                nCurr += nValue;
+            }
+        }
+    }
+
+    if (vfBest.empty())
+        return false;
+    vfBest.resize(vValue.size(), false);
+    nBest = nTarget + nBestExcess;
+    return true;
+}
+
+void ApproximateBestSubset(const std::vector<CAmount>& vValue, const CAmount& nTotalLower, const CAmount& nTarget, std::vector<char>& vfBest, CAmount& nBest, int iterations)
+{
+    std::vector<char> vfIncluded;
+
+    vfBest.assign(vValue.size(), true);
+    nBest = nTotalLower;
+
+    if (!vValue.empty())
+        iterations = std::max(1, std::min(iterations, (int)(KNAPSACK_MAX_STEPS / vValue.size())));
+
+    seed_insecure_rand();
+
+    for (int nRep = 0; nRep < iterations && nBest != nTarget; nRep++) {
+        vfIncluded.assign(vValue.size(), false);
+        CAmount nTotal = 0;
+        bool fReachedTarget = false;
+        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++) {
+            for (unsigned int i = 0; i < vValue.size(); i++) {
+                //The solver here uses a randomized algorithm,
+                //the randomness serves no real security purpose but is just
+                //needed to prevent degenerate behavior and it is important
+                //that the rng is fast. We do not use a constant random sequence,
+                //because there may be some privacy improvement by making
+                //the selection random.
+                if (nPass == 0 ? insecure_rand() & 1 : !vfIncluded[i]) {
+                    nTotal += vValue[i];
+                    vfIncluded[i] = true;
+                    if (nTotal >= nTarget) {
+                        fReachedTarget = true;
+                        if (nTotal < nBest) {
+                            nBest = nTotal;
+                            vfBest = vfIncluded;
+                        }
+                        nTotal -= vValue[i];
+                        vfIncluded[i] = false;
+                    }
+                }
+            }
+        }
+    }
+}
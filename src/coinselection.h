@@ -0,0 +1,32 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBERTY_COINSELECTION_H
+#define LIBERTY_COINSELECTION_H
+
+#include "amount.h"
+
+#include <vector>
+
+/** Maximum number of steps the branch and bound search takes before giving up */
+static const size_t BNB_MAX_TRIES = 100000;
+/** Maximum number of coins looked at, over all iterations, by ApproximateBestSubset */
+static const size_t KNAPSACK_MAX_STEPS = 10000000;
+
+/**
+ * Depth first search for the subset of vValue with a sum between nTarget and
+ * nTarget + nCostOfChange, so the transaction needs no change output. Of the
+ * subsets found, the one with the smallest excess is returned. vValue has to
+ * be in descending order. The search gives up after nMaxTries steps.
+ */
+bool SelectCoinsBnB(const std::vector<CAmount>& vValue, const CAmount& nTarget, const CAmount& nCostOfChange, std::vector<char>& vfBest, CAmount& nBest, size_t nMaxTries = BNB_MAX_TRIES);
+
+/**
+ * Randomized search for the subset of vValue with the smallest sum of at least
+ * nTarget, starting from all of them (nTotalLower). The number of iterations is
+ * reduced for large sets so no more than KNAPSACK_MAX_STEPS coins are looked at.
+ */
+void ApproximateBestSubset(const std::vector<CAmount>& vValue, const CAmount& nTotalLower, const CAmount& nTarget, std::vector<char>& vfBest, CAmount& nBest, int iterations = 1000);
+
+#endif // LIBERTY_COINSELECTION_H
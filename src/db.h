@@ -267,6 +267,47 @@ protected:
         return 0;
     }
 
+    /**
+     * Read as many of the records after the cursor as fit in vchBuffer with a
+     * single bulk get, appending them to vRecords. The buffer is grown when the
+     * next record doesn't fit in it on its own.
+     */
+    template <typename Container>
+    int ReadAtCursorBulk(Dbc* pcursor, std::vector<unsigned char>& vchBuffer, Container& vRecords)
+    {
+        Dbt datKey;
+        Dbt datValue;
+        datValue.set_flags(DB_DBT_USERMEM);
+        int ret;
+        while (true) {
+            datValue.set_data(&vchBuffer[0]);
+            datValue.set_ulen(vchBuffer.size());
+            ret = pcursor->get(&datKey, &datValue, DB_MULTIPLE_KEY | DB_NEXT);
+            if (ret != DB_BUFFER_SMALL)
+                break;
+            vchBuffer.resize((datValue.get_size() / 1024 + 1) * 1024);
+        }
+        if (ret != 0)
+            return ret;
+
+        void* p;
+        DB_MULTIPLE_INIT(p, datValue.get_DBT());
+        while (true) {
+            void* pKey;
+            void* pValue;
+            u_int32_t nKeySize, nValueSize;
+            DB_MULTIPLE_KEY_NEXT(p, datValue.get_DBT(), pKey, nKeySize, pValue, nValueSize);
+            if (p == NULL)
+                break;
+            vRecords.push_back(std::make_pair(CDataStream((const char*)pKey, (const char*)pKey + nKeySize, SER_DISK, CLIENT_VERSION),
+                                              CDataStream((const char*)pValue, (const char*)pValue + nValueSize, SER_DISK, CLIENT_VERSION)));
+        }
+
+        // Clear memory
+        memset(&vchBuffer[0], 0, vchBuffer.size());
+        return 0;
+    }
+
 public:
     bool TxnBegin()
     {
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "crypto/common.h"
 #include "crypto/hmac_sha512.h"
 #include "crypto/scrypt.h"
 
@@ -80,6 +81,59 @@ void BIP32Hash(const ChainCode chainCode, unsigned int nChild, unsigned char hea
     CHMAC_SHA512(chainCode.begin(), chainCode.size()).Write(&header, 1).Write(data, 32).Write(num, 4).Finalize(output);
 }
 
+#define ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                      \
+    do {                              \
+        v0 += v1;                     \
+        v1 = ROTL64(v1, 13);          \
+        v1 ^= v0;                     \
+        v0 = ROTL64(v0, 32);          \
+        v2 += v3;                     \
+        v3 = ROTL64(v3, 16);          \
+        v3 ^= v2;                     \
+        v0 += v3;                     \
+        v3 = ROTL64(v3, 21);          \
+        v3 ^= v0;                     \
+        v2 += v1;                     \
+        v1 = ROTL64(v1, 17);          \
+        v1 ^= v2;                     \
+        v2 = ROTL64(v2, 32);          \
+    } while (0)
+
+uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val)
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+
+    // The 32 byte message is processed as four little endian words
+    for (int i = 0; i < 4; i++) {
+        uint64_t m = ReadLE64(val.begin() + 8 * i);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    // Final block only holds the message length
+    uint64_t b = ((uint64_t)32) << 56;
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+#undef SIPROUND
+#undef ROTL64
+
 void scrypt_hash(const char* pass, unsigned int pLen, const char* salt, unsigned int sLen, char* output, unsigned int N, unsigned int r, unsigned int p, unsigned int dkLen)
 {
     scrypt(pass, pLen, salt, sLen, output, N, r, p, dkLen);
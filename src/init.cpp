@@ -15,6 +15,8 @@
 #include "activemasternode.h"
 #include "addrman.h"
 #include "amount.h"
+#include "blockcache.h"
+#include "blockpipeline.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "httpserver.h"
@@ -26,6 +28,7 @@
 #include "masternodeconfig.h"
 #include "masternodeman.h"
 #include "miner.h"
+#include "msgqueue.h"
 #include "net.h"
 #include "rpc/server.h"
 #include "script/standard.h"
@@ -48,6 +51,7 @@
 
 #endif
 
+#include <atomic>
 #include <fstream>
 #include <stdint.h>
 #include <stdio.h>
@@ -171,6 +175,33 @@ static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
 static boost::thread_group threadGroup;
 static CScheduler scheduler;
+
+static const char* const pszStartupTaskNames[STARTUP_TASK_COUNT] = {"rescan", "masternodecaches"};
+static std::atomic<bool> fStartupTaskDeferred[STARTUP_TASK_COUNT];
+static std::atomic<bool> fStartupTaskDone[STARTUP_TASK_COUNT];
+static std::atomic<int64_t> nStartupTaskTime[STARTUP_TASK_COUNT];
+
+bool IsStartupTaskDone(StartupTask task)
+{
+    return fStartupTaskDone[task];
+}
+
+void GetStartupTaskStatus(StartupTask task, std::string& strName, bool& fDeferred, bool& fDone, int64_t& nTime)
+{
+    strName = pszStartupTaskNames[task];
+    fDeferred = fStartupTaskDeferred[task];
+    fDone = fStartupTaskDone[task];
+    nTime = nStartupTaskTime[task];
+}
+
+static void FinishStartupTask(StartupTask task, int64_t nTimeStart)
+{
+    nStartupTaskTime[task] = GetTimeMillis() - nTimeStart;
+    fStartupTaskDone[task] = true;
+    if (fStartupTaskDeferred[task])
+        LogPrintf("Startup task %s finished in the background in %dms\n", pszStartupTaskNames[task], nStartupTaskTime[task]);
+}
+
 void Interrupt()
 {
     InterruptHTTPServer();
@@ -207,9 +238,12 @@ void PrepareShutdown()
     GenerateBitcoins(false, NULL, 0);
 #endif
     StopNode();
-    DumpMasternodes();
-    DumpBudgets();
-    DumpMasternodePayments();
+    // Don't overwrite the caches before they were read
+    if (IsStartupTaskDone(STARTUP_TASK_MASTERNODE_CACHES)) {
+        DumpMasternodes();
+        DumpBudgets();
+        DumpMasternodePayments();
+    }
     UnregisterNodeSignals(GetNodeSignals());
 
     // After everything has been shut down, but before things get flushed, stop the
@@ -239,6 +273,8 @@ void PrepareShutdown()
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinswriter;
+        pcoinswriter = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
@@ -366,6 +402,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
+    strUsage += HelpMessageOpt("-blockcheckthreads=<n>", strprintf(_("Number of threads checking blocks during initial sync, connecting them moves to a dedicated thread (0 to %d, 0 = handle blocks on the message handler thread, default: %d)"), MAX_BLOCK_CHECK_THREADS, DEFAULT_BLOCK_CHECK_THREADS));
+    strUsage += HelpMessageOpt("-blockcachesize=<n>", strprintf(_("Keep up to <n> MiB of recently used blocks decoded in memory (default: %u)"), DEFAULT_BLOCK_CACHE_SIZE));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-blocksizenotify=<cmd>", _("Execute command when the best block changes and its size is over (%s in cmd is replaced by block hash, %d with the block size)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 500));
@@ -377,6 +415,7 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-deferstartup", strprintf(_("Catch the wallet up with the chain and load the masternode caches in the background, after the node is up (default: %u)"), DEFAULT_DEFER_STARTUP));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
     strUsage += HelpMessageOpt("-maxreorg=<n>", strprintf(_("Set the Maximum reorg depth (default: %u)"), Params(CBaseChainParams::MAIN).MaxReorganizationDepth()));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
@@ -399,6 +438,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), 100));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), 14400));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt("-compactblocks", strprintf(_("Exchange new blocks with peers as compact blocks built from the mempool (default: %u)"), DEFAULT_COMPACT_BLOCKS));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s)"));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP address (default: 1 when listening and no -externalip)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + _("(default: 1)"));
@@ -409,6 +449,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), 125));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), 5000));
+    strUsage += HelpMessageOpt("-msgworkers=<n>", strprintf(_("Number of threads that process masternode, budget and SwiftX vote messages (0 to %d, 0 = use the message handler thread, default: %d)"), MAX_MSG_WORKER_THREADS, DEFAULT_MSG_WORKER_THREADS));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), 1000));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
@@ -477,6 +518,9 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf(_("Only accept block chain matching built-in checkpoints (default: %u)"), 1));
+        strUsage += HelpMessageOpt("-dbcompression", _("Compress the tables of every database, or of none with -dbcompression=0 (default: only the block index)"));
+        strUsage += HelpMessageOpt("-dbmaxopenfiles=<n>", _("Keep up to <n> table files of each database open (default: 16 to 256 depending on the database)"));
+        strUsage += HelpMessageOpt("-dbverifychecksums", strprintf(_("Verify checksums on database point reads, scans always do (default: %u)"), DEFAULT_DB_VERIFY_CHECKSUMS));
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf(_("Flush database activity from memory pool to disk log every <n> megabytes (default: %u)"), 100));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf(_("Disable safemode, override a real safe mode event (default: %u)"), 0));
         strUsage += HelpMessageOpt("-testsafemode", strprintf(_("Force safe mode (default: %u)"), 0));
@@ -620,6 +664,129 @@ static void BlockSizeNotifyCallback(int size, const uint256& hashNewTip)
     boost::thread t(runCommand, strCmd); // thread runs free
 }
 
+/**
+ * Read mncache.dat, budget.dat and mnpayments.dat, see STARTUP_TASK_MASTERNODE_CACHES.
+ * Block creation and the RPCs may use the globals while this runs, so each file is
+ * read into a temporary object that is then swapped in under the global's lock.
+ */
+static void LoadMasternodeCaches()
+{
+    int64_t nStart = GetTimeMillis();
+    CMasternodeMan mnodemanLoaded;
+    CMasternodeDB mndb;
+    CMasternodeDB::ReadResult readResult = mndb.Read(mnodemanLoaded);
+    if (readResult == CMasternodeDB::FileError)
+        LogPrintf("Missing masternode cache file - mncache.dat, will try to recreate\n");
+    else if (readResult != CMasternodeDB::Ok) {
+        LogPrintf("Error reading mncache.dat: ");
+        if (readResult == CMasternodeDB::IncorrectFormat)
+            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
+        else
+            LogPrintf("file format is unknown or invalid, please fix it manually\n");
+    }
+    mnodeman.Swap(mnodemanLoaded);
+
+    CBudgetManager budgetLoaded;
+    CBudgetDB budgetdb;
+    CBudgetDB::ReadResult readResult2 = budgetdb.Read(budgetLoaded);
+
+    if (readResult2 == CBudgetDB::FileError)
+        LogPrintf("Missing budget cache - budget.dat, will try to recreate\n");
+    else if (readResult2 != CBudgetDB::Ok) {
+        LogPrintf("Error reading budget.dat: ");
+        if (readResult2 == CBudgetDB::IncorrectFormat)
+            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
+        else
+            LogPrintf("file format is unknown or invalid, please fix it manually\n");
+    }
+
+    //flag our cached items so we send them to our peers
+    budgetLoaded.ResetSync();
+    budgetLoaded.ClearSeen();
+    budget.Swap(budgetLoaded);
+
+    CMasternodePayments paymentsLoaded;
+    CMasternodePaymentDB mnpayments;
+    CMasternodePaymentDB::ReadResult readResult3 = mnpayments.Read(paymentsLoaded);
+
+    if (readResult3 == CMasternodePaymentDB::FileError)
+        LogPrintf("Missing masternode payment cache - mnpayments.dat, will try to recreate\n");
+    else if (readResult3 != CMasternodePaymentDB::Ok) {
+        LogPrintf("Error reading mnpayments.dat: ");
+        if (readResult3 == CMasternodePaymentDB::IncorrectFormat)
+            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
+        else
+            LogPrintf("file format is unknown or invalid, please fix it manually\n");
+    }
+    masternodePayments.Swap(paymentsLoaded);
+    FinishStartupTask(STARTUP_TASK_MASTERNODE_CACHES, nStart);
+}
+
+static void ThreadLoadMasternodeCaches()
+{
+    RenameThread("liberty-mncache");
+    LoadMasternodeCaches();
+}
+
+#ifdef ENABLE_WALLET
+/**
+ * Catch the wallet up with the chain from pindexRescan (NULL when it already
+ * is) and sync the XLIBz wallet, see STARTUP_TASK_RESCAN. vWtx holds the
+ * transaction meta data to restore after -zapwallettxes=1.
+ */
+static void SyncWalletWithChain(CBlockIndex* pindexRescan, const std::vector<CWalletTx>& vWtx, bool fReaccept)
+{
+    int64_t nStart = GetTimeMillis();
+    if (pindexRescan) {
+        {
+            LOCK(cs_main);
+            LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
+        }
+        pwalletMain->ScanForWalletTransactions(pindexRescan, true);
+        LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
+        {
+            LOCK(cs_main);
+            pwalletMain->SetBestChain(chainActive.GetLocator());
+        }
+        nWalletDBUpdated++;
+
+        // Restore wallet transaction metadata after -zapwallettxes=1
+        if (GetBoolArg("-zapwallettxes", false) && GetArg("-zapwallettxes", "1") != "2") {
+            LOCK(pwalletMain->cs_wallet);
+            BOOST_FOREACH (const CWalletTx& wtxOld, vWtx) {
+                uint256 hash = wtxOld.GetHash();
+                std::map<uint256, CWalletTx>::iterator mi = pwalletMain->mapWallet.find(hash);
+                if (mi != pwalletMain->mapWallet.end()) {
+                    const CWalletTx* copyFrom = &wtxOld;
+                    CWalletTx* copyTo = &mi->second;
+                    copyTo->mapValue = copyFrom->mapValue;
+                    copyTo->vOrderForm = copyFrom->vOrderForm;
+                    copyTo->nTimeReceived = copyFrom->nTimeReceived;
+                    copyTo->nTimeSmart = copyFrom->nTimeSmart;
+                    copyTo->fFromMe = copyFrom->fFromMe;
+                    copyTo->strFromAccount = copyFrom->strFromAccount;
+                    copyTo->nOrderPos = copyFrom->nOrderPos;
+                    copyTo->WriteToDisk();
+                }
+            }
+        }
+    }
+
+    //Load zerocoin mint hashes to memory
+    {
+        LOCK(pwalletMain->cs_wallet);
+        pwalletMain->xlibzTracker->Init();
+        zwalletMain->LoadMintPoolFromDB();
+    }
+    zwalletMain->SyncWithChain();
+
+    // Add wallet transactions that aren't already in a block to mapTransactions
+    if (fReaccept)
+        pwalletMain->ReacceptWalletTransactions();
+    FinishStartupTask(STARTUP_TASK_RESCAN, nStart);
+}
+#endif
+
 struct CImportingNow {
     CImportingNow()
     {
@@ -862,15 +1029,22 @@ bool AppInit2()
         }
     }
 
-    // Make sure enough file descriptors are available
+    // Make sure enough file descriptors are available, including the table files
+    // the databases keep open (see the LevelDB profiles and -dbmaxopenfiles)
+    int nCoreFD = MIN_CORE_FILEDESCRIPTORS;
+#ifndef WIN32
+    nCoreFD += GetLevelDBMaxOpenFiles();
+#endif
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     nMaxConnections = GetArg("-maxconnections", 125);
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
-    int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
-    if (nFD < MIN_CORE_FILEDESCRIPTORS)
+    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - nCoreFD)), 0);
+    int nFD = RaiseFileDescriptorLimit(nMaxConnections + nCoreFD);
+    if (nFD < nCoreFD) {
+        LogPrintf("%d file descriptors available, %d needed without connections (lower -dbmaxopenfiles to need fewer)\n", nFD, nCoreFD);
         return InitError(_("Not enough file descriptors available."));
-    if (nFD - MIN_CORE_FILEDESCRIPTORS < nMaxConnections)
-        nMaxConnections = nFD - MIN_CORE_FILEDESCRIPTORS;
+    }
+    if (nFD - nCoreFD < nMaxConnections)
+        nMaxConnections = nFD - nCoreFD;
 
     // ********************************************************* Step 3: parameter-to-internal-flags
 
@@ -991,6 +1165,8 @@ bool AppInit2()
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices |= NODE_BLOOM;
 
+    fCompactBlocks = GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS);
+
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
     // Initialize elliptic curve code
@@ -1042,6 +1218,18 @@ bool AppInit2()
             threadGroup.create_thread(&ThreadScriptCheck);
     }
 
+    int nMsgWorkerThreads = std::max(0, std::min((int)GetArg("-msgworkers", DEFAULT_MSG_WORKER_THREADS), MAX_MSG_WORKER_THREADS));
+    if (nMsgWorkerThreads) {
+        LogPrintf("Using %u threads for masternode message processing\n", nMsgWorkerThreads);
+        StartMessageWorkers(threadGroup, nMsgWorkerThreads);
+    }
+
+    int nBlockCheckThreads = std::max(0, std::min((int)GetArg("-blockcheckthreads", DEFAULT_BLOCK_CHECK_THREADS), MAX_BLOCK_CHECK_THREADS));
+    if (nBlockCheckThreads) {
+        LogPrintf("Using %u threads for checking blocks during initial sync\n", nBlockCheckThreads);
+        StartBlockPipeline(threadGroup, nBlockCheckThreads);
+    }
+
     if (mapArgs.count("-sporkkey")) // spork priv key
     {
         if (!sporkManager.SetPrivKey(GetArg("-sporkkey", "")))
@@ -1064,6 +1252,8 @@ bool AppInit2()
     }
 
     int64_t nStart;
+    // Time spent in each startup phase, logged once loading has finished
+    int64_t nTimeBlockIndex = 0, nTimeChainstate = 0, nTimeWallet = 0, nTimeMasternodeCaches = 0;
 
 // ********************************************************* Step 5: Backup wallet and verify wallet database integrity
 #ifdef ENABLE_WALLET
@@ -1398,7 +1588,14 @@ bool AppInit2()
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache; // the rest is for the in-memory coins cache
+    LogPrintf("Cache configuration:\n");
+    LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    size_t nBlockCacheSize = std::max((int64_t)0, GetArg("-blockcachesize", DEFAULT_BLOCK_CACHE_SIZE)) << 20;
+    blockCache.SetMaxSize(nBlockCacheSize);
+    LogPrintf("* Using %.1fMiB for decoded blocks\n", nBlockCacheSize * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1412,8 +1609,9 @@ bool AppInit2()
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
-                delete pcoinsdbview;
                 delete pcoinscatcher;
+                delete pcoinswriter;
+                delete pcoinsdbview;
                 delete pblocktree;
                 delete zerocoinDB;
                 delete pSporkDB;
@@ -1424,9 +1622,16 @@ bool AppInit2()
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                pcoinswriter = new CCoinsViewBackgroundWriter(pcoinsdbview, pblocktree);
+                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinswriter);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
+                // A newer client may have changed the layout of the coin database
+                if (!pcoinsdbview->IsVersionSupported()) {
+                    strLoadError = strprintf(_("The chain state database has version %d, this version of Liberty Coin supports up to %d"), pcoinsdbview->GetVersion(), COINS_DB_VERSION);
+                    break;
+                }
+
                 if (fReindex)
                     pblocktree->WriteReindexing(true);
 
@@ -1435,12 +1640,15 @@ bool AppInit2()
                 LoadSporksFromDB();
 
                 uiInterface.InitMessage(_("Loading block index..."));
+                int64_t nTimePhase = GetTimeMillis();
                 string strBlockIndexError = "";
                 if (!LoadBlockIndex(strBlockIndexError)) {
                     strLoadError = _("Error loading block database");
                     strLoadError = strprintf("%s : %s", strLoadError, strBlockIndexError);
                     break;
                 }
+                nTimeBlockIndex = GetTimeMillis() - nTimePhase;
+                nTimePhase = GetTimeMillis();
 
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
@@ -1507,6 +1715,7 @@ bool AppInit2()
                     fVerifyingBlocks = false;
                     break;
                 }
+                nTimeChainstate = GetTimeMillis() - nTimePhase;
             } catch (std::exception& e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
                 strLoadError = _("Error opening block database");
@@ -1546,6 +1755,16 @@ bool AppInit2()
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    {
+        // Connecting and disconnecting blocks keeps the mint maturity heights up to date from here on
+        LOCK(cs_main);
+        UpdateMintMaturityHeight(chainActive.Tip());
+    }
+
+    // A chainstate from before per-output records is upgraded while the node runs
+    if (pcoinsdbview->NeedsUpgrade())
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "coinsupgrade", boost::function<void()>(boost::bind(&CCoinsViewDB::Upgrade, pcoinsdbview))));
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1554,11 +1773,13 @@ bool AppInit2()
     fFeeEstimatesInitialized = true;
 
 // ********************************************************* Step 8: load wallet
+    bool fDeferStartup = GetBoolArg("-deferstartup", DEFAULT_DEFER_STARTUP);
 #ifdef ENABLE_WALLET
     if (fDisableWallet) {
         pwalletMain = NULL;
         zwalletMain = NULL;
         LogPrintf("Wallet disabled!\n");
+        FinishStartupTask(STARTUP_TASK_RESCAN, GetTimeMillis());
     } else {
         // needed to restore wallet transaction meta data after -zapwallettxes
         std::vector<CWalletTx> vWtx;
@@ -1581,6 +1802,7 @@ bool AppInit2()
         fVerifyingBlocks = true;
 
         nStart = GetTimeMillis();
+        int64_t nTimeWalletStart = nStart;
         bool fFirstRun = true;
         pwalletMain = new CWallet(strWalletFile);
         DBErrors nLoadWalletRet = pwalletMain->LoadWallet(fFirstRun);
@@ -1647,50 +1869,26 @@ bool AppInit2()
             else
                 pindexRescan = chainActive.Genesis();
         }
-        if (chainActive.Tip() && chainActive.Tip() != pindexRescan) {
-            uiInterface.InitMessage(_("Rescanning..."));
-            LogPrintf("Rescanning last %i blocks (from block %i)...\n", chainActive.Height() - pindexRescan->nHeight, pindexRescan->nHeight);
-            nStart = GetTimeMillis();
-            pwalletMain->ScanForWalletTransactions(pindexRescan, true);
-            LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
-            pwalletMain->SetBestChain(chainActive.GetLocator());
-            nWalletDBUpdated++;
-
-            // Restore wallet transaction metadata after -zapwallettxes=1
-            if (GetBoolArg("-zapwallettxes", false) && GetArg("-zapwallettxes", "1") != "2") {
-                BOOST_FOREACH (const CWalletTx& wtxOld, vWtx) {
-                    uint256 hash = wtxOld.GetHash();
-                    std::map<uint256, CWalletTx>::iterator mi = pwalletMain->mapWallet.find(hash);
-                    if (mi != pwalletMain->mapWallet.end()) {
-                        const CWalletTx* copyFrom = &wtxOld;
-                        CWalletTx* copyTo = &mi->second;
-                        copyTo->mapValue = copyFrom->mapValue;
-                        copyTo->vOrderForm = copyFrom->vOrderForm;
-                        copyTo->nTimeReceived = copyFrom->nTimeReceived;
-                        copyTo->nTimeSmart = copyFrom->nTimeSmart;
-                        copyTo->fFromMe = copyFrom->fFromMe;
-                        copyTo->strFromAccount = copyFrom->strFromAccount;
-                        copyTo->nOrderPos = copyFrom->nOrderPos;
-                        copyTo->WriteToDisk();
-                    }
-                }
-            }
-        }
-        fVerifyingBlocks = false;
-
-        //Inititalize XLIBzWallet
-        uiInterface.InitMessage(_("Syncing XLIBz wallet..."));
+        if (!chainActive.Tip() || chainActive.Tip() == pindexRescan)
+            pindexRescan = NULL;
 
         bool fEnableXLIBzBackups = GetBoolArg("-backupxlibz", true);
         pwalletMain->setXLIBzAutoBackups(fEnableXLIBzBackups);
 
-        //Load zerocoin mint hashes to memory
-        pwalletMain->xlibzTracker->Init();
-        zwalletMain->LoadMintPoolFromDB();
-        zwalletMain->SyncWithChain();
+        if (fDeferStartup) {
+            // The wallet already follows new blocks, the task catches it up with the ones before
+            fStartupTaskDeferred[STARTUP_TASK_RESCAN] = true;
+            scheduler.scheduleFromNow(boost::bind(&SyncWalletWithChain, pindexRescan, vWtx, true), 0);
+        } else {
+            uiInterface.InitMessage(pindexRescan ? _("Rescanning...") : _("Syncing XLIBz wallet..."));
+            SyncWalletWithChain(pindexRescan, vWtx, false);
+        }
+        fVerifyingBlocks = false;
+        nTimeWallet = GetTimeMillis() - nTimeWalletStart;
     }  // (!fDisableWallet)
 #else  // ENABLE_WALLET
     LogPrintf("No wallet compiled in!\n");
+    FinishStartupTask(STARTUP_TASK_RESCAN, GetTimeMillis());
 #endif // !ENABLE_WALLET
     // ********************************************************* Step 9: import blocks
 
@@ -1701,9 +1899,11 @@ bool AppInit2()
         uiInterface.NotifyBlockSize.connect(BlockSizeNotifyCallback);
 
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
+    nStart = GetTimeMillis();
     CValidationState state;
     if (!ActivateBestChain(state))
         strErrors << "Failed to connect best block";
+    nTimeChainstate += GetTimeMillis() - nStart;
 
     std::vector<boost::filesystem::path> vImportFiles;
     if (mapArgs.count("-loadblock")) {
@@ -1719,53 +1919,16 @@ bool AppInit2()
 
     // ********************************************************* Step 10: setup ObfuScation
 
-    uiInterface.InitMessage(_("Loading masternode cache..."));
-
-    CMasternodeDB mndb;
-    CMasternodeDB::ReadResult readResult = mndb.Read(mnodeman);
-    if (readResult == CMasternodeDB::FileError)
-        LogPrintf("Missing masternode cache file - mncache.dat, will try to recreate\n");
-    else if (readResult != CMasternodeDB::Ok) {
-        LogPrintf("Error reading mncache.dat: ");
-        if (readResult == CMasternodeDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-    }
-
-    uiInterface.InitMessage(_("Loading budget cache..."));
-
-    CBudgetDB budgetdb;
-    CBudgetDB::ReadResult readResult2 = budgetdb.Read(budget);
-
-    if (readResult2 == CBudgetDB::FileError)
-        LogPrintf("Missing budget cache - budget.dat, will try to recreate\n");
-    else if (readResult2 != CBudgetDB::Ok) {
-        LogPrintf("Error reading budget.dat: ");
-        if (readResult2 == CBudgetDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
-    }
-
-    //flag our cached items so we send them to our peers
-    budget.ResetSync();
-    budget.ClearSeen();
-
-
-    uiInterface.InitMessage(_("Loading masternode payment cache..."));
-
-    CMasternodePaymentDB mnpayments;
-    CMasternodePaymentDB::ReadResult readResult3 = mnpayments.Read(masternodePayments);
-
-    if (readResult3 == CMasternodePaymentDB::FileError)
-        LogPrintf("Missing masternode payment cache - mnpayments.dat, will try to recreate\n");
-    else if (readResult3 != CMasternodePaymentDB::Ok) {
-        LogPrintf("Error reading mnpayments.dat: ");
-        if (readResult3 == CMasternodePaymentDB::IncorrectFormat)
-            LogPrintf("magic is ok but data has invalid format, will try to recreate\n");
-        else
-            LogPrintf("file format is unknown or invalid, please fix it manually\n");
+    if (fDeferStartup) {
+        // Masternode messages are ignored and the masternode sync waits until the caches are read.
+        // They get their own thread rather than waiting behind the wallet rescan on the scheduler.
+        fStartupTaskDeferred[STARTUP_TASK_MASTERNODE_CACHES] = true;
+        threadGroup.create_thread(&ThreadLoadMasternodeCaches);
+    } else {
+        uiInterface.InitMessage(_("Loading masternode cache..."));
+        nStart = GetTimeMillis();
+        LoadMasternodeCaches();
+        nTimeMasternodeCaches = GetTimeMillis() - nStart;
     }
 
     fMasterNode = GetBoolArg("-masternode", false);
@@ -1910,11 +2073,15 @@ bool AppInit2()
 
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
+    LogPrintf("Startup phases: block index %dms, chainstate %dms, wallet %dms, masternode caches %dms%s\n",
+        nTimeBlockIndex, nTimeChainstate, nTimeWallet, nTimeMasternodeCaches, fDeferStartup ? " (rescan and masternode caches continue in the background)" : "");
 
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
-        // Add wallet transactions that aren't already in a block to mapTransactions
-        pwalletMain->ReacceptWalletTransactions();
+        // Add wallet transactions that aren't already in a block to mapTransactions,
+        // the deferred rescan does this once it is done
+        if (!fDeferStartup)
+            pwalletMain->ReacceptWalletTransactions();
 
         // Run a thread to flush wallet periodically
         threadGroup.create_thread(boost::bind(&ThreadFlushWalletDB, boost::ref(pwalletMain->strWalletFile)));
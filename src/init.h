@@ -7,6 +7,7 @@
 #ifndef BITCOIN_INIT_H
 #define BITCOIN_INIT_H
 
+#include <stdint.h>
 #include <string>
 
 class CScheduler;
@@ -29,6 +30,23 @@ void Shutdown();
 void PrepareShutdown();
 bool AppInit2();
 
+/** Default for -deferstartup */
+static const bool DEFAULT_DEFER_STARTUP = true;
+
+/** Startup stages that can finish in the background after the node is up (-deferstartup) */
+enum StartupTask {
+    //! wallet rescan, XLIBz wallet sync and re-accepting wallet transactions
+    STARTUP_TASK_RESCAN,
+    //! mncache.dat, budget.dat and mnpayments.dat
+    STARTUP_TASK_MASTERNODE_CACHES,
+    STARTUP_TASK_COUNT
+};
+
+/** Whether a startup task has finished, also true for tasks that didn't need to run */
+bool IsStartupTaskDone(StartupTask task);
+/** Name, whether it was deferred, whether it has finished and how long it took (ms) */
+void GetStartupTaskStatus(StartupTask task, std::string& strName, bool& fDeferred, bool& fDone, int64_t& nTime);
+
 /** The help message mode determines what help message to show */
 enum HelpMessageMode {
     HMM_BITCOIND,
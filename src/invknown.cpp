@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "invknown.h"
+
+CKnownInventory knownInventory(MAX_KNOWN_INVENTORY);
+
+CKnownInventory::CKnownInventory(size_t nMaxItemsIn) : vSlotUsed(MAX_KNOWN_INVENTORY_PEERS, false), nMaxItems(nMaxItemsIn)
+{
+}
+
+int CKnownInventory::AddPeer()
+{
+    LOCK(cs);
+    for (int nSlot = 0; nSlot < MAX_KNOWN_INVENTORY_PEERS; nSlot++) {
+        if (!vSlotUsed[nSlot]) {
+            vSlotUsed[nSlot] = true;
+            return nSlot;
+        }
+    }
+    return -1;
+}
+
+void CKnownInventory::RemovePeer(int nSlot)
+{
+    if (nSlot < 0)
+        return;
+
+    LOCK(cs);
+    // The slot will be handed to another peer, which must not inherit this one's knowledge
+    uint64_t nMask = ~((uint64_t)1 << (nSlot % 64));
+    for (KnownMap::iterator it = mapKnown.begin(); it != mapKnown.end(); ++it)
+        it->second.bits[nSlot / 64] &= nMask;
+    vSlotUsed[nSlot] = false;
+}
+
+bool CKnownInventory::IsKnown(int nSlot, const CInv& inv) const
+{
+    if (nSlot < 0)
+        return false;
+
+    LOCK(cs);
+    KnownMap::const_iterator it = mapKnown.find(inv);
+    if (it == mapKnown.end())
+        return false;
+    return (it->second.bits[nSlot / 64] >> (nSlot % 64)) & 1;
+}
+
+bool CKnownInventory::SetKnown(int nSlot, const CInv& inv)
+{
+    if (nSlot < 0)
+        return true;
+
+    LOCK(cs);
+    std::pair<KnownMap::iterator, bool> ret = mapKnown.insert(std::make_pair(inv, KnownBy()));
+    if (ret.second) {
+        vOrder.push_back(ret.first);
+        if (vOrder.size() > nMaxItems) {
+            mapKnown.erase(vOrder.front());
+            vOrder.pop_front();
+        }
+    }
+
+    uint64_t& nWord = ret.first->second.bits[nSlot / 64];
+    uint64_t nBit = (uint64_t)1 << (nSlot % 64);
+    if (nWord & nBit)
+        return false;
+    nWord |= nBit;
+    return true;
+}
+
+size_t CKnownInventory::Size() const
+{
+    LOCK(cs);
+    return mapKnown.size();
+}
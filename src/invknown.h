@@ -0,0 +1,72 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBERTY_INVKNOWN_H
+#define LIBERTY_INVKNOWN_H
+
+#include "protocol.h"
+#include "sync.h"
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <stdint.h>
+
+/** Maximum number of peers that get a slot in the known inventory map */
+static const int MAX_KNOWN_INVENTORY_PEERS = 256;
+/** Maximum number of inventory items remembered in the known inventory map */
+static const size_t MAX_KNOWN_INVENTORY = 50000;
+
+/**
+ * Shared record of which peers already know an inventory item.
+ *
+ * Instead of every peer keeping its own set of recently known items, every
+ * peer gets a slot and each recently seen item keeps one bit per slot. Only
+ * the most recent nMaxItems items are remembered. Peers that didn't get a
+ * slot (-1) are treated as knowing nothing, so they may receive duplicate
+ * announcements but never miss one.
+ */
+class CKnownInventory
+{
+public:
+    explicit CKnownInventory(size_t nMaxItemsIn);
+
+    //! Get a slot for a new peer, or -1 when all slots are taken
+    int AddPeer();
+    //! Free a peer's slot and forget everything it knew
+    void RemovePeer(int nSlot);
+
+    bool IsKnown(int nSlot, const CInv& inv) const;
+    //! Mark inv as known by the peer in nSlot. Returns false if it already was.
+    bool SetKnown(int nSlot, const CInv& inv);
+
+    size_t Size() const;
+
+private:
+    static const int WORDS = (MAX_KNOWN_INVENTORY_PEERS + 63) / 64;
+
+    struct KnownBy {
+        uint64_t bits[WORDS];
+
+        KnownBy()
+        {
+            for (int i = 0; i < WORDS; i++)
+                bits[i] = 0;
+        }
+    };
+
+    typedef std::map<CInv, KnownBy> KnownMap;
+
+    mutable CCriticalSection cs;
+    KnownMap mapKnown;
+    //! Insertion order of mapKnown, oldest first
+    std::deque<KnownMap::iterator> vOrder;
+    std::vector<bool> vSlotUsed;
+    size_t nMaxItems;
+};
+
+extern CKnownInventory knownInventory;
+
+#endif // LIBERTY_INVKNOWN_H
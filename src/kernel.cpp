@@ -376,9 +376,10 @@ bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake, std::uniqu
         return error("%s: Failed to find the block index", __func__);
 
     // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos()))
+    boost::shared_ptr<const CBlock> pblockprev;
+    if (!ReadBlockFromDiskCached(pblockprev, pindex))
         return error("CheckProofOfStake(): INFO: failed to find block");
+    const CBlock& blockprev = *pblockprev;
 
     uint256 bnTargetPerCoinDay;
     bnTargetPerCoinDay.SetCompact(block.nBits);
@@ -27,14 +27,48 @@ void HandleError(const leveldb::Status& status)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+CLevelDBProfile GetLevelDBProfile(LevelDBProfile profile)
+{
+    // Indexed by LevelDBProfile
+    static const CLevelDBProfile profiles[] = {
+        // name, compression, block size, open files, verify checksums, min cache
+        {"default", false, 4 << 10, 64, true, 0},
+        // Outputs are stored compressed already, and point reads want small blocks
+        {"chainstate", false, 4 << 10, 256, true, 0},
+        // Index records compress well and are read back by one scan, large blocks keep it sequential
+        {"blockindex", true, 64 << 10, 64, true, 0},
+        // Hashes don't compress, small blocks leave less to checksum per lookup
+        {"zerocoin", false, 2 << 10, 128, true, 8 << 20},
+        {"sporks", false, 4 << 10, 16, true, 1 << 20},
+    };
+    CLevelDBProfile ret = profiles[profile];
+    if (mapArgs.count("-dbcompression"))
+        ret.fCompression = GetBoolArg("-dbcompression", false);
+    if (mapArgs.count("-dbmaxopenfiles"))
+        ret.nMaxOpenFiles = std::max(16, (int)GetArg("-dbmaxopenfiles", 0));
+    ret.fVerifyChecksums = ret.fVerifyChecksums && GetBoolArg("-dbverifychecksums", DEFAULT_DB_VERIFY_CHECKSUMS);
+    return ret;
+}
+
+int GetLevelDBMaxOpenFiles()
+{
+    // Every profile but the default one has its database open while the node runs
+    int nFiles = 0;
+    for (int profile = LEVELDB_PROFILE_CHAINSTATE; profile <= LEVELDB_PROFILE_SPORKS; profile++)
+        nFiles += GetLevelDBProfile((LevelDBProfile)profile).nMaxOpenFiles;
+    return nFiles;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CLevelDBProfile& profile)
 {
     leveldb::Options options;
+    nCacheSize = std::max(nCacheSize, profile.nMinCacheSize);
     options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
     options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.compression = profile.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.block_size = profile.nBlockSize;
+    options.max_open_files = profile.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -43,14 +77,14 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CLevelDBProfile& profile)
 {
     penv = NULL;
-    readoptions.verify_checksums = true;
+    readoptions.verify_checksums = profile.fVerifyChecksums;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, profile);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -62,6 +96,8 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
         }
         TryCreateDirectory(path);
         LogPrintf("Opening LevelDB in %s\n", path.string());
+        LogPrint("coindb", "LevelDB %s profile: compression %u, block size %u, %d open files, verify checksums %u\n",
+            profile.pszName, profile.fCompression, options.block_size, options.max_open_files, profile.fVerifyChecksums);
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
@@ -24,6 +24,43 @@ public:
 
 void HandleError(const leveldb::Status& status);
 
+/** The databases, each opened with options suited to how it is used */
+enum LevelDBProfile {
+    LEVELDB_PROFILE_DEFAULT,
+    //! coins, random point reads and writes of already compressed outputs
+    LEVELDB_PROFILE_CHAINSTATE,
+    //! block index, scanned in full at startup and written in batches after
+    LEVELDB_PROFILE_BLOCKINDEX,
+    //! zerocoin serials and pubcoins, random point reads of hashes
+    LEVELDB_PROFILE_ZEROCOIN,
+    //! sporks, a handful of small records
+    LEVELDB_PROFILE_SPORKS,
+};
+
+/** Options a database is opened and read with */
+struct CLevelDBProfile {
+    const char* pszName;
+    //! Snappy-compress table blocks (where LevelDB is built without Snappy they are stored as is)
+    bool fCompression;
+    //! size of the table blocks fetched, checksummed and decompressed together
+    size_t nBlockSize;
+    //! table files kept open
+    int nMaxOpenFiles;
+    //! verify checksums on point reads, iterators always do
+    bool fVerifyChecksums;
+    //! block cache the database gets even when it is handed less
+    size_t nMinCacheSize;
+};
+
+/** Default for -dbverifychecksums */
+static const bool DEFAULT_DB_VERIFY_CHECKSUMS = true;
+
+/** The options a database is opened with, after -dbcompression, -dbmaxopenfiles and -dbverifychecksums */
+CLevelDBProfile GetLevelDBProfile(LevelDBProfile profile);
+
+/** Table files the node's databases keep open together, to budget file descriptors for */
+int GetLevelDBMaxOpenFiles();
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -86,7 +123,7 @@ private:
     leveldb::DB* pdb;
 
 public:
-    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CLevelDBProfile& profile = GetLevelDBProfile(LEVELDB_PROFILE_DEFAULT));
     ~CLevelDBWrapper();
 
     template <typename K, typename V>
@@ -163,10 +200,17 @@ public:
         return WriteBatch(batch, true);
     }
 
+    //! Compact the whole database, so every key lives in exactly one table
+    void CompactFull()
+    {
+        pdb->CompactRange(NULL, NULL);
+    }
+
     // not exactly clean encapsulation, but it's easiest for now
-    leveldb::Iterator* NewIterator()
+    //! Iterators for point lookups should fill the block cache like Read() does; scans should not.
+    leveldb::Iterator* NewIterator(bool fFillCache = false)
     {
-        return pdb->NewIterator(iteroptions);
+        return pdb->NewIterator(fFillCache ? readoptions : iteroptions);
     }
 };
 
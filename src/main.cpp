@@ -12,6 +12,10 @@
 #include "accumulators.h"
 #include "addrman.h"
 #include "alert.h"
+#include "blockcache.h"
+#include "blockencodings.h"
+#include "blockfilemap.h"
+#include "blockpipeline.h"
 #include "blocksignature.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -22,6 +26,7 @@
 #include "masternode-payments.h"
 #include "masternodeman.h"
 #include "merkleblock.h"
+#include "msgqueue.h"
 #include "net.h"
 #include "obfuscation.h"
 #include "pow.h"
@@ -39,6 +44,7 @@
 #include "libzerocoin/Denominations.h"
 #include "primitives/zerocoin.h"
 
+#include <atomic>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -61,6 +67,7 @@ using namespace libzerocoin;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+CBlockIndexArena blockIndexArena;
 map<uint256, uint256> mapProofOfStake;
 map<COutPoint, int> mapStakeSpent;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
@@ -76,8 +83,9 @@ bool fReindex = false;
 bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
+bool fCompactBlocks = DEFAULT_COMPACT_BLOCKS;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 int64_t nReserveBalance = 0;
 
@@ -147,6 +155,8 @@ multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 CCriticalSection cs_LastBlockFile;
 std::vector<CBlockFileInfo> vinfoBlockFile;
 int nLastBlockFile = 0;
+/** Copy of nLastBlockFile for readers that don't hold cs_LastBlockFile, the files below it are finished */
+static std::atomic<int> nLastBlockFileShared(0);
 
 /**
      * Every received block is assigned a unique and increasing identifier, so we
@@ -231,6 +241,14 @@ struct CNodeState {
     int nBlocksInFlight;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer understands compact block messages (it sent sendcmpct).
+    bool fSupportsCompactBlocks;
+    //! Compact blocks we asked this peer for and haven't received yet.
+    std::set<uint256> setCompactBlocksRequested;
+    //! Compact block waiting for the transactions we asked for with getblocktxn.
+    PartiallyDownloadedBlock partialBlock;
+    //! Size of the cmpctblock message partialBlock was built from.
+    uint64_t nPartialBlockBytes;
 
     CNodeState()
     {
@@ -244,12 +262,18 @@ struct CNodeState {
         nStallingSince = 0;
         nBlocksInFlight = 0;
         fPreferredDownload = false;
+        fSupportsCompactBlocks = false;
+        nPartialBlockBytes = 0;
     }
 };
 
 /** Map maintaining per-node state. Requires cs_main. */
 map<NodeId, CNodeState> mapNodeState;
 
+/** Misbehavior scores added while cs_main was busy, see MisbehavingNoWait. */
+CCriticalSection cs_mapMisbehavingQueued;
+map<NodeId, int> mapMisbehavingQueued;
+
 // Requires cs_main.
 CNodeState* State(NodeId pnode)
 {
@@ -307,6 +331,10 @@ void FinalizeNode(NodeId nodeid)
     nPreferredDownload -= state->fPreferredDownload;
 
     mapNodeState.erase(nodeid);
+    {
+        LOCK(cs_mapMisbehavingQueued);
+        mapMisbehavingQueued.erase(nodeid);
+    }
 }
 
 // Requires cs_main.
@@ -530,6 +558,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache* pcoinsTip = NULL;
 CBlockTreeDB* pblocktree = NULL;
+CCoinsViewBackgroundWriter* pcoinswriter = NULL;
 CZerocoinDB* zerocoinDB = NULL;
 CSporkDB* pSporkDB = NULL;
 
@@ -1599,16 +1628,27 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (std::exception& e) {
-                    return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+                CMappedBlockReader reader(SER_DISK, CLIENT_VERSION);
+                if (postx.nFile < nLastBlockFileShared && mappedBlockFiles.Open(postx, reader)) {
+                    try {
+                        reader >> header;
+                        reader.ignore(postx.nTxOffset);
+                        reader >> txOut;
+                    } catch (std::exception& e) {
+                        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+                    }
+                } else {
+                    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                    if (file.IsNull())
+                        return error("%s: OpenBlockFile failed", __func__);
+                    try {
+                        file >> header;
+                        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    } catch (std::exception& e) {
+                        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+                    }
                 }
                 hashBlock = header.GetHash();
                 if (txOut.GetHash() != hash)
@@ -1680,16 +1720,26 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    // Finished block files are read through their memory mapping
+    CMappedBlockReader reader(SER_DISK, CLIENT_VERSION);
+    if (pos.nFile < nLastBlockFileShared && mappedBlockFiles.Open(pos, reader)) {
+        try {
+            reader >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk : OpenBlockFile failed");
 
-    // Read block
-    try {
-        filein >> block;
-    } catch (std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        // Read block
+        try {
+            filein >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Check the header
@@ -1712,6 +1762,28 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadBlockFromDiskCached(boost::shared_ptr<const CBlock>& pblock, const CBlockIndex* pindex)
+{
+    pblock = blockCache.Get(pindex->GetBlockHash());
+    if (pblock)
+        return true;
+    boost::shared_ptr<CBlock> pblockRead(new CBlock());
+    if (!ReadBlockFromDisk(*pblockRead, pindex))
+        return false;
+    pblock = pblockRead;
+    blockCache.Insert(pblock);
+    return true;
+}
+
+bool ReadBlockFromDiskCached(CBlock& block, const CBlockIndex* pindex)
+{
+    boost::shared_ptr<const CBlock> pblock;
+    if (!ReadBlockFromDiskCached(pblock, pindex))
+        return false;
+    block = *pblock;
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -1907,6 +1979,32 @@ void Misbehaving(NodeId pnode, int howmuch)
         LogPrintf("Misbehaving: %s (%d -> %d)\n", state->name, state->nMisbehavior - howmuch, state->nMisbehavior);
 }
 
+void MisbehavingNoWait(NodeId nodeid, int howmuch)
+{
+    TRY_LOCK(cs_main, lockMain);
+    if (lockMain) {
+        Misbehaving(nodeid, howmuch);
+        return;
+    }
+    LOCK(cs_mapMisbehavingQueued);
+    mapMisbehavingQueued[nodeid] += howmuch;
+}
+
+// Requires cs_main.
+static void ApplyQueuedMisbehaving(NodeId nodeid)
+{
+    int howmuch = 0;
+    {
+        LOCK(cs_mapMisbehavingQueued);
+        std::map<NodeId, int>::iterator it = mapMisbehavingQueued.find(nodeid);
+        if (it == mapMisbehavingQueued.end())
+            return;
+        howmuch = it->second;
+        mapMisbehavingQueued.erase(it);
+    }
+    Misbehaving(nodeid, howmuch);
+}
+
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
     if (!pindexBestInvalid || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
@@ -2255,10 +2353,9 @@ void RecalculateXLibzMinted()
         std::list<CZerocoinMint> listMints;
         BlockToZerocoinMintList(block, listMints);
 
-        vector<libzerocoin::CoinDenomination> vDenomsBefore = pindex->vMintDenominationsInBlock;
-        pindex->vMintDenominationsInBlock.clear();
+        pindex->ClearMints();
         for (auto mint : listMints)
-            pindex->vMintDenominationsInBlock.emplace_back(mint.GetDenomination());
+            pindex->AddMint(mint.GetDenomination());
 
         if (pindex->nHeight < nHeightEnd)
             pindex = chainActive.Next(pindex);
@@ -2281,17 +2378,15 @@ void RecalculateXLibzSpent()
         list<libzerocoin::CoinDenomination> listDenomsSpent = ZerocoinSpendListFromBlock(block);
 
         //Reset the supply to previous block
-        pindex->mapZerocoinSupply = pindex->pprev->mapZerocoinSupply;
+        pindex->CopyZerocoinSupply(pindex->pprev);
 
         //Add mints to XLIBz supply
-        for (auto denom : libzerocoin::zerocoinDenomList) {
-            long nDenomAdded = count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), denom);
-            pindex->mapZerocoinSupply.at(denom) += nDenomAdded;
-        }
+        for (auto denom : libzerocoin::zerocoinDenomList)
+            pindex->AddZerocoinSupply(denom, pindex->GetMintCount(denom));
 
         //Remove spends from XLIBz supply
         for (auto denom : listDenomsSpent)
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->AddZerocoinSupply(denom, -1);
 
         //Rewrite money supply
         assert(pblocktree->WriteBlockIndex(CDiskBlockIndex(pindex)));
@@ -2415,19 +2510,17 @@ bool UpdateXLibzSupply(const CBlock& block, CBlockIndex* pindex, bool fJustCheck
     BlockToZerocoinMintList(block, listMints);
     std::list<libzerocoin::CoinDenomination> listSpends = ZerocoinSpendListFromBlock(block);
 
-    for (auto& denom : zerocoinDenomList) {
-        pindex->mapZerocoinSupply.at(denom) = pindex->pprev->mapZerocoinSupply.at(denom);
-    }
+    pindex->CopyZerocoinSupply(pindex->pprev);
 
     // Track zerocoin money supply
     CAmount nAmountZerocoinSpent = 0;
-    pindex->vMintDenominationsInBlock.clear();
+    pindex->ClearMints();
     if (pindex->pprev) {
         std::set<uint256> setAddedToWallet;
         for (auto& m : listMints) {
             libzerocoin::CoinDenomination denom = m.GetDenomination();
-            pindex->vMintDenominationsInBlock.push_back(m.GetDenomination());
-            pindex->mapZerocoinSupply.at(denom)++;
+            pindex->AddMint(denom);
+            pindex->AddZerocoinSupply(denom, 1);
 
             //Remove any of our own mints from the mintpool
             if (!fJustCheck && pwalletMain) {
@@ -2452,17 +2545,17 @@ bool UpdateXLibzSupply(const CBlock& block, CBlockIndex* pindex, bool fJustCheck
         }
 
         for (auto& denom : listSpends) {
-            pindex->mapZerocoinSupply.at(denom)--;
+            pindex->AddZerocoinSupply(denom, -1);
             nAmountZerocoinSpent += libzerocoin::ZerocoinDenominationToAmount(denom);
 
             // zerocoin failsafe
-            if (pindex->mapZerocoinSupply.at(denom) < 0)
+            if (pindex->GetZerocoinSupply(denom) < 0)
                 return error("Block contains zerocoins that spend more than are in the available supply to spend");
         }
     }
 
     for (auto& denom : zerocoinDenomList)
-        LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->mapZerocoinSupply.at(denom));
+        LogPrint("zero", "%s coins for denomination %d pubcoin %s\n", __func__, denom, pindex->GetZerocoinSupply(denom));
 
     return true;
 }
@@ -2828,10 +2921,22 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
 {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
+    // Wallet locator of the last chainstate handed over, and the write it went out with
+    static CBlockLocator locatorPending;
+    static uint64_t nLocatorWrite = 0;
     try {
-        if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
-            (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
+        // The wallet's best block is only moved up to a chainstate that is on disk, so a
+        // crash before the write finishes can't leave the wallet ahead of the chain
+        if (!locatorPending.IsNull() && pcoinswriter->IsWritten(nLocatorWrite)) {
+            GetMainSignals().SetBestChain(locatorPending);
+            locatorPending.SetNull();
+        }
+        size_t nCoinsUsage = pcoinsTip->DynamicMemoryUsage();
+        // The coins cache has outgrown its share of -dbcache
+        bool fCacheLarge = (mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && nCoinsUsage > nCoinCacheUsage;
+        // It's been a while since we wrote the chainstate (and the last write is done)
+        bool fPeriodicWrite = mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000 && !pcoinswriter->IsWriting();
+        if (mode == FLUSH_STATE_ALWAYS || fCacheLarge || fPeriodicWrite) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
             // twice (once in the log, and once in the tables). This is already
@@ -2839,34 +2944,48 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             // overwrite one. Still, use a conservative safety factor of 2.
             if (!CheckDiskSpace(100 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
+            // The previous write has to be on disk before this one is handed over.
+            int64_t nTimeStart = GetTimeMicros();
+            if (!pcoinswriter->Wait())
+                return state.Abort("Failed to write chainstate");
+            int64_t nTimeStall = GetTimeMicros() - nTimeStart;
             // First make sure all block and undo data is flushed to disk.
             FlushBlockFile();
-            // Then update all block file information (which may refer to block and undo files).
-            bool fileschanged = false;
-            for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end();) {
-                if (!pblocktree->WriteBlockFileInfo(*it, vinfoBlockFile[*it])) {
-                    return state.Abort("Failed to write to block index");
-                }
-                fileschanged = true;
-                setDirtyFileInfo.erase(it++);
-            }
-            if (fileschanged && !pblocktree->WriteLastBlockFile(nLastBlockFile)) {
-                return state.Abort("Failed to write to block index");
-            }
-            for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end();) {
-                if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
-                    return state.Abort("Failed to write to block index");
-                }
-                setDirtyBlockIndex.erase(it++);
-            }
-
-            pblocktree->Sync();
-            // Finally flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
+            // Then collect all block file information (which may refer to block and undo files)
+            // and block index entries; they are written ahead of the chainstate.
+            std::vector<std::pair<int, CBlockFileInfo> > vFileInfo;
+            for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); it++)
+                vFileInfo.push_back(std::make_pair(*it, vinfoBlockFile[*it]));
+            std::vector<CDiskBlockIndex> vBlockIndex;
+            vBlockIndex.reserve(setDirtyBlockIndex.size());
+            for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); it++)
+                vBlockIndex.push_back(CDiskBlockIndex(*it));
+            if (!pcoinswriter->QueueBlockIndex(vFileInfo, setDirtyFileInfo.empty() ? -1 : nLastBlockFile, vBlockIndex))
+                return state.Abort("Failed to write chainstate");
+            setDirtyFileInfo.clear();
+            setDirtyBlockIndex.clear();
+            // Finally hand over the chainstate, which is written in the background.
+            // Entries stay cached, only a cache over its budget drops the ones
+            // that weren't used recently.
+            if (!pcoinsTip->Sync())
                 return state.Abort("Failed to write to coin database");
-            // Update best block in wallet (so we can detect restored wallets).
+            if (fCacheLarge)
+                pcoinsTip->Trim(nCoinCacheUsage / 100 * COINS_CACHE_TRIM_PERCENT);
+            int64_t nTimeSnapshot = GetTimeMicros() - nTimeStart - nTimeStall;
+            // Callers flushing everything expect it to be on disk when this returns
+            if (mode == FLUSH_STATE_ALWAYS && !pcoinswriter->Wait())
+                return state.Abort("Failed to write chainstate");
+            LogPrint("bench", "- Flush chainstate: %.2fms stalled on the previous write, %.2fms to hand over, cache %.1fMiB -> %.1fMiB (%u txs)\n",
+                nTimeStall * 0.001, nTimeSnapshot * 0.001, nCoinsUsage * (1.0 / (1 << 20)), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), pcoinsTip->GetCacheSize());
+            // Update best block in wallet (so we can detect restored wallets), once the
+            // chainstate it goes with is on disk.
             if (mode != FLUSH_STATE_IF_NEEDED) {
-                GetMainSignals().SetBestChain(chainActive.GetLocator());
+                locatorPending = chainActive.GetLocator();
+                nLocatorWrite = pcoinswriter->GetWritesQueued();
+                if (pcoinswriter->IsWritten(nLocatorWrite)) {
+                    GetMainSignals().SetBestChain(locatorPending);
+                    locatorPending.SetNull();
+                }
             }
             nLastWrite = GetTimeMicros();
         }
@@ -2887,6 +3006,8 @@ void static UpdateTip(CBlockIndex* pindexNew)
 {
     chainActive.SetTip(pindexNew);
 
+    UpdateMintMaturityHeight(pindexNew);
+
     // If turned on AutoZeromint will automatically convert Liberty to XLIBz
     if (pwalletMain->isZeromintEnabled())
         pwalletMain->AutoZeromint();
@@ -2895,10 +3016,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2931,7 +3052,7 @@ bool static DisconnectTip(CValidationState& state)
     mempool.check(pcoinsTip);
     // Read block from disk.
     CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete))
+    if (!ReadBlockFromDiskCached(block, pindexDelete))
         return state.Abort("Failed to read block");
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
@@ -2988,7 +3109,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
+        if (!ReadBlockFromDiskCached(block, pindexNew))
             return state.Abort("Failed to read block");
         pblock = &block;
     }
@@ -3007,6 +3128,9 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
             return error("ConnectTip() : ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(inv.hash);
+        // The blocks around the tip are the ones read back most
+        if (pblock != &block)
+            blockCache.Insert(boost::shared_ptr<const CBlock>(new CBlock(*pblock)));
         nTime3 = GetTimeMicros();
         nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
@@ -3425,8 +3549,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3556,6 +3679,7 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
     }
 
     nLastBlockFile = nFile;
+    nLastBlockFileShared = nFile;
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
     if (fKnown)
         vinfoBlockFile[nFile].nSize = std::max(pos.nPos + nAddSize, vinfoBlockFile[nFile].nSize);
@@ -3632,7 +3756,70 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig)
+/**
+ * Block checks against the SwiftX locks and the masternode payments. They read and
+ * update state shared with the message handler, so unlike the rest of CheckBlock they
+ * run under cs_main and stay off the block check threads.
+ */
+static bool CheckBlockLocksAndPayee(const CBlock& block, CValidationState& state)
+{
+    LOCK(cs_main);
+
+    // ----------- swiftTX transaction scanning -----------
+    if (IsSporkActive(SPORK_3_SWIFTTX_BLOCK_FILTERING)) {
+        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            if (!tx.IsCoinBase()) {
+                //only reject blocks when it's based on complete consensus
+                BOOST_FOREACH (const CTxIn& in, tx.vin) {
+                    if (mapLockedInputs.count(in.prevout)) {
+                        if (mapLockedInputs[in.prevout] != tx.GetHash()) {
+                            mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
+                            LogPrintf("%s: found conflicting transaction with transaction lock %s %s\n", __func__, mapLockedInputs[in.prevout].ToString(), tx.GetHash().ToString());
+                            return state.DoS(0, error("%s: found conflicting transaction with transaction lock", __func__),
+                                REJECT_INVALID, "conflicting-tx-ix");
+                        }
+                    }
+                }
+            }
+        }
+    } else {
+        LogPrintf("%s: skipping transaction locking checks\n", __func__);
+    }
+
+    // masternode payments / budgets
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (pindexPrev != NULL) {
+        int nHeight = 0;
+        if (pindexPrev->GetBlockHash() == block.hashPrevBlock) {
+            nHeight = pindexPrev->nHeight + 1;
+        } else { //out of order
+            BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+            if (mi != mapBlockIndex.end() && (*mi).second)
+                nHeight = (*mi).second->nHeight + 1;
+        }
+
+        // Liberty
+        // It is entierly possible that we don't have enough data and this could fail
+        // (i.e. the block could indeed be valid). Store the block for later consideration
+        // but issue an initial reject message.
+        // The case also exists that the sending peer could not have enough data to see
+        // that this block is invalid, so don't issue an outright ban.
+        if (nHeight != 0 && !IsInitialBlockDownload()) {
+            if (!IsBlockPayeeValid(block, nHeight)) {
+                mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
+                return state.DoS(0, error("%s: couldn't find masternode/budget payment", __func__),
+                    REJECT_INVALID, "bad-cb-payee");
+            }
+        } else {
+            if (fDebug)
+                LogPrintf("%s: masternode payment check skipped on sync - skipping IsBlockPayeeValid()\n", __func__);
+        }
+    }
+
+    return true;
+}
+
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig, bool fCheckLocksAndPayee)
 {
     // These are checks that are independent of context.
 
@@ -3708,72 +3895,29 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             uint256 hashBlockPrev;
             if (!GetTransaction(block.vtx[1].vin[0].prevout.hash, txPrev, hashBlockPrev, true))
                 return state.DoS(100, error("%s: stake failed to find vin transaction", __func__));
-            // Find block in map.
-            CBlockIndex* pindex = NULL;
-            BlockMap::iterator it = mapBlockIndex.find(hashBlockPrev);
-            if (it != mapBlockIndex.end())
-                pindex = it->second;
-            else
-                return state.DoS(100, error("%s: stake failed to find block index", __func__));
+            // Find block in map, the active chain may be changing on another thread when blocks
+            // are checked ahead of being connected
+            int64_t nTimePrev;
+            int nConfirmations;
+            {
+                LOCK(cs_main);
+                BlockMap::iterator it = mapBlockIndex.find(hashBlockPrev);
+                if (it == mapBlockIndex.end())
+                    return state.DoS(100, error("%s: stake failed to find block index", __func__));
+                nTimePrev = it->second->GetBlockTime();
+                nConfirmations = chainActive.Tip()->nHeight - it->second->nHeight;
+            }
             // Check block time vs stake age requirement.
-            if (pindex->GetBlockHeader().nTime + Params().Stake_Min_Age() > GetAdjustedTime())
+            if (nTimePrev + Params().Stake_Min_Age() > GetAdjustedTime())
                 return state.DoS(100, error("%s: stake under minimum stake age", __func__));
             
             // Check that the prev. stake block has required confirmations by height.
-            if (chainActive.Tip()->nHeight - pindex->nHeight < Params().Stake_Min_Confirmations())
+            if (nConfirmations < Params().Stake_Min_Confirmations())
                 return state.DoS(100, error("%s: stake under minimum required confirmations", __func__));
     }
 
-    // ----------- swiftTX transaction scanning -----------
-    if (IsSporkActive(SPORK_3_SWIFTTX_BLOCK_FILTERING)) {
-        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-            if (!tx.IsCoinBase()) {
-                //only reject blocks when it's based on complete consensus
-                BOOST_FOREACH (const CTxIn& in, tx.vin) {
-                    if (mapLockedInputs.count(in.prevout)) {
-                        if (mapLockedInputs[in.prevout] != tx.GetHash()) {
-                            mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
-                            LogPrintf("%s: found conflicting transaction with transaction lock %s %s\n", __func__, mapLockedInputs[in.prevout].ToString(), tx.GetHash().ToString());
-                            return state.DoS(0, error("%s: found conflicting transaction with transaction lock", __func__),
-                                REJECT_INVALID, "conflicting-tx-ix");
-                        }
-                    }
-                }
-            }
-        }
-    } else {
-        LogPrintf("%s: skipping transaction locking checks\n", __func__);
-    }
-
-    // masternode payments / budgets
-    CBlockIndex* pindexPrev = chainActive.Tip();
-    int nHeight = 0;
-    if (pindexPrev != NULL) {
-        if (pindexPrev->GetBlockHash() == block.hashPrevBlock) {
-            nHeight = pindexPrev->nHeight + 1;
-        } else { //out of order
-            BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
-            if (mi != mapBlockIndex.end() && (*mi).second)
-                nHeight = (*mi).second->nHeight + 1;
-        }
-
-        // Liberty
-        // It is entierly possible that we don't have enough data and this could fail
-        // (i.e. the block could indeed be valid). Store the block for later consideration
-        // but issue an initial reject message.
-        // The case also exists that the sending peer could not have enough data to see
-        // that this block is invalid, so don't issue an outright ban.
-        if (nHeight != 0 && !IsInitialBlockDownload()) {
-            if (!IsBlockPayeeValid(block, nHeight)) {
-                mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
-                return state.DoS(0, error("%s: couldn't find masternode/budget payment", __func__),
-                    REJECT_INVALID, "bad-cb-payee");
-            }
-        } else {
-            if (fDebug)
-                LogPrintf("%s: masternode payment check skipped on sync - skipping IsBlockPayeeValid()\n", __func__);
-        }
-    }
+    if (fCheckLocksAndPayee && !CheckBlockLocksAndPayee(block, state))
+        return false;
 
     // Check transactions
     vector<CBigNum> vBlockSerials;
@@ -4126,7 +4270,7 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
                 searchedBlockCount <= Params().MaxReorganizationDepth()) {
                 
                 CBlock forkedBlock;
-                if (!ReadBlockFromDisk(forkedBlock, lastSearchedBlock))
+                if (!ReadBlockFromDiskCached(forkedBlock, lastSearchedBlock))
                     // this should never happen
                     break;
 
@@ -4233,11 +4377,11 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp)
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp, bool fAlreadyChecked)
 {
     // Preliminary checks
     int64_t nStartTime = GetTimeMillis();
-    bool checked = CheckBlock(*pblock, state);
+    bool checked = fAlreadyChecked ? CheckBlockLocksAndPayee(*pblock, state) : CheckBlock(*pblock, state);
 
     int nMints = 0;
     int nSpends = 0;
@@ -4256,7 +4400,7 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     if (nMints || nSpends)
         LogPrintf("%s : block contains %d XLIBz mints and %d XLIBz spends\n", __func__, nMints, nSpends);
 
-    if (!CheckBlockSignature(*pblock))
+    if (!fAlreadyChecked && !CheckBlockSignature(*pblock))
         return error("ProcessNewBlock() : bad proof-of-stake block signature");
 
     if (pblock->GetHash() != Params().HashGenesisBlock() && pfrom != NULL) {
@@ -4414,9 +4558,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
     //mark as PoS seen
@@ -4430,8 +4572,12 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
 
 bool static LoadBlockIndexDB(string& strError)
 {
+    int64_t nStart = GetTimeMillis();
+    int64_t nResidentBefore = GetResidentMemoryKiB();
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
+    LogPrintf("LoadBlockIndexDB(): loaded %u block index entries in %dms, %u KiB in entries, resident memory %d KiB -> %d KiB\n",
+        mapBlockIndex.size(), GetTimeMillis() - nStart, blockIndexArena.DynamicMemoryUsage() / 1024, nResidentBefore, GetResidentMemoryKiB());
 
     boost::this_thread::interruption_point();
 
@@ -4470,6 +4616,7 @@ bool static LoadBlockIndexDB(string& strError)
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
+    nLastBlockFileShared = nLastBlockFile;
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
     for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
@@ -4544,69 +4691,206 @@ CVerifyDB::~CVerifyDB()
     uiInterface.ShowProgress("", 100);
 }
 
+/**
+ * Blocks read and checked at levels 0 to 2 by VerifyDB's worker threads, at
+ * most MAX_VERIFY_DB_READAHEAD blocks ahead of the serial replay. Results are
+ * picked up in chain order, so the first failure below the tip is the one
+ * reported, like when the checks ran one block at a time.
+ */
+class CVerifyDBWorkers
+{
+public:
+    CVerifyDBWorkers(const std::vector<CBlockIndex*>& vIndexIn, int nCheckLevelIn, int nThreads)
+        : vIndex(vIndexIn), vBlock(vIndexIn.size()), vError(vIndexIn.size()), vDone(vIndexIn.size(), false),
+          nCheckLevel(nCheckLevelIn), nNext(0), nConsumed(0), fStop(false), nTimeRead(0), nTimeCheck(0), nTimeUndo(0)
+    {
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CVerifyDBWorkers::Loop, this));
+    }
+
+    ~CVerifyDBWorkers()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        threadGroup.join_all();
+    }
+
+    //! Wait for block i, returns the reason it failed its checks or an empty string
+    std::string Get(size_t i, boost::shared_ptr<CBlock>& pblock)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!vDone[i])
+                condDone.wait(lock);
+            pblock.swap(vBlock[i]);
+            nConsumed = i + 1;
+        }
+        condWork.notify_all();
+        return vError[i];
+    }
+
+    void GetTimes(int64_t& nTimeReadOut, int64_t& nTimeCheckOut, int64_t& nTimeUndoOut)
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        nTimeReadOut = nTimeRead;
+        nTimeCheckOut = nTimeCheck;
+        nTimeUndoOut = nTimeUndo;
+    }
+
+private:
+    const std::vector<CBlockIndex*>& vIndex;
+    std::vector<boost::shared_ptr<CBlock> > vBlock;
+    std::vector<std::string> vError;
+    std::vector<bool> vDone;
+    int nCheckLevel;
+
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    boost::thread_group threadGroup;
+    size_t nNext;
+    size_t nConsumed;
+    bool fStop;
+    //! Time spent at each level, in microseconds summed over the threads, protected by mutex
+    int64_t nTimeRead;
+    int64_t nTimeCheck;
+    int64_t nTimeUndo;
+
+    void Loop()
+    {
+        RenameThread("liberty-verifydb");
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNext < vIndex.size() && nNext >= nConsumed + MAX_VERIFY_DB_READAHEAD)
+                    condWork.wait(lock);
+                if (fStop || nNext >= vIndex.size())
+                    return;
+                i = nNext++;
+            }
+
+            const CBlockIndex* pindex = vIndex[i];
+            boost::shared_ptr<CBlock> pblock(new CBlock());
+            std::string strError;
+            CValidationState state;
+            int64_t nTimeStart = GetTimeMicros();
+            // check level 0: read from disk
+            if (!ReadBlockFromDisk(*pblock, pindex))
+                strError = strprintf("ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            int64_t nTime1 = GetTimeMicros();
+            // check level 1: verify block validity, the SwiftX locks and masternode payments are
+            // network state that stored blocks aren't checked against
+            if (strError.empty() && nCheckLevel >= 1 && !CheckBlock(*pblock, state, true, true, true, false))
+                strError = strprintf("found bad block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            int64_t nTime2 = GetTimeMicros();
+            // check level 2: verify undo validity
+            if (strError.empty() && nCheckLevel >= 2) {
+                CBlockUndo undo;
+                CDiskBlockPos pos = pindex->GetUndoPos();
+                if (!pos.IsNull() && !undo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
+                    strError = strprintf("found bad undo data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            }
+            int64_t nTime3 = GetTimeMicros();
+
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                vBlock[i] = pblock;
+                vError[i] = strError;
+                vDone[i] = true;
+                nTimeRead += nTime1 - nTimeStart;
+                nTimeCheck += nTime2 - nTime1;
+                nTimeUndo += nTime3 - nTime2;
+            }
+            condDone.notify_all();
+        }
+    }
+};
+
 bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth)
 {
-    LOCK(cs_main);
-    if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
-        return true;
+    // cs_main is only held for the replay at levels 3 and 4, CheckBlock on the
+    // worker threads needs it too.
+    std::vector<CBlockIndex*> vIndex;
+    CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+        if (pindexTip == NULL || pindexTip->pprev == NULL)
+            return true;
 
-    // Verify blocks in the best chain
-    if (nCheckDepth <= 0)
-        nCheckDepth = 1000000000; // suffices until the year 19000
-    if (nCheckDepth > chainActive.Height())
-        nCheckDepth = chainActive.Height();
+        // Verify blocks in the best chain
+        if (nCheckDepth <= 0)
+            nCheckDepth = 1000000000; // suffices until the year 19000
+        if (nCheckDepth > chainActive.Height())
+            nCheckDepth = chainActive.Height();
+        for (CBlockIndex* pindex = pindexTip; pindex && pindex->pprev && pindex->nHeight >= chainActive.Height() - nCheckDepth; pindex = pindex->pprev)
+            vIndex.push_back(pindex);
+    }
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
+    int nThreads = std::max(1, nScriptCheckThreads);
     LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+
     CCoinsViewCache coins(coinsview);
-    CBlockIndex* pindexState = chainActive.Tip();
+    CBlockIndex* pindexState = pindexTip;
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
+    bool fReplay = nCheckLevel >= 3;
     CValidationState state;
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
-        boost::this_thread::interruption_point();
-        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
-        if (pindex->nHeight < chainActive.Height() - nCheckDepth)
-            break;
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex))
-            return error("VerifyDB() : *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
-            return error("VerifyDB() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!undo.ReadFromDisk(pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB() : *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+    int64_t nTimeStart = GetTimeMicros();
+    int64_t nTimeWait = 0, nTimeDisconnect = 0, nTimeConnect = 0;
+    int64_t nTimeRead = 0, nTimeCheck = 0, nTimeUndo = 0;
+    {
+        CVerifyDBWorkers workers(vIndex, nCheckLevel, nThreads);
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            boost::this_thread::interruption_point();
+            CBlockIndex* pindex = vIndex[i];
+            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(pindexTip->nHeight - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
+            boost::shared_ptr<CBlock> pblock;
+            int64_t nTime1 = GetTimeMicros();
+            std::string strError = workers.Get(i, pblock);
+            int64_t nTime2 = GetTimeMicros();
+            nTimeWait += nTime2 - nTime1;
+            if (!strError.empty())
+                return error("VerifyDB() : *** %s", strError);
+            // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+            if (fReplay && pindex == pindexState) {
+                LOCK(cs_main);
+                if (chainActive.Tip() != pindexTip) {
+                    LogPrintf("VerifyDB() : best chain changed, not replaying further blocks\n");
+                    fReplay = false;
+                } else if ((coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+                    bool fClean = true;
+                    if (!DisconnectBlock(*pblock, state, pindex, coins, &fClean))
+                        return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                    pindexState = pindex->pprev;
+                    if (!fClean) {
+                        nGoodTransactions = 0;
+                        pindexFailure = pindex;
+                    } else
+                        nGoodTransactions += pblock->vtx.size();
+                }
             }
+            nTimeDisconnect += GetTimeMicros() - nTime2;
+            if (ShutdownRequested())
+                return true;
         }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
-            bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
-                return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            pindexState = pindex->pprev;
-            if (!fClean) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else
-                nGoodTransactions += block.vtx.size();
-        }
-        if (ShutdownRequested())
-            return true;
+        workers.GetTimes(nTimeRead, nTimeCheck, nTimeUndo);
     }
     if (pindexFailure)
-        return error("VerifyDB() : *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
+        return error("VerifyDB() : *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", pindexTip->nHeight - pindexFailure->nHeight + 1, nGoodTransactions);
 
     // check level 4: try reconnecting blocks
-    if (nCheckLevel >= 4) {
+    if (nCheckLevel >= 4 && fReplay) {
+        int64_t nTime1 = GetTimeMicros();
+        LOCK(cs_main);
         CBlockIndex* pindex = pindexState;
-        while (pindex != chainActive.Tip()) {
+        while (pindex != pindexTip && chainActive.Tip() == pindexTip) {
             boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
+            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(pindexTip->nHeight - pindex->nHeight)) / (double)nCheckDepth * 50))));
             pindex = chainActive.Next(pindex);
             CBlock block;
             if (!ReadBlockFromDisk(block, pindex))
@@ -4614,9 +4898,13 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             if (!ConnectBlock(block, state, pindex, coins, false))
                 return error("VerifyDB() : *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         }
+        nTimeConnect = GetTimeMicros() - nTime1;
     }
 
-    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
+    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", pindexTip->nHeight - pindexState->nHeight, nGoodTransactions);
+    LogPrintf("VerifyDB() : %u blocks in %.2fs on %d threads: read %.2fs, check %.2fs, undo %.2fs (summed over threads), waited %.2fs, disconnect %.2fs, reconnect %.2fs\n",
+        vIndex.size(), (GetTimeMicros() - nTimeStart) * 0.000001, nThreads, nTimeRead * 0.000001, nTimeCheck * 0.000001, nTimeUndo * 0.000001,
+        nTimeWait * 0.000001, nTimeDisconnect * 0.000001, nTimeConnect * 0.000001);
 
     return true;
 }
@@ -5061,7 +5349,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end()) {
@@ -5081,12 +5369,20 @@ void static ProcessGetData(CNode* pfrom)
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
+                    boost::shared_ptr<const CBlock> pblock;
+                    if (!ReadBlockFromDiskCached(pblock, (*mi).second))
                         assert(!"cannot load block from disk");
+                    const CBlock& block = *pblock;
                     if (inv.type == MSG_BLOCK)
                         pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    else if (inv.type == MSG_CMPCT_BLOCK) {
+                        // Transactions of older blocks are no longer in the peer's mempool
+                        if (chainActive.Height() - mi->second->nHeight < MAX_CMPCTBLOCK_DEPTH) {
+                            pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                            RecordCompactBlockSent();
+                        } else
+                            pfrom->PushMessage("block", block);
+                    } else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
@@ -5100,7 +5396,7 @@ void static ProcessGetData(CNode* pfrom)
                             // however we MUST always provide at least what the remote peer needs
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH (PairType& pair, merkleBlock.vMatchedTxn)
-                                if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
+                                if (!pfrom->IsInventoryKnown(CInv(MSG_TX, pair.second)))
                                     pfrom->PushMessage("tx", block.vtx[pair.first]);
                         }
                         // else
@@ -5256,7 +5552,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             GetMainSignals().Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -5276,6 +5572,54 @@ void static ProcessGetData(CNode* pfrom)
 }
 
 bool fRequestedSporksIDB = false;
+/** Validate a block received from pfrom and tell the peer when it was rejected */
+void static ProcessReceivedBlock(CNode* pfrom, CBlock& block, bool fAlreadyChecked = false)
+{
+    CInv inv(MSG_BLOCK, block.GetHash());
+    pfrom->AddInventoryKnown(inv);
+
+    CValidationState state;
+    if (!mapBlockIndex.count(block.GetHash())) {
+        ProcessNewBlock(state, pfrom, &block, NULL, fAlreadyChecked);
+        int nDoS;
+        if (state.IsInvalid(nDoS)) {
+            pfrom->PushMessage("reject", (string) "block", state.GetRejectCode(),
+                state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
+            if (nDoS > 0) {
+                TRY_LOCK(cs_main, lockMain);
+                if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
+            }
+        }
+        //disconnect this node if its old protocol version
+        pfrom->DisconnectOldProtocol(ActiveProtocol(), "block");
+    } else {
+        LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+    }
+}
+
+/**
+ * Build the compact block pending for pfrom from what was found in the mempool
+ * and vtxMissing. Falls back to requesting the full block when the result
+ * doesn't match the header. Requires cs_main.
+ */
+ReadStatus static FillPartialBlock(CNode* pfrom, const vector<CTransaction>& vtxMissing, uint64_t nBytesReceived, CBlock& block)
+{
+    CNodeState* nodestate = State(pfrom->GetId());
+    uint256 hashBlock = nodestate->partialBlock.header.GetHash();
+    ReadStatus status = nodestate->partialBlock.FillBlock(block, vtxMissing);
+
+    uint64_t nFullSize = status == READ_STATUS_OK ? ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION) : 0;
+    RecordCompactBlockReceived(nodestate->partialBlock, vtxMissing.size(), nodestate->nPartialBlockBytes + nBytesReceived, nFullSize);
+    nodestate->partialBlock = PartiallyDownloadedBlock();
+    nodestate->nPartialBlockBytes = 0;
+
+    if (status == READ_STATUS_FAILED) {
+        LogPrint("net", "could not reconstruct compact block %s, requesting full block from peer=%d\n", hashBlock.ToString(), pfrom->id);
+        pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, hashBlock)));
+    }
+    return status;
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     RandAddSeedPerfmon();
@@ -5421,6 +5765,20 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Let the peer know it can send us compact blocks. Older peers ignore unknown messages.
+        if (fCompactBlocks)
+            pfrom->PushMessage("sendcmpct", CMPCTBLOCK_VERSION);
+    }
+
+
+    else if (strCommand == "sendcmpct") {
+        uint64_t nCmpctVersion = 0;
+        vRecv >> nCmpctVersion;
+        if (nCmpctVersion == CMPCTBLOCK_VERSION) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fSupportsCompactBlocks = true;
+        }
     }
 
 
@@ -5531,8 +5889,19 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
         }
 
-        if (!vToFetch.empty())
+        if (!vToFetch.empty()) {
+            // Near the tip we already have most of the transactions of a new block in our mempool
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (fCompactBlocks && nodestate->fSupportsCompactBlocks && !IsInitialBlockDownload()) {
+                BOOST_FOREACH (CInv& inv, vToFetch) {
+                    if (nodestate->setCompactBlocksRequested.size() >= (size_t)MAX_BLOCKS_IN_TRANSIT_PER_PEER)
+                        break;
+                    inv.type = MSG_CMPCT_BLOCK;
+                    nodestate->setCompactBlocksRequested.insert(inv.hash);
+                }
+            }
             pfrom->PushMessage("getdata", vToFetch);
+        }
     }
 
 
@@ -5852,8 +6221,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
 
+        // The parent may still be waiting in the pipeline, this block then goes in right after it
+        bool fParentQueued = blockPipeline.IsLastQueued(block.hashPrevBlock);
+
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
-        if (!mapBlockIndex.count(block.hashPrevBlock)) {
+        if (!fParentQueued && !mapBlockIndex.count(block.hashPrevBlock)) {
             if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
                 //we already asked for this block, so lets work backwards and ask for the previous block
                 pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
@@ -5863,27 +6235,143 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 pfrom->PushMessage("getblocks", chainActive.GetLocator(), hashBlock);
                 pfrom->vBlockRequested.push_back(hashBlock);
             }
+        } else if (blockPipeline.IsRunning() && (fParentQueued || blockPipeline.Size() > 0 || IsInitialBlockDownload())) {
+            // Checked on the pipeline's check threads and connected on its connect thread,
+            // after any blocks already queued
+            if (!blockPipeline.Push(pfrom, block)) {
+                // The pipeline is full. Handling the block here would put it ahead of the queued
+                // ones, so it is no longer counted as in flight and gets downloaded again.
+                LogPrint("net", "block pipeline full, dropping block %s peer=%d\n", hashBlock.ToString(), pfrom->id);
+                LOCK(cs_main);
+                MarkBlockAsReceived(hashBlock);
+            }
         } else {
-            pfrom->AddInventoryKnown(inv);
+            ProcessReceivedBlock(pfrom, block);
+        }
+    }
+
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        uint64_t nMessageSize = vRecv.size();
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+        CInv inv(MSG_BLOCK, hashBlock);
+        LogPrint("net", "received compact block %s (%u transactions) peer=%d\n", hashBlock.ToString(), cmpctblock.BlockTxCount(), pfrom->id);
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            // Rebuilding the block scans the mempool, so that is only done for blocks asked
+            // from this peer that extend a known block and have a valid header
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (!nodestate->setCompactBlocksRequested.erase(hashBlock)) {
+                LogPrint("net", "ignoring compact block %s we didn't ask for peer=%d\n", hashBlock.ToString(), pfrom->id);
+                return true;
+            }
+            if (mapBlockIndex.count(hashBlock)) {
+                pfrom->AddInventoryKnown(inv);
+                return true;
+            }
+            BlockMap::iterator mi = mapBlockIndex.find(cmpctblock.header.hashPrevBlock);
+            if (mi == mapBlockIndex.end()) {
+                // Let the full block path find out what we are missing
+                pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+                return true;
+            }
             CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash())) {
-                ProcessNewBlock(state, pfrom, &block);
+            if (!CheckBlockHeader(cmpctblock.header, state, false) || !ContextualCheckBlockHeader(cmpctblock.header, state, mi->second)) {
                 int nDoS;
-                if (state.IsInvalid(nDoS)) {
-                    pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                        state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-                    if (nDoS > 0) {
-                        TRY_LOCK(cs_main, lockMain);
-                        if (lockMain) Misbehaving(pfrom->GetId(), nDoS);
-                    }
-                }
-                //disconnect this node if its old protocol version
-                pfrom->DisconnectOldProtocol(ActiveProtocol(), strCommand);
-            } else {
-                LogPrint("net", "%s : Already processed block %s, skipping ProcessNewBlock()\n", __func__, block.GetHash().GetHex());
+                if (state.IsInvalid(nDoS) && nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                return error("peer=%d sent compact block %s with an invalid header", pfrom->id, hashBlock.ToString());
             }
+
+            nodestate->partialBlock = PartiallyDownloadedBlock();
+            ReadStatus status = nodestate->partialBlock.InitData(cmpctblock, mempool);
+            if (status == READ_STATUS_INVALID) {
+                nodestate->partialBlock = PartiallyDownloadedBlock();
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us invalid compact block %s", pfrom->id, hashBlock.ToString());
+            }
+            if (status == READ_STATUS_FAILED) {
+                RecordCompactBlockReceived(nodestate->partialBlock, 0, 0, 0);
+                nodestate->partialBlock = PartiallyDownloadedBlock();
+                pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+                return true;
+            }
+
+            CBlockTransactionsRequest req;
+            req.blockhash = hashBlock;
+            nodestate->partialBlock.GetMissing(req.indexes);
+            nodestate->nPartialBlockBytes = nMessageSize;
+            if (!req.indexes.empty()) {
+                pfrom->PushMessage("getblocktxn", req);
+                return true;
+            }
+
+            if (FillPartialBlock(pfrom, vector<CTransaction>(), 0, block) != READ_STATUS_OK)
+                return true;
+        }
+        ProcessReceivedBlock(pfrom, block);
+    }
+
+
+    else if (strCommand == "getblocktxn") {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA) || !chainActive.Contains(mi->second) ||
+            chainActive.Height() - mi->second->nHeight >= MAX_BLOCKTXN_DEPTH) {
+            LogPrint("net", "peer=%d asked for transactions of unknown or old block %s\n", pfrom->id, req.blockhash.ToString());
+            return true;
+        }
+
+        boost::shared_ptr<const CBlock> pblock;
+        if (!ReadBlockFromDiskCached(pblock, mi->second))
+            return error("%s : cannot load block %s from disk", __func__, req.blockhash.ToString());
+        const CBlock& block = *pblock;
+
+        CBlockTransactions resp(req);
+        resp.txn.reserve(req.indexes.size());
+        BOOST_FOREACH (uint16_t index, req.indexes) {
+            if (index >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d asked for out of range transaction %u of block %s", pfrom->id, index, req.blockhash.ToString());
+            }
+            resp.txn.push_back(block.vtx[index]);
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        uint64_t nMessageSize = vRecv.size();
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        {
+            LOCK(cs_main);
+            CNodeState* nodestate = State(pfrom->GetId());
+            if (nodestate->partialBlock.IsNull() || nodestate->partialBlock.header.GetHash() != resp.blockhash) {
+                LogPrint("net", "peer=%d sent us unrequested transactions for block %s\n", pfrom->id, resp.blockhash.ToString());
+                return true;
+            }
+
+            ReadStatus status = FillPartialBlock(pfrom, resp.txn, nMessageSize, block);
+            if (status == READ_STATUS_INVALID) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us the wrong transactions for block %s", pfrom->id, resp.blockhash.ToString());
+            }
+            if (status != READ_STATUS_OK)
+                return true;
         }
+        ProcessReceivedBlock(pfrom, block);
     }
 
 
@@ -6107,13 +6595,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
     } else {
         //probably one the extensions
-        obfuScationPool.ProcessMessageObfuscation(pfrom, strCommand, vRecv);
-        mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
-        budget.ProcessMessage(pfrom, strCommand, vRecv);
-        masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
+        // Masternode data received before the caches are read would be overwritten by them
+        bool fMasternodeCaches = IsStartupTaskDone(STARTUP_TASK_MASTERNODE_CACHES);
+        if (fMasternodeCaches) {
+            obfuScationPool.ProcessMessageObfuscation(pfrom, strCommand, vRecv);
+            mnodeman.ProcessMessage(pfrom, strCommand, vRecv);
+            budget.ProcessMessage(pfrom, strCommand, vRecv);
+            masternodePayments.ProcessMessageMasternodePayments(pfrom, strCommand, vRecv);
+        }
         ProcessMessageSwiftTX(pfrom, strCommand, vRecv);
         ProcessSpork(pfrom, strCommand, vRecv);
-        masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
+        if (fMasternodeCaches)
+            masternodeSync.ProcessMessage(pfrom, strCommand, vRecv);
     }
 
 
@@ -6137,6 +6630,82 @@ int ActiveProtocol()
     return MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT;
 }
 
+// Messages that are handled by their own subsystem, off the message handler thread so they don't wait behind blocks.
+// Their handlers only take cs_main through MisbehavingNoWait. SwiftX lock votes stay on the message handler
+// thread, the SwiftX maps are shared with "ix" and block checks without a lock of their own.
+static bool IsWorkerMessage(const string& strCommand)
+{
+    return strCommand == "mnp" || strCommand == "mnw" || strCommand == "mvote" || strCommand == "dseg";
+}
+
+// Process a single message and record its processing time
+static bool HandleMessage(CNode* pfrom, const string& strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+{
+    unsigned int nMessageSize = vRecv.size();
+    int64_t nTimeStart = GetTimeMicros();
+
+    bool fRet = false;
+    try {
+        fRet = ProcessMessage(pfrom, strCommand, vRecv, nTimeReceived);
+        boost::this_thread::interruption_point();
+    } catch (std::ios_base::failure& e) {
+        pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
+        if (strstr(e.what(), "end of data")) {
+            // Allow exceptions from under-length message on vRecv
+            LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(strCommand), nMessageSize, e.what());
+        } else if (strstr(e.what(), "size too large")) {
+            // Allow exceptions from over-long size
+            LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
+        } else {
+            PrintExceptionContinue(&e, "ProcessMessages()");
+        }
+    } catch (boost::thread_interrupted) {
+        throw;
+    } catch (std::exception& e) {
+        PrintExceptionContinue(&e, "ProcessMessages()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "ProcessMessages()");
+    }
+
+    RecordMessageTime(strCommand, GetTimeMicros() - nTimeStart);
+
+    if (!fRet)
+        LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
+
+    return fRet;
+}
+
+static void HandleQueuedMessage(CNode* pfrom, const string& strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+{
+    HandleMessage(pfrom, strCommand, vRecv, nTimeReceived);
+}
+
+void StartMessageWorkers(boost::thread_group& threadGroup, int nThreads)
+{
+    messageQueue.Start(threadGroup, nThreads, &HandleQueuedMessage);
+}
+
+/**
+ * Checks that don't need the chain state, run ahead of connecting on the pipeline's check threads.
+ * The SwiftX lock and payee checks are left to ProcessNewBlock on the connect thread.
+ */
+static bool PipelineCheckBlock(const CBlock& block)
+{
+    CValidationState state;
+    return CheckBlock(block, state, true, true, true, false) && CheckBlockSignature(block);
+}
+
+static void PipelineConnectBlock(CNode* pfrom, CBlock& block, bool fChecked)
+{
+    // Blocks that failed the checks go through them again, so the peer gets the usual reject and penalty
+    ProcessReceivedBlock(pfrom, block, fChecked);
+}
+
+void StartBlockPipeline(boost::thread_group& threadGroup, int nCheckThreads)
+{
+    blockPipeline.Start(threadGroup, nCheckThreads, &PipelineCheckBlock, &PipelineConnectBlock);
+}
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -6209,39 +6778,31 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
-        // Process message
-        bool fRet = false;
-        try {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
-            boost::this_thread::interruption_point();
-        } catch (std::ios_base::failure& e) {
-            pfrom->PushMessage("reject", strCommand, REJECT_MALFORMED, string("error parsing message"));
-            if (strstr(e.what(), "end of data")) {
-                // Allow exceptions from under-length message on vRecv
-                LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught, normally caused by a message being shorter than its stated length\n", SanitizeString(strCommand), nMessageSize, e.what());
-            } else if (strstr(e.what(), "size too large")) {
-                // Allow exceptions from over-long size
-                LogPrintf("ProcessMessages(%s, %u bytes): Exception '%s' caught\n", SanitizeString(strCommand), nMessageSize, e.what());
-            } else {
-                PrintExceptionContinue(&e, "ProcessMessages()");
+        // Let the worker lanes handle masternode and budget traffic instead of
+        // queueing it behind blocks
+        if (pfrom->fSuccessfullyConnected && IsWorkerMessage(strCommand) && messageQueue.IsRunning()) {
+            if (messageQueue.Push(pfrom, strCommand, vRecv, msg.nTime)) {
+                pfrom->fPauseRecv = false;
+                continue;
             }
-        } catch (boost::thread_interrupted) {
-            throw;
-        } catch (std::exception& e) {
-            PrintExceptionContinue(&e, "ProcessMessages()");
-        } catch (...) {
-            PrintExceptionContinue(NULL, "ProcessMessages()");
+            // The peer's lane is full: keep the message and stop reading from the
+            // peer until the workers have caught up
+            pfrom->fPauseRecv = true;
+            it--;
+            break;
         }
 
-        if (!fRet)
-            LogPrintf("ProcessMessage(%s, %u bytes) FAILED peer=%d\n", SanitizeString(strCommand), nMessageSize, pfrom->id);
-
+        // Process message
+        HandleMessage(pfrom, strCommand, vRecv, msg.nTime);
         break;
     }
 
     // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
+    if (!pfrom->fDisconnect) {
+        for (std::deque<CNetMessage>::iterator itDone = pfrom->vRecvMsg.begin(); itDone != it; ++itDone)
+            recvBufferPool.Release(itDone->vRecv);
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+    }
 
     return fOk;
 }
@@ -6287,6 +6848,8 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (!lockMain)
             return true;
 
+        ApplyQueuedMisbehaving(pto->GetId());
+
         // Address refresh broadcast
         static int64_t nLastRebroadcast;
         if (!IsInitialBlockDownload() && (GetTime() - nLastRebroadcast > 24 * 60 * 60)) {
@@ -6370,34 +6933,29 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         //
         // Message: inventory
         //
+        // Announcements are batched per peer on a randomized timer, which also
+        // keeps the origin of a relayed object hard to pin down. Blocks and
+        // SwiftX locks are latency sensitive and always go out right away.
+        int64_t nNow = GetTimeMicros();
+        bool fSendBatch = pto->fWhitelisted || pto->nNextInvSend < nNow;
+        if (fSendBatch)
+            pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL);
+
         vector<CInv> vInv;
         vector<CInv> vInvWait;
         {
             LOCK(pto->cs_inventory);
             vInv.reserve(pto->vInventoryToSend.size());
-            vInvWait.reserve(pto->vInventoryToSend.size());
+            if (!fSendBatch)
+                vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH (const CInv& inv, pto->vInventoryToSend) {
-                if (pto->setInventoryKnown.count(inv))
+                if (!fSendBatch && inv.type != MSG_BLOCK && inv.type != MSG_TXLOCK_REQUEST && inv.type != MSG_TXLOCK_VOTE) {
+                    vInvWait.push_back(inv);
                     continue;
-
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle) {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt == 0)
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = inv.hash ^ hashSalt;
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((hashRand & 3) != 0);
-
-                    if (fTrickleWait) {
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second) {
+                // returns true if the peer didn't know it yet
+                if (pto->AddInventoryKnown(inv)) {
                     vInv.push_back(inv);
                     if (vInv.size() >= 1000) {
                         pto->PushMessage("inv", vInv);
@@ -6405,13 +6963,12 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
             }
-            pto->vInventoryToSend = vInvWait;
+            pto->vInventoryToSend.swap(vInvWait);
         }
         if (!vInv.empty())
             pto->PushMessage("inv", vInv);
 
         // Detect whether we're stalling
-        int64_t nNow = GetTimeMicros();
         if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
@@ -6540,10 +7097,8 @@ public:
     ~CMainCleanup()
     {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
@@ -260,6 +260,20 @@ public:
         mapOrphanMasternodeBudgetVotes.clear();
         mapOrphanFinalizedBudgetVotes.clear();
     }
+    // Exchange the objects that are stored in budget.dat with a budget loaded elsewhere
+    void Swap(CBudgetManager& other)
+    {
+        LOCK2(cs, other.cs);
+
+        mapProposals.swap(other.mapProposals);
+        mapFinalizedBudgets.swap(other.mapFinalizedBudgets);
+        mapSeenMasternodeBudgetProposals.swap(other.mapSeenMasternodeBudgetProposals);
+        mapSeenMasternodeBudgetVotes.swap(other.mapSeenMasternodeBudgetVotes);
+        mapSeenFinalizedBudgets.swap(other.mapSeenFinalizedBudgets);
+        mapSeenFinalizedBudgetVotes.swap(other.mapSeenFinalizedBudgetVotes);
+        mapOrphanMasternodeBudgetVotes.swap(other.mapOrphanMasternodeBudgetVotes);
+        mapOrphanFinalizedBudgetVotes.swap(other.mapOrphanFinalizedBudgetVotes);
+    }
     void CheckAndRemove();
     std::string ToString() const;
 
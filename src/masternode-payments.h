@@ -253,6 +253,15 @@ public:
         mapMasternodePayeeVotes.clear();
     }
 
+    // Exchange the votes and block payees with payments loaded elsewhere. The locks guarding
+    // them are global, so this also covers the other object.
+    void Swap(CMasternodePayments& other)
+    {
+        LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
+        mapMasternodePayeeVotes.swap(other.mapMasternodePayeeVotes);
+        mapMasternodeBlocks.swap(other.mapMasternodeBlocks);
+    }
+
     bool AddWinningMasternode(CMasternodePaymentWinner& winner);
     bool ProcessBlock(int nBlockHeight);
 
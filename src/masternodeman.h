@@ -109,6 +109,9 @@ public:
     /// Clear Masternode vector
     void Clear();
 
+    /// Exchange the masternode list and the seen maps with a list loaded elsewhere
+    void Swap(CMasternodeMan& other);
+
     int CountEnabled(int protocolVersion = -1);
 
     void CountNetworks(int protocolVersion, int& ipv4, int& ipv6, int& onion);
@@ -9,6 +9,7 @@
 
 #include "amount.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "masternode-sync.h"
 #include "net.h"
@@ -574,6 +575,12 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
 
     while (fGenerateBitcoins || fProofOfStake) {
         if (fProofOfStake) {
+            // Wait for a deferred wallet rescan, the wallet and the zerocoin tracker are incomplete until it is done
+            if (!IsStartupTaskDone(STARTUP_TASK_RESCAN)) {
+                MilliSleep(5000);
+                continue;
+            }
+
             //control the amount of times the client will check for mintable coins
             if ((GetTime() - nMintableLastCheck > 5 * 60)) // 5 minute check time
             {
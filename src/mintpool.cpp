@@ -30,6 +30,7 @@ void CMintPool::Add(const CBigNum& bnValue, const uint32_t& nCount)
 void CMintPool::Add(const pair<uint256, uint32_t>& pMint, bool fVerbose)
 {
     insert(pMint);
+    setCounts.insert(pMint.second);
     if (pMint.second > nCountLastGenerated)
         nCountLastGenerated = pMint.second;
 
@@ -68,6 +69,7 @@ std::list<pair<uint256, uint32_t> > CMintPool::List()
 void CMintPool::Reset()
 {
     clear();
+    setCounts.clear();
     nCountLastGenerated = 0;
     nCountLastRemoved = 0;
 }
@@ -103,6 +105,7 @@ void CMintPool::Remove(const uint256& hashPubcoin)
         return;
 
     nCountLastRemoved = it->second;
+    setCounts.erase(it->second);
     erase(it);
 }
 
@@ -0,0 +1,156 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "msgqueue.h"
+
+#include "net.h"
+#include "util.h"
+#include "version.h"
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+CPeerMessageQueue messageQueue;
+
+const int64_t CMessageTimeStats::BUCKET_LIMITS[CMessageTimeStats::NUM_BUCKETS - 1] = {10, 100, 1000, 10000, 100000, 1000000};
+
+//! Commands are chosen by the remote peer, so only keep this many separate entries
+static const unsigned int MAX_MESSAGE_STATS_COMMANDS = 128;
+
+static CCriticalSection cs_mapMessageStats;
+static std::map<std::string, CMessageTimeStats> mapMessageStats;
+
+CMessageTimeStats::CMessageTimeStats() : nCount(0), nTotalMicros(0), nMaxMicros(0)
+{
+    for (int i = 0; i < NUM_BUCKETS; i++)
+        vBuckets[i] = 0;
+}
+
+void CMessageTimeStats::Add(int64_t nMicros)
+{
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+
+    int nBucket = 0;
+    while (nBucket < NUM_BUCKETS - 1 && nMicros >= BUCKET_LIMITS[nBucket])
+        nBucket++;
+    vBuckets[nBucket]++;
+}
+
+std::string CMessageTimeStats::BucketName(int nBucket)
+{
+    if (nBucket < NUM_BUCKETS - 1)
+        return strprintf("<%dus", BUCKET_LIMITS[nBucket]);
+    return strprintf(">=%dus", BUCKET_LIMITS[NUM_BUCKETS - 2]);
+}
+
+void RecordMessageTime(const std::string& strCommand, int64_t nMicros)
+{
+    LOCK(cs_mapMessageStats);
+    std::map<std::string, CMessageTimeStats>::iterator it = mapMessageStats.find(strCommand);
+    if (it == mapMessageStats.end()) {
+        if (mapMessageStats.size() >= MAX_MESSAGE_STATS_COMMANDS)
+            it = mapMessageStats.insert(std::make_pair(std::string("other"), CMessageTimeStats())).first;
+        else
+            it = mapMessageStats.insert(std::make_pair(strCommand, CMessageTimeStats())).first;
+    }
+    it->second.Add(nMicros);
+}
+
+void GetMessageTimeStats(std::map<std::string, CMessageTimeStats>& mapStatsOut)
+{
+    LOCK(cs_mapMessageStats);
+    mapStatsOut = mapMessageStats;
+}
+
+CPeerMessageQueue::CPeerMessageQueue()
+{
+}
+
+void CPeerMessageQueue::Start(boost::thread_group& threadGroup, int nThreads, Handler handlerIn)
+{
+    assert(vLanes.empty());
+    handler = handlerIn;
+    for (int i = 0; i < nThreads; i++)
+        vLanes.push_back(boost::shared_ptr<Lane>(new Lane()));
+
+    BOOST_FOREACH (const boost::shared_ptr<Lane>& lane, vLanes) {
+        boost::function<void()> fn = boost::bind(&CPeerMessageQueue::Loop, this, lane);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msgworker", fn));
+    }
+}
+
+bool CPeerMessageQueue::Push(CNode* pnode, const std::string& strCommand, CDataStream& vRecv, int64_t nTime)
+{
+    if (vLanes.empty())
+        return false;
+
+    Lane& lane = *vLanes[pnode->GetId() % vLanes.size()];
+    {
+        boost::unique_lock<boost::mutex> lock(lane.mutex);
+        if (lane.queue.size() >= MAX_MSG_WORKER_QUEUE)
+            return false;
+
+        {
+            LOCK(cs_vNodes);
+            pnode->AddRef();
+        }
+        lane.queue.push_back(Item(pnode, strCommand, vRecv.nType, vRecv.nVersion, nTime));
+        lane.queue.back().vRecv.swap(vRecv);
+    }
+    lane.cond.notify_one();
+    return true;
+}
+
+size_t CPeerMessageQueue::Size() const
+{
+    size_t nSize = 0;
+    BOOST_FOREACH (const boost::shared_ptr<Lane>& lane, vLanes) {
+        boost::unique_lock<boost::mutex> lock(lane->mutex);
+        nSize += lane->queue.size();
+    }
+    return nSize;
+}
+
+void CPeerMessageQueue::Loop(boost::shared_ptr<Lane> lane)
+{
+    SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
+    while (true) {
+        boost::this_thread::interruption_point();
+
+        CNode* pnode;
+        std::string strCommand;
+        CDataStream vRecv(SER_NETWORK, PROTOCOL_VERSION);
+        int64_t nTime;
+        {
+            boost::unique_lock<boost::mutex> lock(lane->mutex);
+            while (lane->queue.empty())
+                lane->cond.wait(lock);
+
+            Item& item = lane->queue.front();
+            pnode = item.pnode;
+            strCommand.swap(item.strCommand);
+            vRecv.swap(item.vRecv);
+            nTime = item.nTime;
+            lane->queue.pop_front();
+        }
+
+        try {
+            if (!pnode->fDisconnect)
+                handler(pnode, strCommand, vRecv, nTime);
+        } catch (...) {
+            LOCK(cs_vNodes);
+            pnode->Release();
+            throw;
+        }
+
+        recvBufferPool.Release(vRecv);
+        {
+            LOCK(cs_vNodes);
+            pnode->Release();
+        }
+    }
+}
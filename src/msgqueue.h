@@ -0,0 +1,109 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef LIBERTY_MSGQUEUE_H
+#define LIBERTY_MSGQUEUE_H
+
+#include "streams.h"
+#include "sync.h"
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+class CNode;
+
+namespace boost
+{
+class thread_group;
+} // namespace boost
+
+/** Default number of worker threads for messages that don't need cs_main (0 = handle them on the message handler thread) */
+static const int DEFAULT_MSG_WORKER_THREADS = 0;
+/** Maximum number of message worker threads */
+static const int MAX_MSG_WORKER_THREADS = 16;
+/** Maximum number of messages waiting in one worker lane, reading from a peer whose lane is full is paused */
+static const unsigned int MAX_MSG_WORKER_QUEUE = 10000;
+
+/** Processing time statistics for one message command */
+class CMessageTimeStats
+{
+public:
+    //! Upper bounds (in microseconds) of the histogram buckets, the last bucket is open-ended
+    static const int NUM_BUCKETS = 7;
+    static const int64_t BUCKET_LIMITS[NUM_BUCKETS - 1];
+
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[NUM_BUCKETS];
+
+    CMessageTimeStats();
+
+    void Add(int64_t nMicros);
+    static std::string BucketName(int nBucket);
+};
+
+/** Record how long processing a message took */
+void RecordMessageTime(const std::string& strCommand, int64_t nMicros);
+/** Get a copy of the per-command processing time statistics */
+void GetMessageTimeStats(std::map<std::string, CMessageTimeStats>& mapStatsOut);
+
+/**
+ * Pool of worker threads for network messages that can be processed off the
+ * message handler thread.
+ *
+ * Every worker owns one lane (a FIFO queue) and a peer is always mapped to the
+ * same lane, so messages from one peer are handled in the order they arrived.
+ * A queued message holds a reference to its node until it has been processed.
+ */
+class CPeerMessageQueue
+{
+public:
+    typedef boost::function<void(CNode*, const std::string&, CDataStream&, int64_t)> Handler;
+
+    CPeerMessageQueue();
+
+    //! Start nThreads workers that call handler for every queued message
+    void Start(boost::thread_group& threadGroup, int nThreads, Handler handlerIn);
+
+    bool IsRunning() const { return !vLanes.empty(); }
+
+    //! Queue a message for pnode. On success the contents of vRecv are taken over, fails if pnode's lane is full.
+    bool Push(CNode* pnode, const std::string& strCommand, CDataStream& vRecv, int64_t nTime);
+
+    //! Number of messages waiting to be processed
+    size_t Size() const;
+
+private:
+    struct Item {
+        CNode* pnode;
+        std::string strCommand;
+        CDataStream vRecv;
+        int64_t nTime;
+
+        Item(CNode* pnodeIn, const std::string& strCommandIn, int nType, int nVersion, int64_t nTimeIn) : pnode(pnodeIn), strCommand(strCommandIn), vRecv(nType, nVersion), nTime(nTimeIn) {}
+    };
+
+    struct Lane {
+        mutable boost::mutex mutex;
+        boost::condition_variable cond;
+        std::deque<Item> queue;
+    };
+
+    std::vector<boost::shared_ptr<Lane> > vLanes;
+    Handler handler;
+
+    void Loop(boost::shared_ptr<Lane> lane);
+};
+
+extern CPeerMessageQueue messageQueue;
+
+#endif // LIBERTY_MSGQUEUE_H
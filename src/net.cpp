@@ -21,6 +21,8 @@
 #include "ui_interface.h"
 #include "wallet.h"
 
+#include <math.h>
+
 #ifdef WIN32
 #include <string.h>
 #else
@@ -93,6 +95,7 @@ map<CInv, CDataStream> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
+CRecvBufferPool recvBufferPool(MAX_POOLED_RECV_BYTES, MAX_POOLED_RECV_BUFFER_SIZE);
 
 static deque<string> vOneShots;
 CCriticalSection cs_vOneShots;
@@ -711,8 +714,10 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
     while (nBytes > 0) {
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
-            vRecvMsg.back().complete())
+            vRecvMsg.back().complete()) {
             vRecvMsg.push_back(CNetMessage(SER_NETWORK, nRecvVersion));
+            recvBufferPool.Acquire(vRecvMsg.back().vRecv);
+        }
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -746,19 +751,19 @@ bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
 int CNetMessage::readHeader(const char* pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
     try {
-        hdrbuf >> hdr;
+        CBufferReader(hdrbuf, hdrbuf + CMessageHeader::HEADER_SIZE, vRecv.GetType(), vRecv.GetVersion()) >> hdr;
     } catch (const std::exception&) {
         return -1;
     }
@@ -790,6 +795,49 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
 }
 
 
+CRecvBufferPool::CRecvBufferPool(size_t nMaxPooledBytesIn, size_t nMaxBufferSizeIn) : nPooledBytes(0), nMaxPooledBytes(nMaxPooledBytesIn), nMaxBufferSize(nMaxBufferSizeIn), nAllocated(0), nReused(0)
+{
+}
+
+void CRecvBufferPool::Acquire(CDataStream& stream)
+{
+    stream.clear();
+    LOCK(cs);
+    if (vFree.empty()) {
+        nAllocated++;
+        return;
+    }
+    nReused++;
+    nPooledBytes -= vFree.back().capacity();
+    stream.SwapBuffer(vFree.back());
+    vFree.pop_back();
+}
+
+void CRecvBufferPool::Release(CDataStream& stream)
+{
+    CSerializeData vch;
+    stream.SwapBuffer(vch);
+    if (vch.capacity() == 0 || vch.capacity() > nMaxBufferSize)
+        return;
+    vch.clear();
+
+    LOCK(cs);
+    if (nPooledBytes + vch.capacity() <= nMaxPooledBytes) {
+        nPooledBytes += vch.capacity();
+        vFree.push_back(CSerializeData());
+        vFree.back().swap(vch);
+    }
+}
+
+void CRecvBufferPool::GetStats(uint64_t& nAllocatedOut, uint64_t& nReusedOut, size_t& nPooledOut) const
+{
+    LOCK(cs);
+    nAllocatedOut = nAllocated;
+    nReusedOut = nReused;
+    nPooledOut = vFree.size();
+}
+
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
 {
@@ -955,8 +1003,9 @@ void ThreadSocketHandler()
                 }
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    if (lockRecv && !pnode->fPauseRecv &&
+                        (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                            pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
                         FD_SET(pnode->hSocket, &fdsetRecv);
                 }
             }
@@ -1514,7 +1563,8 @@ void ThreadMessageHandler()
                     if (!g_signals.ProcessMessages(pnode))
                         pnode->CloseSocketDisconnect();
 
-                    if (pnode->nSendSize < SendBufferSize()) {
+                    // A paused peer is retried after the usual wait, not in a busy loop
+                    if (pnode->nSendSize < SendBufferSize() && !pnode->fPauseRecv) {
                         if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete())) {
                             fSleep = false;
                         }
@@ -2036,6 +2086,11 @@ bool CAddrDB::Read(CAddrMan& addr)
     return true;
 }
 
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds)
+{
+    return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
+}
+
 unsigned int ReceiveFloodSize() { return 1000 * GetArg("-maxreceivebuffer", 5 * 1000); }
 unsigned int SendBufferSize() { return 1000 * GetArg("-maxsendbuffer", 1 * 1000); }
 
@@ -2061,6 +2116,7 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fPauseRecv = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2068,7 +2124,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
-    setInventoryKnown.max_size(SendBufferSize() / 1000);
+    nInventorySlot = knownInventory.AddPeer();
+    nNextInvSend = 0;
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
     nPingUsecStart = 0;
@@ -2100,6 +2157,8 @@ CNode::~CNode()
     if (pfilter)
         delete pfilter;
 
+    knownInventory.RemovePeer(nInventorySlot);
+
     GetNodeSignals().FinalizeNode(GetId());
 }
 
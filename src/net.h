@@ -10,6 +10,7 @@
 #include "bloom.h"
 #include "compat.h"
 #include "hash.h"
+#include "invknown.h"
 #include "limitedmap.h"
 #include "mruset.h"
 #include "netbase.h"
@@ -63,6 +64,11 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** Average delay between batched inventory announcements to a peer (in seconds) */
+static const int INVENTORY_BROADCAST_INTERVAL = 2;
+
+/** Return a timestamp in the future (in microseconds) for exponentially distributed events */
+int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
@@ -183,7 +189,7 @@ class CNetMessage
 public:
     bool in_data; // parsing header (false) or data (true)
 
-    CDataStream hdrbuf; // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr; // complete header
     unsigned int nHdrPos;
 
@@ -192,9 +198,8 @@ public:
 
     int64_t nTime; // time (in microseconds) of message receipt.
 
-    CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn)
+    CNetMessage(int nTypeIn, int nVersionIn) : vRecv(nTypeIn, nVersionIn)
     {
-        hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
@@ -210,7 +215,6 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
@@ -219,6 +223,43 @@ public:
 };
 
 
+/**
+ * Free list of message receive buffers.
+ *
+ * Buffers of processed messages are handed back here and reused for the next
+ * received message, so a flood of small messages doesn't allocate (and free)
+ * a new buffer for every one of them.
+ */
+class CRecvBufferPool
+{
+public:
+    CRecvBufferPool(size_t nMaxPooledBytesIn, size_t nMaxBufferSizeIn);
+
+    //! Give stream an empty buffer, reusing a pooled one when available
+    void Acquire(CDataStream& stream);
+    //! Take back the buffer of a stream that is no longer needed
+    void Release(CDataStream& stream);
+
+    void GetStats(uint64_t& nAllocatedOut, uint64_t& nReusedOut, size_t& nPooledOut) const;
+
+private:
+    mutable CCriticalSection cs;
+    std::vector<CSerializeData> vFree;
+    size_t nPooledBytes;
+    size_t nMaxPooledBytes;
+    size_t nMaxBufferSize;
+    uint64_t nAllocated;
+    uint64_t nReused;
+};
+
+/** Maximum total capacity of idle receive buffers kept for reuse */
+static const size_t MAX_POOLED_RECV_BYTES = 4 * 1024 * 1024;
+/** Receive buffers bigger than this are freed instead of pooled */
+static const size_t MAX_POOLED_RECV_BUFFER_SIZE = 256 * 1024;
+
+extern CRecvBufferPool recvBufferPool;
+
+
 typedef enum BanReason
 {
     BanReasonUnknown          = 0,
@@ -321,6 +362,8 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // The peer's message worker lane is full, nothing more is read from it until there is room again
+    bool fPauseRecv;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in their version message that we should not relay tx invs
@@ -366,9 +409,10 @@ public:
     std::set<uint256> setKnown;
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    int nInventorySlot; // slot in knownInventory, -1 if none
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
+    int64_t nNextInvSend;
     std::multimap<int64_t, CInv> mapAskFor;
     std::vector<uint256> vBlockRequested;
 
@@ -459,19 +503,22 @@ public:
     }
 
 
-    void AddInventoryKnown(const CInv& inv)
+    bool IsInventoryKnown(const CInv& inv) const
     {
-        {
-            LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
-        }
+        return knownInventory.IsKnown(nInventorySlot, inv);
+    }
+
+    // returns false if inv was already known
+    bool AddInventoryKnown(const CInv& inv)
+    {
+        return knownInventory.SetKnown(nInventorySlot, inv);
     }
 
     void PushInventory(const CInv& inv)
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!knownInventory.IsKnown(nInventorySlot, inv))
                 vInventoryToSend.push_back(inv);
         }
     }
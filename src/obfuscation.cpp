@@ -2293,6 +2293,10 @@ void ThreadCheckObfuScationPool()
         MilliSleep(1000);
         //LogPrintf("ThreadCheckObfuScationPool::check timeout\n");
 
+        // wait for the masternode caches, they are read in the background with -deferstartup
+        if (!IsStartupTaskDone(STARTUP_TASK_MASTERNODE_CACHES))
+            continue;
+
         // try to sync from all available nodes, one step at a time
         masternodeSync.Process();
 
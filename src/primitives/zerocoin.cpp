@@ -56,6 +56,16 @@ std::vector<CZerocoinSpend> CZerocoinSpendReceipt::GetSpends()
     return vSpends;
 }
 
+void CZerocoinSpendReceipt::AddTiming(const std::string& strPhase, int64_t nTimeMicros)
+{
+    vTimings.emplace_back(strPhase, nTimeMicros);
+}
+
+std::vector<std::pair<std::string, int64_t> > CZerocoinSpendReceipt::GetTimings()
+{
+    return vTimings;
+}
+
 void CZerocoinSpendReceipt::SetStatus(std::string strStatus, int nStatus, int nNeededSpends)
 {
     strStatusMessage = strStatus;
@@ -239,10 +239,14 @@ private:
     int nStatus;
     int nNeededSpends;
     std::vector<CZerocoinSpend> vSpends;
+    //! time taken by each phase of creating the spend, in microseconds
+    std::vector<std::pair<std::string, int64_t> > vTimings;
 
 public:
     void AddSpend(const CZerocoinSpend& spend);
     std::vector<CZerocoinSpend> GetSpends();
+    void AddTiming(const std::string& strPhase, int64_t nTimeMicros);
+    std::vector<std::pair<std::string, int64_t> > GetTimings();
     void SetStatus(std::string strStatus, int nStatus, int nNeededSpends = 0);
     std::string GetStatusMessage();
     int GetStatus();
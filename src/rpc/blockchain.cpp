@@ -6,6 +6,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "base58.h"
+#include "blockcache.h"
 #include "checkpoints.h"
 #include "clientversion.h"
 #include "main.h"
@@ -122,7 +123,7 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
 
     UniValue xlibzObj(UniValue::VOBJ);
     for (auto denom : libzerocoin::zerocoinDenomList) {
-        xlibzObj.push_back(Pair(to_string(denom), ValueFromAmount(blockindex->mapZerocoinSupply.at(denom) * (denom*COIN))));
+        xlibzObj.push_back(Pair(to_string(denom), ValueFromAmount(blockindex->GetZerocoinSupply(denom) * (denom*COIN))));
     }
     xlibzObj.push_back(Pair("total", ValueFromAmount(blockindex->GetZerocoinSupply())));
     result.push_back(Pair("XLIBzsupply", xlibzObj));
@@ -362,7 +363,7 @@ UniValue getblock(const UniValue& params, bool fHelp)
     CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
-    if (!ReadBlockFromDisk(block, pblockindex))
+    if (!ReadBlockFromDiskCached(block, pblockindex))
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
     if (!fVerbose) {
@@ -443,7 +444,10 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
             "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
-            "  \"total_amount\": x.xxx          (numeric) The total amount\n"
+            "  \"total_amount\": x.xxx,         (numeric) The total amount\n"
+            "  \"cache_entries\": n,     (numeric) The number of transactions in the in-memory coins cache\n"
+            "  \"cache_usage\": n,       (numeric) The memory used by the coins cache in bytes\n"
+            "  \"cache_max_usage\": n,   (numeric) The memory the coins cache may use before it is trimmed (-dbcache)\n"
             "}\n"
 
             "\nExamples:\n" +
@@ -464,6 +468,9 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
         ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
+    ret.push_back(Pair("cache_entries", (int64_t)pcoinsTip->GetCacheSize()));
+    ret.push_back(Pair("cache_usage", (int64_t)pcoinsTip->DynamicMemoryUsage()));
+    ret.push_back(Pair("cache_max_usage", (int64_t)nCoinCacheUsage));
     return ret;
 }
 
@@ -548,6 +555,40 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue getblockcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockcacheinfo\n"
+            "\nReturns statistics about the cache of decoded blocks.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx,      (numeric) The number of blocks in the cache\n"
+            "  \"size\": xxxxx,         (numeric) The serialized size of the cached blocks\n"
+            "  \"max_size\": xxxxx,     (numeric) The size the cache is bounded to (-blockcachesize)\n"
+            "  \"hits\": xxxxx,         (numeric) The number of reads served from the cache\n"
+            "  \"misses\": xxxxx,       (numeric) The number of reads that went to disk\n"
+            "  \"hit_rate\": x.xxx      (numeric) The share of reads served from the cache\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getblockcacheinfo", "") + HelpExampleRpc("getblockcacheinfo", ""));
+
+    size_t nEntries, nSize, nMaxSize;
+    uint64_t nHits, nMisses;
+    blockCache.GetStats(nEntries, nSize, nMaxSize, nHits, nMisses);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (uint64_t)nEntries));
+    ret.push_back(Pair("size", (uint64_t)nSize));
+    ret.push_back(Pair("max_size", (uint64_t)nMaxSize));
+    ret.push_back(Pair("hits", nHits));
+    ret.push_back(Pair("misses", nMisses));
+    ret.push_back(Pair("hit_rate", nHits + nMisses > 0 ? (double)nHits / (nHits + nMisses) : 0.0));
+    return ret;
+}
+
 UniValue verifychain(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -564,8 +605,7 @@ UniValue verifychain(const UniValue& params, bool fHelp)
             "\nExamples:\n" +
             HelpExampleCli("verifychain", "") + HelpExampleRpc("verifychain", ""));
 
-    LOCK(cs_main);
-
+    // VerifyDB locks cs_main itself, its worker threads need it as well
     int nCheckLevel = 4;
     int nCheckDepth = GetArg("-checkblocks", 288);
     if (params.size() > 0)
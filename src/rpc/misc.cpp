@@ -124,7 +124,7 @@ UniValue getinfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("moneysupply",ValueFromAmount(chainActive.Tip()->nMoneySupply)));
     UniValue xlibzObj(UniValue::VOBJ);
     for (auto denom : libzerocoin::zerocoinDenomList) {
-        xlibzObj.push_back(Pair(to_string(denom), ValueFromAmount(chainActive.Tip()->mapZerocoinSupply.at(denom) * (denom*COIN))));
+        xlibzObj.push_back(Pair(to_string(denom), ValueFromAmount(chainActive.Tip()->GetZerocoinSupply(denom) * (denom*COIN))));
     }
     xlibzObj.push_back(Pair("total", ValueFromAmount(chainActive.Tip()->GetZerocoinSupply())));
     obj.push_back(Pair("XLIBzsupply", xlibzObj));
@@ -149,6 +149,52 @@ UniValue getinfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getstartupinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getstartupinfo\n"
+            "\nReturns the state of the startup tasks that may still be running in the background (see -deferstartup).\n"
+            "Wallet commands fail with error code -28 until the rescan task is done.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"ready\": true|false,          (boolean) if all startup tasks have finished\n"
+            "  \"tasks\": {\n"
+            "    \"name\": {                   (string) the task, rescan or masternodecaches\n"
+            "      \"deferred\": true|false,   (boolean) if it runs in the background\n"
+            "      \"done\": true|false,       (boolean) if it has finished\n"
+            "      \"time\": n                 (numeric) the time it took in milliseconds, once done\n"
+            "    },\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getstartupinfo", "") + HelpExampleRpc("getstartupinfo", ""));
+
+    bool fReady = true;
+    UniValue tasks(UniValue::VOBJ);
+    for (int i = 0; i < STARTUP_TASK_COUNT; i++) {
+        std::string strName;
+        bool fDeferred, fDone;
+        int64_t nTime;
+        GetStartupTaskStatus((StartupTask)i, strName, fDeferred, fDone, nTime);
+        UniValue task(UniValue::VOBJ);
+        task.push_back(Pair("deferred", fDeferred));
+        task.push_back(Pair("done", fDone));
+        if (fDone)
+            task.push_back(Pair("time", nTime));
+        tasks.push_back(Pair(strName, task));
+        fReady = fReady && fDone;
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("ready", fReady));
+    obj.push_back(Pair("tasks", tasks));
+    return obj;
+}
+
 UniValue mnsync(const UniValue& params, bool fHelp)
 {
     std::string strMode;
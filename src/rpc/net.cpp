@@ -6,8 +6,10 @@
 
 #include "rpc/server.h"
 
+#include "blockencodings.h"
 #include "clientversion.h"
 #include "main.h"
+#include "msgqueue.h"
 #include "net.h"
 #include "netbase.h"
 #include "protocol.h"
@@ -367,6 +369,104 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     return obj;
 }
 
+UniValue getmessagestats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getmessagestats\n"
+            "\nReturns processing time statistics for each received P2P message command.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"queued\": n,              (numeric) Messages waiting in the message worker lanes\n"
+            "  \"commands\": {\n"
+            "    \"command\": {            (object) Statistics for one message command\n"
+            "      \"count\": n,           (numeric) Number of processed messages\n"
+            "      \"totaltime\": n,       (numeric) Total processing time in microseconds\n"
+            "      \"avgtime\": n,         (numeric) Average processing time in microseconds\n"
+            "      \"maxtime\": n,         (numeric) Longest processing time in microseconds\n"
+            "      \"histogram\": {        (object) Number of messages per processing time bucket\n"
+            "        \"<10us\": n,\n"
+            "        ...\n"
+            "      }\n"
+            "    },\n"
+            "    ...\n"
+            "  }\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getmessagestats", "") + HelpExampleRpc("getmessagestats", ""));
+
+    std::map<std::string, CMessageTimeStats> mapStats;
+    GetMessageTimeStats(mapStats);
+
+    UniValue commands(UniValue::VOBJ);
+    for (std::map<std::string, CMessageTimeStats>::const_iterator it = mapStats.begin(); it != mapStats.end(); ++it) {
+        const CMessageTimeStats& stats = it->second;
+        UniValue histogram(UniValue::VOBJ);
+        for (int i = 0; i < CMessageTimeStats::NUM_BUCKETS; i++)
+            histogram.push_back(Pair(CMessageTimeStats::BucketName(i), stats.vBuckets[i]));
+
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("count", stats.nCount));
+        entry.push_back(Pair("totaltime", stats.nTotalMicros));
+        entry.push_back(Pair("avgtime", stats.nCount ? stats.nTotalMicros / (int64_t)stats.nCount : 0));
+        entry.push_back(Pair("maxtime", stats.nMaxMicros));
+        entry.push_back(Pair("histogram", histogram));
+        commands.push_back(Pair(SanitizeString(it->first), entry));
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("queued", (uint64_t)messageQueue.Size()));
+    obj.push_back(Pair("commands", commands));
+    return obj;
+}
+
+UniValue getcompactblockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw runtime_error(
+            "getcompactblockstats\n"
+            "\nReturns statistics about compact block relay since startup.\n"
+
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,      (boolean) Whether compact blocks are requested from peers (-compactblocks)\n"
+            "  \"sent\": n,                  (numeric) Compact blocks sent to peers\n"
+            "  \"received\": n,              (numeric) Compact blocks received from peers\n"
+            "  \"reconstructed\": n,         (numeric) Blocks rebuilt from the mempool without a round-trip\n"
+            "  \"roundtrips\": n,            (numeric) Blocks that needed a getblocktxn round-trip\n"
+            "  \"failed\": n,                (numeric) Blocks that had to be downloaded in full\n"
+            "  \"reconstructionrate\": x.xxx, (numeric) Fraction of received compact blocks rebuilt without a round-trip\n"
+            "  \"txprefilled\": n,           (numeric) Transactions sent along with the compact blocks\n"
+            "  \"txfrommempool\": n,         (numeric) Transactions found in the mempool\n"
+            "  \"txrequested\": n,           (numeric) Transactions requested with getblocktxn\n"
+            "  \"bytesreceived\": n,         (numeric) Bytes received for the rebuilt blocks\n"
+            "  \"bytessaved\": n             (numeric) Bytes saved compared to downloading those blocks in full\n"
+            "}\n"
+
+            "\nExamples:\n" +
+            HelpExampleCli("getcompactblockstats", "") + HelpExampleRpc("getcompactblockstats", ""));
+
+    CCompactBlockStats stats;
+    GetCompactBlockStats(stats);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("enabled", fCompactBlocks));
+    obj.push_back(Pair("sent", stats.nSent));
+    obj.push_back(Pair("received", stats.nReceived));
+    obj.push_back(Pair("reconstructed", stats.nReconstructed));
+    obj.push_back(Pair("roundtrips", stats.nRoundTrips));
+    obj.push_back(Pair("failed", stats.nFailed));
+    obj.push_back(Pair("reconstructionrate", stats.nReceived ? (double)stats.nReconstructed / stats.nReceived : 0.0));
+    obj.push_back(Pair("txprefilled", stats.nTxPrefilled));
+    obj.push_back(Pair("txfrommempool", stats.nTxFromMempool));
+    obj.push_back(Pair("txrequested", stats.nTxRequested));
+    obj.push_back(Pair("bytesreceived", stats.nBytesReceived));
+    obj.push_back(Pair("bytessaved", stats.nBytesFullBlocks > stats.nBytesReceived ? (int64_t)(stats.nBytesFullBlocks - stats.nBytesReceived) : (int64_t)0));
+    return obj;
+}
+
 static UniValue GetNetworksInfo()
 {
     UniValue networks(UniValue::VARR);
@@ -1308,6 +1308,32 @@ void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDe
     }
 }
 
+// Number of entries ListTransactions adds for wtx, without building them
+static int CountListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDepth, const isminefilter& filter)
+{
+    CAmount nFee;
+    string strSentAccount;
+    list<COutputEntry> listReceived;
+    list<COutputEntry> listSent;
+
+    wtx.GetAmounts(listReceived, listSent, nFee, strSentAccount, filter);
+
+    bool fAllAccounts = (strAccount == string("*"));
+    int nEntries = 0;
+    if ((!listSent.empty() || nFee != 0) && (fAllAccounts || strAccount == strSentAccount))
+        nEntries += listSent.size();
+    if (listReceived.size() > 0 && wtx.GetDepthInMainChain() >= nMinDepth) {
+        if (fAllAccounts)
+            return nEntries + listReceived.size();
+        BOOST_FOREACH (const COutputEntry& r, listReceived) {
+            map<CTxDestination, CAddressBookData>::const_iterator mi = pwalletMain->mapAddressBook.find(r.destination);
+            if ((mi != pwalletMain->mapAddressBook.end() ? mi->second.name : string()) == strAccount)
+                nEntries++;
+        }
+    }
+    return nEntries;
+}
+
 void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, UniValue& ret)
 {
     bool fAllAccounts = (strAccount == string("*"));
@@ -1409,18 +1435,31 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
     const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
 
-    // iterate backwards until we have nCount items to return:
+    // iterate backwards until we have nCount items to return. Whole transactions that
+    // fall before the page are only counted, from their cached output summaries.
     for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
         CWalletTx* const pwtx = (*it).second.first;
+        CAccountingEntry* const pacentry = (*it).second.second;
+        if (nFrom > 0 && ret.empty()) {
+            int nEntries = 0;
+            if (pwtx != 0)
+                nEntries += CountListTransactions(*pwtx, strAccount, 0, filter);
+            if (pacentry != 0 && (strAccount == "*" || pacentry->strAccount == strAccount))
+                nEntries++;
+            if (nEntries <= nFrom) {
+                nFrom -= nEntries;
+                continue;
+            }
+        }
+
         if (pwtx != 0)
             ListTransactions(*pwtx, strAccount, 0, true, ret, filter);
-        CAccountingEntry* const pacentry = (*it).second.second;
         if (pacentry != 0)
             AcentryToJSON(*pacentry, strAccount, ret);
 
         if ((int)ret.size() >= (nCount + nFrom)) break;
     }
-    // ret is newest to oldest
+    // ret is newest to oldest, starting nFrom entries before the page
 
     if (nFrom > (int)ret.size())
         nFrom = ret.size();
@@ -1593,11 +1632,14 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
     UniValue transactions(UniValue::VARR);
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++) {
-        CWalletTx tx = (*it).second;
-
-        if (depth == -1 || tx.GetDepthInMainChain(false) < depth)
-            ListTransactions(tx, "*", 0, true, transactions, filter);
+    if (pindex) {
+        BOOST_FOREACH (const CWalletTx* pwtx, pwalletMain->GetTransactionsSince(pindex->nHeight)) {
+            if (pwtx->GetDepthInMainChain(false) < depth)
+                ListTransactions(*pwtx, "*", 0, true, transactions, filter);
+        }
+    } else {
+        for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+            ListTransactions((*it).second, "*", 0, true, transactions, filter);
     }
 
     CBlockIndex* pblockLast = chainActive[chainActive.Height() + 1 - target_confirms];
@@ -2860,7 +2902,14 @@ UniValue spendzerocoin(const UniValue& params, bool fHelp)
             "      \"address\": \"xxx\"         (string) XLIB address or \"zerocoinmint\" for reminted change.\n"
             "    }\n"
             "    ,...\n"
-            "  ]\n"
+            "  ],\n"
+            "  \"timings\": {               (object) Time taken by each phase of the spend.\n"
+            "    \"select_millis\": nnn,     (numeric) Selecting and checking the mints.\n"
+            "    \"witness_millis\": nnn,    (numeric) Generating the accumulator witnesses.\n"
+            "    \"proof_millis\": nnn,      (numeric) Building the zero knowledge proofs of the inputs.\n"
+            "    \"finalize_millis\": nnn,   (numeric) Putting the transaction together.\n"
+            "    \"commit_millis\": nnn      (numeric) Committing the transaction to the wallet and network.\n"
+            "  }\n"
             "}\n"
 
             "\nExamples\n" +
@@ -2917,7 +2966,14 @@ UniValue spendzerocoinmints(const UniValue& params, bool fHelp)
             "      \"address\": \"xxx\"         (string) XLIB address or \"zerocoinmint\" for reminted change.\n"
             "    }\n"
             "    ,...\n"
-            "  ]\n"
+            "  ],\n"
+            "  \"timings\": {               (object) Time taken by each phase of the spend.\n"
+            "    \"select_millis\": nnn,     (numeric) Selecting and checking the mints.\n"
+            "    \"witness_millis\": nnn,    (numeric) Generating the accumulator witnesses.\n"
+            "    \"proof_millis\": nnn,      (numeric) Building the zero knowledge proofs of the inputs.\n"
+            "    \"finalize_millis\": nnn,   (numeric) Putting the transaction together.\n"
+            "    \"commit_millis\": nnn      (numeric) Committing the transaction to the wallet and network.\n"
+            "  }\n"
             "}\n"
 
             "\nExamples\n" +
@@ -3026,6 +3082,11 @@ extern UniValue DoXLibzSpend(const CAmount nAmount, bool fMintChange, bool fMini
     ret.push_back(Pair("spends", arrSpends));
     ret.push_back(Pair("outputs", vout));
 
+    UniValue timings(UniValue::VOBJ);
+    for (const std::pair<std::string, int64_t>& timing : receipt.GetTimings())
+        timings.push_back(Pair(timing.first + "_millis", timing.second / 1000));
+    ret.push_back(Pair("timings", timings));
+
     return ret;
 }
 
@@ -3454,7 +3515,7 @@ UniValue setxlibzseed(const UniValue& params, bool fHelp)
     CXlibzWallet* zwallet = pwalletMain->getZWallet();
     bool fSuccess = zwallet->SetMasterSeed(seed, true);
     if (fSuccess)
-        zwallet->SyncWithChain();
+        zwallet->SyncWithChain(true, true);
 
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("success", fSuccess));
@@ -3557,36 +3618,6 @@ UniValue dxlibzstate(const UniValue& params, bool fHelp) {
 }
 
 
-void static SearchThread(CXlibzWallet* zwallet, int nCountStart, int nCountEnd)
-{
-    LogPrintf("%s: start=%d end=%d\n", __func__, nCountStart, nCountEnd);
-    CWalletDB walletDB(pwalletMain->strWalletFile);
-    try {
-        uint256 seedMaster = zwallet->GetMasterSeed();
-        uint256 hashSeed = Hash(seedMaster.begin(), seedMaster.end());
-        for(int i = nCountStart; i < nCountEnd; i++) {
-            boost::this_thread::interruption_point();
-            CDataStream ss(SER_GETHASH, 0);
-            ss << seedMaster << i;
-            uint512 zerocoinSeed = Hash512(ss.begin(), ss.end());
-
-            CBigNum bnValue;
-            CBigNum bnSerial;
-            CBigNum bnRandomness;
-            CKey key;
-            zwallet->SeedToZXLIB(zerocoinSeed, bnValue, bnSerial, bnRandomness, key);
-
-            uint256 hashPubcoin = GetPubCoinHash(bnValue);
-            zwallet->AddToMintPool(make_pair(hashPubcoin, i), true);
-            walletDB.WriteMintPoolPair(hashSeed, hashPubcoin, i);
-        }
-    } catch (std::exception& e) {
-        LogPrintf("SearchThread() exception");
-    } catch (...) {
-        LogPrintf("SearchThread() exception");
-    }
-}
-
 UniValue searchdxlibz(const UniValue& params, bool fHelp)
 {
     if(fHelp || params.size() != 3)
@@ -3614,21 +3645,13 @@ UniValue searchdxlibz(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Range has to be at least 1");
 
     int nThreads = params[2].get_int();
+    if (nThreads < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Threads has to be at least 1");
 
     CXlibzWallet* zwallet = pwalletMain->zwalletMain;
 
-    boost::thread_group* dxlibzThreads = new boost::thread_group();
-    int nRangePerThread = nRange / nThreads;
-
-    int nPrevThreadEnd = nCount - 1;
-    for (int i = 0; i < nThreads; i++) {
-        int nStart = nPrevThreadEnd + 1;;
-        int nEnd = nStart + nRangePerThread;
-        nPrevThreadEnd = nEnd;
-        dxlibzThreads->create_thread(boost::bind(&SearchThread, zwallet, nStart, nEnd));
-    }
-
-    dxlibzThreads->join_all();
+    // Counts already in the mint pool are skipped, the rest are derived on nThreads threads
+    zwallet->GenerateMintPool(nCount, nRange, nThreads);
 
     zwallet->RemoveMintsFromPool(pwalletMain->xlibzTracker->GetSerialHashes());
     zwallet->SyncWithChain(false);
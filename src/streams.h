@@ -106,6 +106,21 @@ public:
         return (std::string(begin(), end()));
     }
 
+    void swap(CDataStream& other)
+    {
+        vch.swap(other.vch);
+        std::swap(nReadPos, other.nReadPos);
+        std::swap(nType, other.nType);
+        std::swap(nVersion, other.nVersion);
+    }
+
+    //! Exchange the underlying buffer with vchOther and rewind, used to recycle allocations
+    void SwapBuffer(CSerializeData& vchOther)
+    {
+        vch.swap(vchOther);
+        nReadPos = 0;
+    }
+
 
     //
     // Vector subset
@@ -291,6 +306,45 @@ public:
 };
 
 
+/** Minimal stream that deserializes directly from a caller-owned buffer.
+ *
+ * Nothing is copied or allocated; the buffer must outlive the reader.
+ */
+class CBufferReader
+{
+private:
+    const char* pbegin;
+    const char* pend;
+    int nType;
+    int nVersion;
+
+public:
+    CBufferReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) : pbegin(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    size_t size() const { return pend - pbegin; }
+    bool empty() const { return pbegin == pend; }
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+
+    CBufferReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CBufferReader::read() : end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+        return (*this);
+    }
+
+    template <typename T>
+    CBufferReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+
 /** Non-refcounted RAII wrapper for FILE*
  *
  * Will automatically close the file when it goes out of scope if not null.
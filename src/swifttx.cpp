@@ -51,6 +51,9 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
         pfrom->AddInventoryKnown(inv);
         GetMainSignals().Inventory(inv.hash);
 
+        // The SwiftX maps are also read by the block checks, on the block connect thread when blocks are pipelined
+        LOCK(cs_main);
+
         if (mapTxLockReq.count(tx.GetHash()) || mapTxLockReqRejected.count(tx.GetHash())) {
             return;
         }
@@ -73,12 +76,7 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
         bool fMissingInputs = false;
         CValidationState state;
 
-        bool fAccepted = false;
-        {
-            LOCK(cs_main);
-            fAccepted = AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs);
-        }
-        if (fAccepted) {
+        if (AcceptToMemoryPool(mempool, state, tx, true, &fMissingInputs)) {
             RelayInv(inv);
 
             DoConsensusVote(tx, nBlockHeight);
@@ -135,6 +133,8 @@ void ProcessMessageSwiftTX(CNode* pfrom, std::string& strCommand, CDataStream& v
         CInv inv(MSG_TXLOCK_VOTE, ctx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        LOCK(cs_main);
+
         if (mapTxLockVote.count(ctx.GetHash())) {
             return;
         }
@@ -431,6 +431,7 @@ int64_t GetAverageVoteTime()
 
 void CleanTransactionLocksList()
 {
+    LOCK(cs_main);
     if (chainActive.Tip() == NULL) return;
 
     std::map<uint256, CTransactionLock>::iterator it = mapTxLocks.begin();
@@ -0,0 +1,148 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Benchmark of block reads per second through fopen and through the block file mappings
+//
+
+#include "blockfilemap.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "utiltime.h"
+
+#include <iostream>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+static const int BENCH_BLOCKS = 2000;
+static const int BENCH_BLOCK_TXS = 40;
+static const int BENCH_THREADS = 4;
+//! Far past the files the test setup writes to
+static const int BENCH_FILE = 9999;
+
+static CBlock MakeBlock()
+{
+    CBlock block;
+    block.nVersion = 3;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = 1500000000;
+    for (int i = 0; i < BENCH_BLOCK_TXS; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1 + insecure_rand() % 3);
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            tx.vin[j].prevout = COutPoint(GetRandHash(), insecure_rand() % 4);
+            tx.vin[j].scriptSig.assign(107, 0x51);
+        }
+        tx.vout.resize(1 + insecure_rand() % 3);
+        for (unsigned int j = 0; j < tx.vout.size(); j++) {
+            tx.vout[j].nValue = insecure_rand();
+            tx.vout[j].scriptPubKey.assign(25, 0x76);
+        }
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+// Store the blocks the way WriteBlockToDisk does, after the network magic and their size
+static void WriteBlocks(vector<CDiskBlockPos>& vPos)
+{
+    CAutoFile fileout(OpenBlockFile(CDiskBlockPos(BENCH_FILE, 0)), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!fileout.IsNull());
+    unsigned int nPos = 0;
+    for (int i = 0; i < BENCH_BLOCKS; i++) {
+        CBlock block = MakeBlock();
+        unsigned int nSize = fileout.GetSerializeSize(block);
+        fileout << FLATDATA(Params().MessageStart()) << nSize;
+        nPos += MESSAGE_START_SIZE + sizeof(nSize);
+        vPos.push_back(CDiskBlockPos(BENCH_FILE, nPos));
+        fileout << block;
+        nPos += nSize;
+    }
+}
+
+static bool ReadBlockFile(const CDiskBlockPos& pos)
+{
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return false;
+    CBlock block;
+    filein >> block;
+    return block.vtx.size() == (size_t)BENCH_BLOCK_TXS;
+}
+
+static bool ReadBlockMapped(CMappedBlockFiles& files, const CDiskBlockPos& pos)
+{
+    CMappedBlockReader reader(SER_DISK, CLIENT_VERSION);
+    if (!files.Open(pos, reader))
+        return false;
+    CBlock block;
+    reader >> block;
+    return block.vtx.size() == (size_t)BENCH_BLOCK_TXS;
+}
+
+static void ReadBlocks(const vector<CDiskBlockPos>& vPos, CMappedBlockFiles* pfiles, int nThread, int nThreads, int* pnFailed)
+{
+    for (unsigned int i = nThread; i < vPos.size(); i += nThreads) {
+        if (!(pfiles ? ReadBlockMapped(*pfiles, vPos[i]) : ReadBlockFile(vPos[i])))
+            (*pnFailed)++;
+    }
+}
+
+static void Run(const vector<CDiskBlockPos>& vPos, CMappedBlockFiles* pfiles, int nThreads, const char* pszName)
+{
+    vector<int> vFailed(nThreads, 0);
+    int64_t nTimeStart = GetTimeMicros();
+    if (nThreads == 1) {
+        ReadBlocks(vPos, pfiles, 0, 1, &vFailed[0]);
+    } else {
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&ReadBlocks, boost::cref(vPos), pfiles, i, nThreads, &vFailed[i]));
+        threads.join_all();
+    }
+    int64_t nTime = std::max((int64_t)1, GetTimeMicros() - nTimeStart);
+    for (int i = 0; i < nThreads; i++)
+        BOOST_CHECK_EQUAL(vFailed[i], 0);
+
+    cout << "Block reads, " << pszName << ": " << vPos.size() << " blocks in " << nTime / 1000 << " ms, "
+         << (int64_t)vPos.size() * 1000000 / nTime << " reads/s" << endl;
+}
+
+BOOST_AUTO_TEST_SUITE(benchmark_blockfiles)
+
+BOOST_AUTO_TEST_CASE(benchmark_block_reads)
+{
+    vector<CDiskBlockPos> vPos;
+    WriteBlocks(vPos);
+
+    vector<CDiskBlockPos> vPosRandom(vPos);
+    for (unsigned int i = vPosRandom.size() - 1; i > 0; i--)
+        std::swap(vPosRandom[i], vPosRandom[insecure_rand() % (i + 1)]);
+
+    Run(vPos, NULL, 1, "fopen, in file order");
+    Run(vPosRandom, NULL, 1, "fopen, random order");
+    Run(vPosRandom, NULL, BENCH_THREADS, "fopen, random order, 4 threads");
+
+    if (MAX_MAPPED_BLOCK_FILES > 0) {
+        CMappedBlockFiles files;
+        Run(vPos, &files, 1, "mapped, in file order");
+        Run(vPosRandom, &files, 1, "mapped, random order");
+        Run(vPos, &files, BENCH_THREADS, "mapped, in file order, 4 threads");
+        Run(vPosRandom, &files, BENCH_THREADS, "mapped, random order, 4 threads");
+        files.Clear();
+    }
+
+    boost::filesystem::remove(GetBlockPosFilename(CDiskBlockPos(BENCH_FILE, 0), "blk"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
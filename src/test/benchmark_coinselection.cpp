@@ -0,0 +1,119 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Benchmark for coin selection on synthetic wallets with many unspent outputs
+//
+
+#include "coinselection.h"
+#include "random.h"
+#include "utiltime.h"
+#include "wallet.h"
+
+#include <iostream>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static const int BENCH_SELECTIONS = 20;
+
+static CWallet benchWallet;
+
+// Coins from 0.001 to 512 coins, spread over the orders of magnitude like the
+// change and payments of a busy wallet
+static void MakeCoins(int nCoins, vector<COutput>& vCoins)
+{
+    for (int i = 0; i < nCoins; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = i; // so all transactions get different hashes
+        tx.vout.resize(1);
+        tx.vout[0].nValue = (CAmount)(1 + insecure_rand() % 1000) * (CENT / 10) * (1 << (insecure_rand() % 10));
+        CWalletTx* wtx = new CWalletTx(&benchWallet, tx);
+        vCoins.push_back(COutput(wtx, 0, 6 * 24, true));
+    }
+}
+
+static void FreeCoins(vector<COutput>& vCoins)
+{
+    BOOST_FOREACH (COutput& output, vCoins)
+        delete output.tx;
+    vCoins.clear();
+}
+
+static void RunSelection(int nCoins)
+{
+    vector<COutput> vCoins;
+    MakeCoins(nCoins, vCoins);
+
+    vector<CAmount> vValue;
+    BOOST_FOREACH (const COutput& output, vCoins)
+        vValue.push_back(output.tx->vout[0].nValue);
+    sort(vValue.rbegin(), vValue.rend());
+    CAmount nTotal = 0;
+    BOOST_FOREACH (CAmount n, vValue)
+        nTotal += n;
+
+    // Targets the size of a few typical coins, some of which can be paid exactly
+    vector<CAmount> vTargets;
+    for (int i = 0; i < BENCH_SELECTIONS; i++) {
+        if (i % 2)
+            vTargets.push_back(vValue[insecure_rand() % vValue.size()] + vValue[insecure_rand() % vValue.size()]);
+        else
+            vTargets.push_back((CAmount)(1 + insecure_rand() % 5000) * CENT);
+    }
+
+    int64_t nTimeStart = GetTimeMicros();
+    int nSelected = 0;
+    {
+        LOCK(benchWallet.cs_wallet);
+        BOOST_FOREACH (CAmount nTarget, vTargets) {
+            set<pair<const CWalletTx*, unsigned int> > setCoins;
+            CAmount nValueRet;
+            BOOST_CHECK(benchWallet.SelectCoinsMinConf(nTarget, 1, 6, vCoins, setCoins, nValueRet));
+            BOOST_CHECK(nValueRet >= nTarget);
+            nSelected += setCoins.size();
+        }
+    }
+    int64_t nSelectTime = GetTimeMicros() - nTimeStart;
+
+    nTimeStart = GetTimeMicros();
+    int nFound = 0;
+    BOOST_FOREACH (CAmount nTarget, vTargets) {
+        vector<char> vfBest;
+        CAmount nBest;
+        if (SelectCoinsBnB(vValue, nTarget, 5459, vfBest, nBest)) {
+            BOOST_CHECK(nBest >= nTarget && nBest <= nTarget + 5459);
+            nFound++;
+        }
+    }
+    int64_t nBnBTime = GetTimeMicros() - nTimeStart;
+
+    nTimeStart = GetTimeMicros();
+    BOOST_FOREACH (CAmount nTarget, vTargets) {
+        vector<char> vfBest;
+        CAmount nBest;
+        ApproximateBestSubset(vValue, nTotal, nTarget, vfBest, nBest);
+        BOOST_CHECK(nBest >= nTarget);
+    }
+    int64_t nKnapsackTime = GetTimeMicros() - nTimeStart;
+
+    cout << nCoins << " coins, " << BENCH_SELECTIONS << " selections: SelectCoinsMinConf " << nSelectTime / 1000 << " ms ("
+         << nSelected << " inputs), branch and bound " << nBnBTime / 1000 << " ms (" << nFound << " without change), knapsack "
+         << nKnapsackTime / 1000 << " ms" << endl;
+
+    FreeCoins(vCoins);
+}
+
+BOOST_AUTO_TEST_SUITE(benchmark_coinselection)
+
+BOOST_AUTO_TEST_CASE(benchmark_coinselection_wallet_sizes)
+{
+    RunSelection(1000);
+    RunSelection(10000);
+    RunSelection(100000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,160 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Benchmark comparing the LevelDB profiles on block index and zerocoin like records
+//
+
+#include "chain.h"
+#include "leveldbwrapper.h"
+#include "random.h"
+#include "uint256.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static const int BENCH_RECORDS = 50000;
+static const int BENCH_LOOKUPS = 200000;
+static const size_t BENCH_CACHE = 4 << 20;
+
+// Size of the table files, leaving out the log and the manifest
+static uint64_t GetTablesSize(const boost::filesystem::path& path)
+{
+    uint64_t nSize = 0;
+    for (boost::filesystem::directory_iterator it(path); it != boost::filesystem::directory_iterator(); it++) {
+        std::string strExtension = it->path().extension().string();
+        if (strExtension == ".ldb" || strExtension == ".sst")
+            nSize += boost::filesystem::file_size(it->path());
+    }
+    return nSize;
+}
+
+static CDiskBlockIndex MakeBlockIndex(int nHeight, const uint256& hashPrev)
+{
+    CBlockIndex index;
+    index.nHeight = nHeight;
+    index.nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+    index.nTx = 1 + nHeight % 7;
+    index.nFile = nHeight / 1000;
+    index.nDataPos = (nHeight % 1000) * 500;
+    index.nUndoPos = (nHeight % 1000) * 100;
+    index.nVersion = 3;
+    index.hashMerkleRoot = GetRandHash();
+    index.nTime = 1500000000 + nHeight * 60;
+    index.nBits = 0x1e0ffff0;
+    CDiskBlockIndex diskindex(&index);
+    diskindex.hashPrev = hashPrev;
+    return diskindex;
+}
+
+// Write and compact the records, the way a long running node has them, and
+// reopen the database to start reading with an empty cache
+template <typename V>
+static CLevelDBWrapper* Fill(const boost::filesystem::path& path, const CLevelDBProfile& profile, const vector<pair<uint256, V> >& vRecords, int64_t& nWriteTime)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    {
+        CLevelDBWrapper db(path, BENCH_CACHE, false, true, profile);
+        CLevelDBBatch batch;
+        for (unsigned int i = 0; i < vRecords.size(); i++) {
+            batch.Write(make_pair('b', vRecords[i].first), vRecords[i].second);
+            if (i % 1000 == 999) {
+                db.WriteBatch(batch);
+                batch = CLevelDBBatch();
+            }
+        }
+        db.WriteBatch(batch, true);
+        db.CompactFull();
+    }
+    nWriteTime = GetTimeMicros() - nTimeStart;
+    return new CLevelDBWrapper(path, BENCH_CACHE, false, false, profile);
+}
+
+static void RunBlockIndex(const vector<pair<uint256, CDiskBlockIndex> >& vRecords, const CLevelDBProfile& profile, const char* pszName)
+{
+    boost::filesystem::path path = GetDataDir() / "bench_blockindex";
+    int64_t nWriteTime;
+    boost::scoped_ptr<CLevelDBWrapper> db(Fill(path, profile, vRecords, nWriteTime));
+
+    // Scan everything, like LoadBlockIndexGuts
+    int64_t nTimeStart = GetTimeMicros();
+    int nFound = 0;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db->NewIterator());
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+        CDataStream ssValue(pcursor->value().data(), pcursor->value().data() + pcursor->value().size(), SER_DISK, CLIENT_VERSION);
+        CDiskBlockIndex diskindex;
+        ssValue >> diskindex;
+        nFound++;
+    }
+    BOOST_CHECK(pcursor->status().ok());
+    BOOST_CHECK_EQUAL(nFound, (int)vRecords.size());
+    int64_t nScanTime = GetTimeMicros() - nTimeStart;
+
+    cout << "Block index, " << pszName << ": write and compact " << nWriteTime / 1000 << " ms, scan " << nScanTime / 1000
+         << " ms, " << GetTablesSize(path) / 1024 << " KiB of tables" << endl;
+}
+
+static void RunZerocoin(const vector<pair<uint256, uint256> >& vRecords, const CLevelDBProfile& profile, const char* pszName)
+{
+    boost::filesystem::path path = GetDataDir() / "bench_zerocoin";
+    int64_t nWriteTime;
+    boost::scoped_ptr<CLevelDBWrapper> db(Fill(path, profile, vRecords, nWriteTime));
+
+    // Random lookups, half of them of serials that were never spent
+    int64_t nTimeStart = GetTimeMicros();
+    int nFound = 0;
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        uint256 txHash;
+        if (i % 2) {
+            const pair<uint256, uint256>& record = vRecords[insecure_rand() % vRecords.size()];
+            BOOST_CHECK(db->Read(make_pair('b', record.first), txHash) && txHash == record.second);
+            nFound++;
+        } else {
+            BOOST_CHECK(!db->Read(make_pair('b', GetRandHash()), txHash));
+        }
+    }
+    int64_t nReadTime = GetTimeMicros() - nTimeStart;
+    BOOST_CHECK_EQUAL(nFound, BENCH_LOOKUPS / 2);
+
+    cout << "Zerocoin, " << pszName << ": write and compact " << nWriteTime / 1000 << " ms, " << BENCH_LOOKUPS << " lookups "
+         << nReadTime / 1000 << " ms, " << GetTablesSize(path) / 1024 << " KiB of tables" << endl;
+}
+
+BOOST_AUTO_TEST_SUITE(benchmark_leveldb)
+
+BOOST_AUTO_TEST_CASE(benchmark_leveldb_profiles)
+{
+    vector<pair<uint256, CDiskBlockIndex> > vBlockIndex;
+    uint256 hashPrev;
+    for (int i = 0; i < BENCH_RECORDS; i++) {
+        uint256 hash = GetRandHash();
+        vBlockIndex.push_back(make_pair(hash, MakeBlockIndex(i, hashPrev)));
+        hashPrev = hash;
+    }
+
+    CLevelDBProfile profile = GetLevelDBProfile(LEVELDB_PROFILE_BLOCKINDEX);
+    RunBlockIndex(vBlockIndex, GetLevelDBProfile(LEVELDB_PROFILE_DEFAULT), "default profile");
+    RunBlockIndex(vBlockIndex, profile, "block index profile");
+    profile.fCompression = false;
+    RunBlockIndex(vBlockIndex, profile, "block index profile without compression");
+
+    vector<pair<uint256, uint256> > vZerocoin;
+    for (int i = 0; i < BENCH_RECORDS; i++)
+        vZerocoin.push_back(make_pair(GetRandHash(), GetRandHash()));
+
+    profile = GetLevelDBProfile(LEVELDB_PROFILE_ZEROCOIN);
+    RunZerocoin(vZerocoin, GetLevelDBProfile(LEVELDB_PROFILE_DEFAULT), "default profile");
+    RunZerocoin(vZerocoin, profile, "zerocoin profile");
+    profile.fVerifyChecksums = false;
+    RunZerocoin(vZerocoin, profile, "zerocoin profile without checksums on reads");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,117 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Benchmark for the message receive path under a flood of small messages
+//
+
+#include "chainparams.h"
+#include "hash.h"
+#include "net.h"
+#include "protocol.h"
+#include "random.h"
+#include "streams.h"
+#include "utiltime.h"
+#include "version.h"
+
+#include <fstream>
+#include <iostream>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+using namespace std;
+
+static const int FLOOD_MESSAGES = 100000;
+// Same size as the receive buffer in ThreadSocketHandler
+static const unsigned int RECV_CHUNK_SIZE = 0x10000;
+
+// Resident set size in KiB, or 0 where it can't be determined
+static long GetResidentKiB()
+{
+#ifdef WIN32
+    return 0;
+#else
+    std::ifstream statm("/proc/self/statm");
+    long nPages = 0, nResident = 0;
+    if (!(statm >> nPages >> nResident))
+        return 0;
+    return nResident * (sysconf(_SC_PAGESIZE) / 1024);
+#endif
+}
+
+static void AppendMessage(CDataStream& ssFlood, const char* pszCommand, const vector<CInv>& vInv)
+{
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload << vInv;
+
+    CMessageHeader hdr(pszCommand, ssPayload.size());
+    uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+
+    ssFlood << hdr;
+    ssFlood += ssPayload;
+}
+
+// Feed the flood to a node in socket sized chunks and consume the complete
+// messages after every chunk, the way the socket and message handler threads do
+static void RunFlood(const CDataStream& ssFlood, bool fRecycle, const char* pszName)
+{
+    CAddress addr(CService("10.0.0.1", Params().GetP2PPort()));
+    CNode node(INVALID_SOCKET, addr, "", true);
+
+    uint64_t nAllocatedBefore, nReusedBefore, nAllocatedAfter, nReusedAfter;
+    size_t nPooled;
+    recvBufferPool.GetStats(nAllocatedBefore, nReusedBefore, nPooled);
+    long nResidentBefore = GetResidentKiB();
+    int64_t nTimeStart = GetTimeMicros();
+
+    int nMessages = 0;
+    size_t nPos = 0;
+    while (nPos < ssFlood.size()) {
+        unsigned int nBytes = std::min((size_t)RECV_CHUNK_SIZE, ssFlood.size() - nPos);
+        LOCK(node.cs_vRecvMsg);
+        BOOST_CHECK(node.ReceiveMsgBytes(&ssFlood[nPos], nBytes));
+        nPos += nBytes;
+
+        while (!node.vRecvMsg.empty() && node.vRecvMsg.front().complete()) {
+            CNetMessage& msg = node.vRecvMsg.front();
+            vector<CInv> vInv;
+            msg.vRecv >> vInv;
+            BOOST_CHECK_EQUAL(vInv.size(), 1U);
+            if (fRecycle)
+                recvBufferPool.Release(msg.vRecv);
+            node.vRecvMsg.pop_front();
+            nMessages++;
+        }
+    }
+
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    recvBufferPool.GetStats(nAllocatedAfter, nReusedAfter, nPooled);
+    BOOST_CHECK_EQUAL(nMessages, FLOOD_MESSAGES);
+
+    cout << pszName << ": " << nMessages << " messages in " << nTime / 1000 << " ms, "
+         << (double)(nAllocatedAfter - nAllocatedBefore) / nMessages << " buffer allocations per message, "
+         << nReusedAfter - nReusedBefore << " buffers reused, RSS "
+         << nResidentBefore << " -> " << GetResidentKiB() << " KiB" << endl;
+
+    if (fRecycle)
+        BOOST_CHECK(nAllocatedAfter - nAllocatedBefore < (uint64_t)FLOOD_MESSAGES / 10);
+}
+
+BOOST_AUTO_TEST_SUITE(benchmark_netmessage)
+
+BOOST_AUTO_TEST_CASE(benchmark_recv_flood)
+{
+    CDataStream ssFlood(SER_NETWORK, PROTOCOL_VERSION);
+    for (int i = 0; i < FLOOD_MESSAGES; i++)
+        AppendMessage(ssFlood, "inv", vector<CInv>(1, CInv(MSG_TX, GetRandHash())));
+
+    RunFlood(ssFlood, false, "Receive flood without buffer reuse");
+    RunFlood(ssFlood, true, "Receive flood with buffer reuse");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
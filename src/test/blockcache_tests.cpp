@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "clientversion.h"
+#include "serialize.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockcache_tests)
+
+static boost::shared_ptr<const CBlock> MakeBlock(int n)
+{
+    boost::shared_ptr<CBlock> pblock(new CBlock());
+    pblock->nVersion = 1;
+    pblock->nNonce = n;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = n;
+    pblock->vtx.push_back(tx);
+    return pblock;
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_lru)
+{
+    std::vector<boost::shared_ptr<const CBlock> > vBlocks;
+    for (int i = 0; i < 10; i++)
+        vBlocks.push_back(MakeBlock(i));
+    size_t nBlockSize = ::GetSerializeSize(*vBlocks[0], SER_NETWORK, CLIENT_VERSION);
+
+    CBlockCache cache(nBlockSize * 3);
+    for (int i = 0; i < 3; i++)
+        cache.Insert(vBlocks[i]);
+    BOOST_CHECK(cache.Get(vBlocks[0]->GetHash()) == vBlocks[0]);
+
+    // Block 1 is now the least recently used and makes room for block 3
+    cache.Insert(vBlocks[3]);
+    BOOST_CHECK(!cache.Get(vBlocks[1]->GetHash()));
+    BOOST_CHECK(cache.Get(vBlocks[0]->GetHash()));
+    BOOST_CHECK(cache.Get(vBlocks[2]->GetHash()));
+    BOOST_CHECK(cache.Get(vBlocks[3]->GetHash()));
+
+    size_t nEntries, nSize, nMaxSize;
+    uint64_t nHits, nMisses;
+    cache.GetStats(nEntries, nSize, nMaxSize, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntries, 3U);
+    BOOST_CHECK_EQUAL(nSize, nBlockSize * 3);
+    BOOST_CHECK_EQUAL(nHits, 4U);
+    BOOST_CHECK_EQUAL(nMisses, 1U);
+
+    // Shrinking drops the least recently used blocks first
+    cache.SetMaxSize(nBlockSize);
+    BOOST_CHECK(cache.Get(vBlocks[3]->GetHash()));
+    BOOST_CHECK(!cache.Get(vBlocks[2]->GetHash()));
+
+    // Blocks that don't fit at all aren't cached
+    cache.SetMaxSize(nBlockSize - 1);
+    cache.Insert(vBlocks[4]);
+    BOOST_CHECK(!cache.Get(vBlocks[4]->GetHash()));
+
+    cache.Clear();
+    cache.GetStats(nEntries, nSize, nMaxSize, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntries, 0U);
+    BOOST_CHECK_EQUAL(nSize, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+static CBlock BuildBlock()
+{
+    CBlock block;
+    block.nBits = 0x207fffff;
+    block.nTime = 1530000000;
+
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(txCoinbase);
+
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vin[0].scriptSig = CScript() << OP_11;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = 1000;
+        block.vtx.push_back(tx);
+    }
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+static CBlockHeaderAndShortTxIDs RoundTrip(const CBlock& block)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << CBlockHeaderAndShortTxIDs(block);
+
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    ss >> cmpctblock;
+    BOOST_CHECK(ss.empty());
+    return cmpctblock;
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_reconstruction)
+{
+    CBlock block = BuildBlock();
+    CTxMemPool pool(CFeeRate(0));
+    pool.addUnchecked(block.vtx[1].GetHash(), CTxMemPoolEntry(block.vtx[1], 0, 0, 0.0, 1));
+    pool.addUnchecked(block.vtx[3].GetHash(), CTxMemPoolEntry(block.vtx[3], 0, 0, 0.0, 1));
+
+    CBlockHeaderAndShortTxIDs cmpctblock = RoundTrip(block);
+    BOOST_CHECK_EQUAL(cmpctblock.prefilledtxn.size(), 1U);
+    BOOST_CHECK_EQUAL(cmpctblock.shorttxids.size(), 3U);
+    BOOST_CHECK(cmpctblock.header.GetHash() == block.GetHash());
+
+    // The transaction that isn't in the mempool has to be requested
+    PartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctblock, pool), READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+    BOOST_CHECK(partialBlock.IsTxAvailable(1));
+    BOOST_CHECK(!partialBlock.IsTxAvailable(2));
+    BOOST_CHECK(partialBlock.IsTxAvailable(3));
+    BOOST_CHECK_EQUAL(partialBlock.nPrefilled, 1);
+    BOOST_CHECK_EQUAL(partialBlock.nFromMempool, 2);
+
+    std::vector<uint16_t> vMissing;
+    partialBlock.GetMissing(vMissing);
+    BOOST_CHECK_EQUAL(vMissing.size(), 1U);
+    BOOST_CHECK_EQUAL(vMissing[0], 2);
+
+    CBlock blockOut;
+    BOOST_CHECK_EQUAL(partialBlock.FillBlock(blockOut, std::vector<CTransaction>(1, block.vtx[2])), READ_STATUS_OK);
+    BOOST_CHECK(blockOut.GetHash() == block.GetHash());
+    BOOST_CHECK(blockOut.hashMerkleRoot == blockOut.BuildMerkleTree());
+
+    // Wrong number of transactions is a protocol violation
+    PartiallyDownloadedBlock partialBlock2;
+    BOOST_CHECK_EQUAL(partialBlock2.InitData(cmpctblock, pool), READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialBlock2.FillBlock(blockOut, std::vector<CTransaction>()), READ_STATUS_INVALID);
+
+    // The wrong transaction shows up as a merkle root mismatch
+    PartiallyDownloadedBlock partialBlock3;
+    BOOST_CHECK_EQUAL(partialBlock3.InitData(cmpctblock, pool), READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(partialBlock3.FillBlock(blockOut, std::vector<CTransaction>(1, block.vtx[1])), READ_STATUS_FAILED);
+
+    // With everything in the mempool no round-trip is needed
+    pool.addUnchecked(block.vtx[2].GetHash(), CTxMemPoolEntry(block.vtx[2], 0, 0, 0.0, 1));
+    PartiallyDownloadedBlock partialBlock4;
+    BOOST_CHECK_EQUAL(partialBlock4.InitData(cmpctblock, pool), READ_STATUS_OK);
+    partialBlock4.GetMissing(vMissing);
+    BOOST_CHECK(vMissing.empty());
+    BOOST_CHECK_EQUAL(partialBlock4.FillBlock(blockOut, std::vector<CTransaction>()), READ_STATUS_OK);
+    BOOST_CHECK(blockOut.GetHash() == block.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_invalid)
+{
+    CBlock block = BuildBlock();
+    CTxMemPool pool(CFeeRate(0));
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+
+    // Prefilled index out of range
+    CBlockHeaderAndShortTxIDs cmpctBad = cmpctblock;
+    cmpctBad.prefilledtxn[0].index = 4;
+    PartiallyDownloadedBlock partialBlock;
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctBad, pool), READ_STATUS_INVALID);
+
+    // Duplicate short ids can't be resolved from the mempool
+    cmpctBad = cmpctblock;
+    cmpctBad.shorttxids[1] = cmpctBad.shorttxids[0];
+    BOOST_CHECK_EQUAL(partialBlock.InitData(cmpctBad, pool), READ_STATUS_FAILED);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "clientversion.h"
+#include "streams.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+using namespace libzerocoin;
+
+BOOST_AUTO_TEST_SUITE(blockindex_tests)
+
+BOOST_AUTO_TEST_CASE(zerocoin_fields_serialization)
+{
+    CBlockIndex index;
+    index.nVersion = 4;
+    index.SetZerocoinSupply(ZQ_ONE, 12);
+    index.SetZerocoinSupply(ZQ_FIFTY, 3);
+    index.AddZerocoinSupply(ZQ_FIVE_THOUSAND, 7);
+    index.AddZerocoinSupply(ZQ_FIVE_THOUSAND, -2);
+    index.AddMint(ZQ_TEN);
+    index.AddMint(ZQ_TEN);
+    index.AddMint(ZQ_ONE_HUNDRED);
+
+    BOOST_CHECK_EQUAL(index.GetZerocoinSupply(ZQ_FIVE_THOUSAND), 5);
+    BOOST_CHECK_EQUAL(index.GetZerocoinSupply(), (12 + 3 * 50 + 5 * 5000) * COIN);
+    BOOST_CHECK_EQUAL(index.GetMintCount(ZQ_TEN), 2);
+    BOOST_CHECK(index.MintedDenomination(ZQ_ONE_HUNDRED));
+    BOOST_CHECK(!index.MintedDenomination(ZQ_ONE));
+    BOOST_CHECK_THROW(index.GetZerocoinSupply(ZQ_ERROR), std::out_of_range);
+
+    // The arrays are stored as the map and vector the block index database has always used
+    std::map<CoinDenomination, int64_t> mapSupply;
+    for (auto denom : zerocoinDenomList)
+        mapSupply[denom] = index.GetZerocoinSupply(denom);
+    std::vector<CoinDenomination> vMints;
+    vMints.push_back(ZQ_TEN);
+    vMints.push_back(ZQ_TEN);
+    vMints.push_back(ZQ_ONE_HUNDRED);
+
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION);
+    ssLegacy << mapSupply << vMints;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << REF(CZerocoinSupplyRef(index.nZerocoinSupply)) << REF(CZerocoinMintsRef(index.nMintDenominationsInBlock));
+    BOOST_CHECK(ss.str() == ssLegacy.str());
+    BOOST_CHECK_EQUAL(::GetSerializeSize(REF(CZerocoinSupplyRef(index.nZerocoinSupply)), SER_DISK, CLIENT_VERSION), ::GetSerializeSize(mapSupply, SER_DISK, CLIENT_VERSION));
+    BOOST_CHECK_EQUAL(::GetSerializeSize(REF(CZerocoinMintsRef(index.nMintDenominationsInBlock)), SER_DISK, CLIENT_VERSION), ::GetSerializeSize(vMints, SER_DISK, CLIENT_VERSION));
+
+    // Mints in any order are read back as counts
+    vMints.clear();
+    vMints.push_back(ZQ_ONE_HUNDRED);
+    vMints.push_back(ZQ_FIVE);
+    vMints.push_back(ZQ_ONE_HUNDRED);
+    CDataStream ssOld(SER_DISK, CLIENT_VERSION);
+    ssOld << mapSupply << vMints;
+    CBlockIndex indexRead;
+    ssOld >> REF(CZerocoinSupplyRef(indexRead.nZerocoinSupply)) >> REF(CZerocoinMintsRef(indexRead.nMintDenominationsInBlock));
+    BOOST_CHECK(ssOld.empty());
+    for (auto denom : zerocoinDenomList)
+        BOOST_CHECK_EQUAL(indexRead.GetZerocoinSupply(denom), index.GetZerocoinSupply(denom));
+    BOOST_CHECK_EQUAL(indexRead.GetMintCount(ZQ_ONE_HUNDRED), 2);
+    BOOST_CHECK_EQUAL(indexRead.GetMintCount(ZQ_FIVE), 1);
+    BOOST_CHECK_EQUAL(indexRead.GetMintCount(ZQ_TEN), 0);
+
+    // Full round trip through the database format
+    CDataStream ssDisk(SER_DISK, CLIENT_VERSION);
+    ssDisk << CDiskBlockIndex(&index);
+    CDiskBlockIndex diskindex;
+    ssDisk >> diskindex;
+    BOOST_CHECK(memcmp(diskindex.nZerocoinSupply, index.nZerocoinSupply, sizeof(index.nZerocoinSupply)) == 0);
+    BOOST_CHECK(memcmp(diskindex.nMintDenominationsInBlock, index.nMintDenominationsInBlock, sizeof(index.nMintDenominationsInBlock)) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(blockindex_arena)
+{
+    CBlockIndexArena arena;
+    BOOST_CHECK_EQUAL(arena.Size(), 0U);
+
+    std::vector<CBlockIndex*> vIndex;
+    for (int i = 0; i < 10000; i++) {
+        CBlockIndex* pindex = arena.Allocate();
+        BOOST_CHECK_EQUAL(pindex->nHeight, 0);
+        BOOST_CHECK_EQUAL(pindex->GetZerocoinSupply(ZQ_ONE), 0);
+        pindex->nHeight = i;
+        pindex->pprev = vIndex.empty() ? NULL : vIndex.back();
+        vIndex.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(arena.Size(), 10000U);
+    BOOST_CHECK(arena.DynamicMemoryUsage() >= 10000 * sizeof(CBlockIndex));
+
+    // Entries stay where they were allocated
+    for (int i = 0; i < 10000; i++) {
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, i);
+        if (i > 0)
+            BOOST_CHECK(vIndex[i]->pprev == vIndex[i - 1]);
+    }
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.Size(), 0U);
+    BOOST_CHECK_EQUAL(arena.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,7 +3,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "memusage.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
@@ -58,6 +60,126 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+
+    bool IsCached(const uint256& txid) const { return cacheCoins.count(txid) > 0; }
+
+    bool IsDirty(const uint256& txid) const
+    {
+        CCoinsMap::const_iterator it = cacheCoins.find(txid);
+        return it != cacheCoins.end() && (it->second.flags & CCoinsCacheEntry::DIRTY);
+    }
+};
+
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest(bool fMemory = true, bool fWipe = false) : CCoinsViewDB(1 << 20, fMemory, fWipe) {}
+
+    //! Store coins the way older versions did, one record per transaction
+    void WriteLegacyCoins(const uint256& txid, const CCoins& coins)
+    {
+        BOOST_CHECK(db.Write(std::make_pair('c', txid), coins));
+        fLegacyCoins = true;
+    }
+
+    void WriteVersion(int nVersionIn) { BOOST_CHECK(db.Write('V', nVersionIn)); }
+
+    bool HaveLegacyRecord(const uint256& txid) const { return db.Exists(std::make_pair('c', txid)); }
+    bool HaveOutputRecord(const uint256& txid, unsigned int n) const { return db.Exists(std::make_pair('C', COutPoint(txid, n))); }
+};
+
+CCoins RandomCoins(unsigned int nOutputs)
+{
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = insecure_rand() % 1000000;
+    coins.fCoinStake = insecure_rand() % 2 == 0;
+    coins.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        coins.vout[i].nValue = 1 + insecure_rand() % 100000000;
+        coins.vout[i].scriptPubKey.assign(1 + insecure_rand() % 40, 0);
+    }
+    return coins;
+}
+
+/**
+ * Coin database whose writes wait until they are let through, so the state of a
+ * write in progress can be looked at, and that can be made to fail its writes.
+ */
+class CCoinsViewDBGated : public CCoinsViewDBTest
+{
+private:
+    CWaitableCriticalSection csGate;
+    CConditionVariable condGate;
+    bool fOpen;
+    bool fFail;
+
+public:
+    //! block index entry that has to be written before the coins, checked when they are
+    CBlockTreeDB* pblocktreeCheck;
+    uint256 hashIndexCheck;
+    bool fIndexWrittenFirst;
+
+    CCoinsViewDBGated() : fOpen(false), fFail(false), pblocktreeCheck(NULL), fIndexWrittenFirst(false) {}
+
+    void Open(bool fFailIn = false)
+    {
+        WaitableLock lock(csGate);
+        fOpen = true;
+        fFail = fFailIn;
+        condGate.notify_all();
+    }
+
+    bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock)
+    {
+        {
+            WaitableLock lock(csGate);
+            while (!fOpen)
+                condGate.wait(lock);
+            if (fFail)
+                return false;
+        }
+        if (pblocktreeCheck)
+            fIndexWrittenFirst = pblocktreeCheck->Exists(std::make_pair('b', hashIndexCheck));
+        return CCoinsViewDB::WriteCoins(mapCoins, hashBlock);
+    }
+};
+
+void WriteCoinsEntry(CCoinsView& view, const uint256& txid, const CCoins& coins, bool fFresh, const uint256& hashBlock)
+{
+    CCoinsMap mapCoins;
+    CCoinsCacheEntry& entry = mapCoins[txid];
+    entry.coins = coins;
+    entry.flags = CCoinsCacheEntry::DIRTY | (fFresh ? CCoinsCacheEntry::FRESH : 0);
+    BOOST_CHECK(view.BatchWrite(mapCoins, hashBlock));
+    BOOST_CHECK(mapCoins.empty());
+}
+
+CDiskBlockIndex RandomDiskBlockIndex()
+{
+    CBlockIndex index;
+    index.nHeight = insecure_rand() % 1000000;
+    index.nVersion = 3;
+    index.hashMerkleRoot = GetRandHash();
+    CDiskBlockIndex diskindex(&index);
+    diskindex.hashPrev = GetRandHash();
+    return diskindex;
+}
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -83,14 +205,16 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool synced_a_cache = false;
+    bool trimmed_a_cache = false;
 
     // A simple map to track what we expect the cache stack to represent.
     std::map<uint256, CCoins> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -135,6 +259,21 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            BOOST_FOREACH (const CCoinsViewCacheTest* test, stack) {
+                test->SelfTest();
+            }
+        }
+
+        if (insecure_rand() % 100 == 50) {
+            // Every 100 iterations, write the tip to its parent but keep it cached,
+            // and sometimes also shrink it.
+            stack.back()->Sync();
+            synced_a_cache = true;
+            if (insecure_rand() % 2) {
+                stack.back()->Trim(stack.back()->DynamicMemoryUsage() / 2);
+                trimmed_a_cache = true;
+            }
+            stack.back()->SelfTest();
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +290,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -173,6 +312,313 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(synced_a_cache);
+    BOOST_CHECK(trimmed_a_cache);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_sync_trim)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), memusage::DynamicUsage(CCoinsMap()));
+
+    std::vector<uint256> txids;
+    for (int i = 0; i < 100; i++) {
+        txids.push_back(GetRandHash());
+        CCoinsModifier coins = cache.ModifyCoins(txids.back());
+        coins->vout.resize(1 + i % 3);
+        coins->vout[0].nValue = 1000 + i;
+        coins->vout[0].scriptPubKey = CScript() << std::vector<unsigned char>(20 * (1 + i % 5), i);
+    }
+    cache.SelfTest();
+    size_t nUsage = cache.DynamicMemoryUsage();
+
+    // Unwritten entries can't be trimmed
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nUsage);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 100U);
+
+    // Writing keeps everything cached and readable
+    BOOST_CHECK(cache.Sync());
+    cache.SelfTest();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 100U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nUsage);
+    for (int i = 0; i < 100; i++) {
+        BOOST_CHECK(!cache.IsDirty(txids[i]));
+        CCoins coins;
+        BOOST_CHECK(base.GetCoins(txids[i], coins));
+        BOOST_CHECK_EQUAL(coins.vout[0].nValue, 1000 + i);
+    }
+
+    // Spent entries are dropped once written
+    cache.ModifyCoins(txids[0])->Clear();
+    BOOST_CHECK(cache.IsDirty(txids[0]));
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK(!cache.IsCached(txids[0]));
+    cache.SelfTest();
+
+    // Trimming to nothing drops all written entries
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    cache.SelfTest();
+
+    // Entries used again since they were loaded are dropped last
+    for (int i = 1; i < 100; i++)
+        BOOST_CHECK(cache.AccessCoins(txids[i]));
+    for (int i = 90; i < 100; i++)
+        BOOST_CHECK(cache.AccessCoins(txids[i]));
+    cache.Trim(cache.DynamicMemoryUsage() + 1);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 99U);
+    cache.Trim(cache.DynamicMemoryUsage() / 2);
+    cache.SelfTest();
+    for (int i = 90; i < 100; i++)
+        BOOST_CHECK(cache.IsCached(txids[i]));
+    BOOST_CHECK(cache.GetCacheSize() < 99U);
+}
+
+
+// Outputs are stored under their own keys: spending one only touches its record,
+// and what BatchWrite stored reads back as the same coins.
+BOOST_AUTO_TEST_CASE(coins_db_per_output)
+{
+    CCoinsViewDBTest view;
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    CCoins coins = RandomCoins(4);
+
+    WriteCoinsEntry(view, txid, coins, true, hashBlock);
+    BOOST_CHECK(view.GetBestBlock() == hashBlock);
+    BOOST_CHECK(view.HaveCoins(txid));
+    for (unsigned int i = 0; i < 4; i++)
+        BOOST_CHECK(view.HaveOutputRecord(txid, i));
+    BOOST_CHECK(!view.HaveLegacyRecord(txid));
+    CCoins coinsRead;
+    BOOST_CHECK(view.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+
+    // Spend one output in the middle and the last one
+    coins.Spend(1);
+    coins.Spend(3);
+    WriteCoinsEntry(view, txid, coins, false, hashBlock);
+    BOOST_CHECK(view.HaveOutputRecord(txid, 0));
+    BOOST_CHECK(!view.HaveOutputRecord(txid, 1));
+    BOOST_CHECK(view.HaveOutputRecord(txid, 2));
+    BOOST_CHECK(!view.HaveOutputRecord(txid, 3));
+    BOOST_CHECK(view.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+
+    // Once everything is spent nothing is left of the transaction
+    coins.Spend(0);
+    coins.Spend(2);
+    BOOST_CHECK(coins.IsPruned());
+    WriteCoinsEntry(view, txid, coins, false, hashBlock);
+    BOOST_CHECK(!view.HaveOutputRecord(txid, 0));
+    BOOST_CHECK(!view.HaveOutputRecord(txid, 2));
+    BOOST_CHECK(!view.HaveCoins(txid));
+    BOOST_CHECK(!view.GetCoins(txid, coinsRead));
+
+    // A txid sharing no outputs with the others is never mixed up with them
+    uint256 txidOther = GetRandHash();
+    CCoins coinsOther = RandomCoins(2);
+    WriteCoinsEntry(view, txidOther, coinsOther, true, hashBlock);
+    BOOST_CHECK(!view.HaveCoins(txid));
+    BOOST_CHECK(view.GetCoins(txidOther, coinsRead));
+    BOOST_CHECK(coinsRead == coinsOther);
+}
+
+// Databases in the per-transaction layout are read as they are, written to in
+// the per-output layout and moved over completely by Upgrade.
+BOOST_AUTO_TEST_CASE(coins_db_upgrade)
+{
+    CCoinsViewDBTest view;
+    std::vector<uint256> txids;
+    std::vector<CCoins> vCoins;
+    for (int i = 0; i < 50; i++) {
+        txids.push_back(GetRandHash());
+        vCoins.push_back(RandomCoins(1 + insecure_rand() % 5));
+        view.WriteLegacyCoins(txids.back(), vCoins.back());
+    }
+    BOOST_CHECK(view.NeedsUpgrade());
+
+    CCoins coinsRead;
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        BOOST_CHECK(view.HaveCoins(txids[i]));
+        BOOST_CHECK(view.GetCoins(txids[i], coinsRead));
+        BOOST_CHECK(coinsRead == vCoins[i]);
+    }
+
+    // Writing to a transaction in the old layout moves it to the new one
+    vCoins[0].Spend(0);
+    WriteCoinsEntry(view, txids[0], vCoins[0], false, GetRandHash());
+    BOOST_CHECK(!view.HaveLegacyRecord(txids[0]));
+    BOOST_CHECK(!view.HaveOutputRecord(txids[0], 0));
+    if (!vCoins[0].IsPruned()) {
+        BOOST_CHECK(view.GetCoins(txids[0], coinsRead));
+        BOOST_CHECK(coinsRead == vCoins[0]);
+    } else {
+        BOOST_CHECK(!view.HaveCoins(txids[0]));
+    }
+
+    view.Upgrade();
+    BOOST_CHECK(!view.NeedsUpgrade());
+    for (unsigned int i = 1; i < txids.size(); i++) {
+        BOOST_CHECK(!view.HaveLegacyRecord(txids[i]));
+        for (unsigned int n = 0; n < vCoins[i].vout.size(); n++)
+            BOOST_CHECK(view.HaveOutputRecord(txids[i], n));
+        BOOST_CHECK(view.GetCoins(txids[i], coinsRead));
+        BOOST_CHECK(coinsRead == vCoins[i]);
+    }
+}
+
+// Lookups reuse their iterators, but never one from before the last write
+BOOST_AUTO_TEST_CASE(coins_db_cursor_reuse)
+{
+    CCoinsViewDBTest view;
+    uint256 txid = GetRandHash();
+    CCoins coins = RandomCoins(3);
+    CCoins coinsRead;
+    BOOST_CHECK(!view.HaveCoins(txid));
+    BOOST_CHECK(!view.GetCoins(txid, coinsRead));
+
+    WriteCoinsEntry(view, txid, coins, true, GetRandHash());
+    BOOST_CHECK(view.HaveCoins(txid));
+    BOOST_CHECK(view.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+
+    coins.Spend(1);
+    WriteCoinsEntry(view, txid, coins, false, GetRandHash());
+    BOOST_CHECK(view.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+
+    coins.Spend(0);
+    coins.Spend(2);
+    WriteCoinsEntry(view, txid, coins, false, GetRandHash());
+    BOOST_CHECK(!view.HaveCoins(txid));
+    BOOST_CHECK(!view.GetCoins(txid, coinsRead));
+}
+
+// The format version is recorded, and a database from a newer version is not written to
+BOOST_AUTO_TEST_CASE(coins_db_version)
+{
+    uint256 hashBlock = GetRandHash();
+    {
+        CCoinsViewDBTest view(false, true);
+        BOOST_CHECK_EQUAL(view.GetVersion(), COINS_DB_VERSION);
+        BOOST_CHECK(view.IsVersionSupported());
+        WriteCoinsEntry(view, GetRandHash(), RandomCoins(1), true, hashBlock);
+        view.WriteVersion(COINS_DB_VERSION + 1);
+    }
+    {
+        CCoinsViewDBTest view(false);
+        BOOST_CHECK_EQUAL(view.GetVersion(), COINS_DB_VERSION + 1);
+        BOOST_CHECK(!view.IsVersionSupported());
+        CCoinsMap mapCoins;
+        BOOST_CHECK(!view.BatchWrite(mapCoins, GetRandHash()));
+        BOOST_CHECK(view.GetBestBlock() == hashBlock);
+    }
+    {
+        // Rebuilding starts over in the current format
+        CCoinsViewDBTest view(false, true);
+        BOOST_CHECK_EQUAL(view.GetVersion(), COINS_DB_VERSION);
+    }
+}
+
+// What was handed to the background writer is served until it is written, block
+// index entries go to disk ahead of the coins, and the best block with them.
+BOOST_AUTO_TEST_CASE(coins_writer_ordering)
+{
+    CCoinsViewDBGated db;
+    CBlockTreeDB blocktree(1 << 20, true);
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    CCoins coins = RandomCoins(3);
+    CDiskBlockIndex diskindex = RandomDiskBlockIndex();
+    db.pblocktreeCheck = &blocktree;
+    db.hashIndexCheck = diskindex.GetBlockHash();
+    {
+        CCoinsViewBackgroundWriter writer(&db, &blocktree);
+        BOOST_CHECK_EQUAL(writer.GetWritesQueued(), 0U);
+        BOOST_CHECK(writer.IsWritten(0));
+
+        std::vector<std::pair<int, CBlockFileInfo> > vFileInfo(1, std::make_pair(0, CBlockFileInfo()));
+        std::vector<CDiskBlockIndex> vBlockIndex(1, diskindex);
+        BOOST_CHECK(writer.QueueBlockIndex(vFileInfo, 0, vBlockIndex));
+        WriteCoinsEntry(writer, txid, coins, true, hashBlock);
+        BOOST_CHECK_EQUAL(writer.GetWritesQueued(), 1U);
+
+        // Held up in the database write
+        BOOST_CHECK(writer.IsWriting());
+        BOOST_CHECK(!writer.IsWritten(1));
+        CCoins coinsRead;
+        BOOST_CHECK(writer.GetCoins(txid, coinsRead));
+        BOOST_CHECK(coinsRead == coins);
+        BOOST_CHECK(writer.HaveCoins(txid));
+        BOOST_CHECK(writer.GetBestBlock() == hashBlock);
+        BOOST_CHECK(!db.GetCoins(txid, coinsRead));
+        BOOST_CHECK(db.GetBestBlock() == uint256(0));
+
+        db.Open();
+        BOOST_CHECK(writer.Wait());
+        BOOST_CHECK(!writer.IsWriting());
+        BOOST_CHECK(writer.IsWritten(1));
+        BOOST_CHECK(db.fIndexWrittenFirst);
+        BOOST_CHECK(db.GetCoins(txid, coinsRead));
+        BOOST_CHECK(coinsRead == coins);
+        BOOST_CHECK(db.GetBestBlock() == hashBlock);
+        BOOST_CHECK(writer.GetBestBlock() == hashBlock);
+        int nLastBlockFile = -1;
+        BOOST_CHECK(blocktree.ReadLastBlockFile(nLastBlockFile));
+        BOOST_CHECK_EQUAL(nLastBlockFile, 0);
+    }
+}
+
+// After a failed write the state is kept and served, and nothing more is taken.
+BOOST_AUTO_TEST_CASE(coins_writer_failure)
+{
+    CCoinsViewDBGated db;
+    CBlockTreeDB blocktree(1 << 20, true);
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    CCoins coins = RandomCoins(2);
+    db.Open(true);
+    {
+        CCoinsViewBackgroundWriter writer(&db, &blocktree);
+        WriteCoinsEntry(writer, txid, coins, true, hashBlock);
+        BOOST_CHECK(!writer.Wait());
+        BOOST_CHECK(!writer.IsWritten(writer.GetWritesQueued()));
+
+        CCoins coinsRead;
+        BOOST_CHECK(writer.GetCoins(txid, coinsRead));
+        BOOST_CHECK(coinsRead == coins);
+        BOOST_CHECK(writer.GetBestBlock() == hashBlock);
+        BOOST_CHECK(!db.HaveCoins(txid));
+
+        CCoinsMap mapCoins;
+        mapCoins[GetRandHash()].flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+        BOOST_CHECK(!writer.BatchWrite(mapCoins, GetRandHash()));
+        std::vector<std::pair<int, CBlockFileInfo> > vFileInfo;
+        std::vector<CDiskBlockIndex> vBlockIndex;
+        BOOST_CHECK(!writer.QueueBlockIndex(vFileInfo, -1, vBlockIndex));
+        BOOST_CHECK(writer.GetBestBlock() == hashBlock);
+    }
+}
+
+// A write still in flight when the writer goes away is finished first.
+BOOST_AUTO_TEST_CASE(coins_writer_shutdown)
+{
+    CCoinsViewDBTest db;
+    CBlockTreeDB blocktree(1 << 20, true);
+    uint256 txid = GetRandHash();
+    uint256 hashBlock = GetRandHash();
+    CCoins coins = RandomCoins(2);
+    {
+        CCoinsViewBackgroundWriter writer(&db, &blocktree);
+        WriteCoinsEntry(writer, txid, coins, true, hashBlock);
+    }
+    CCoins coinsRead;
+    BOOST_CHECK(db.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,56 @@
+// Copyright (c) 2018 The Liberty Developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "invknown.h"
+
+#include "random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(invknown_tests)
+
+BOOST_AUTO_TEST_CASE(invknown_per_peer)
+{
+    CKnownInventory known(100);
+    int nSlotA = known.AddPeer();
+    int nSlotB = known.AddPeer();
+    BOOST_CHECK(nSlotA >= 0 && nSlotB >= 0 && nSlotA != nSlotB);
+
+    CInv inv(MSG_TX, GetRandHash());
+    BOOST_CHECK(!known.IsKnown(nSlotA, inv));
+    BOOST_CHECK(known.SetKnown(nSlotA, inv));
+    BOOST_CHECK(!known.SetKnown(nSlotA, inv));
+    BOOST_CHECK(known.IsKnown(nSlotA, inv));
+    BOOST_CHECK(!known.IsKnown(nSlotB, inv));
+    BOOST_CHECK_EQUAL(known.Size(), 1U);
+
+    // A reused slot must not inherit what its previous owner knew
+    known.RemovePeer(nSlotA);
+    int nSlotC = known.AddPeer();
+    BOOST_CHECK_EQUAL(nSlotC, nSlotA);
+    BOOST_CHECK(!known.IsKnown(nSlotC, inv));
+}
+
+BOOST_AUTO_TEST_CASE(invknown_limits)
+{
+    CKnownInventory known(10);
+    int nSlot = known.AddPeer();
+
+    CInv invFirst(MSG_TX, GetRandHash());
+    known.SetKnown(nSlot, invFirst);
+    for (int i = 0; i < 10; i++)
+        known.SetKnown(nSlot, CInv(MSG_MASTERNODE_PING, GetRandHash()));
+    BOOST_CHECK_EQUAL(known.Size(), 10U);
+    BOOST_CHECK(!known.IsKnown(nSlot, invFirst));
+
+    // Peers beyond the slot limit are never considered to know anything
+    for (int i = 1; i < MAX_KNOWN_INVENTORY_PEERS; i++)
+        BOOST_CHECK(known.AddPeer() >= 0);
+    BOOST_CHECK_EQUAL(known.AddPeer(), -1);
+    BOOST_CHECK(known.SetKnown(-1, invFirst));
+    BOOST_CHECK(known.SetKnown(-1, invFirst));
+    BOOST_CHECK(!known.IsKnown(-1, invFirst));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,10 +9,12 @@
 #include "main.h"
 #include "txdb.h"
 #include "primitives/deterministicmint.h"
+#include "random.h"
 #include "key.h"
 #include "libzerocoin/bignum.h"
 #include <boost/test/unit_test.hpp>
 #include <iostream>
+#include <boost/shared_ptr.hpp>
 #include <accumulators.h>
 #include "wallet.h"
 #include "xlibzwallet.h"
@@ -537,4 +539,66 @@ BOOST_AUTO_TEST_CASE(deterministic_tests)
 }
 
 
+// Maturity height of denom, walking back over the chain from the confirmed height
+static int WalkMintMaturityHeight(const CBlockIndex* pindexTip, CoinDenomination denom)
+{
+    int nConfirmedHeight = (pindexTip ? pindexTip->nHeight : -1) - Params().Zerocoin_MintRequiredConfirmations();
+    int nMinimumMaturityHeight = nConfirmedHeight - (nConfirmedHeight % 10);
+    int nCount = 0;
+    for (const CBlockIndex* pindex = pindexTip; pindex; pindex = pindex->pprev) {
+        if (pindex->nHeight > nConfirmedHeight)
+            continue;
+        nCount += pindex->GetMintCount(denom);
+        if (nCount >= Params().Zerocoin_RequiredAccumulation())
+            return std::min(pindex->nHeight, nMinimumMaturityHeight);
+    }
+    return 0;
+}
+
+BOOST_AUTO_TEST_CASE(mint_maturity_test)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    // Keep few blocks around, so that reorganizations go past the ones that were kept
+    mapArgs["-maxreorg"] = "5";
+
+    std::vector<boost::shared_ptr<CBlockIndex> > vChain;
+    LOCK(cs_main);
+    for (int i = 0; i < 4000; i++) {
+        if (vChain.empty() || insecure_rand() % 4 != 0) {
+            boost::shared_ptr<CBlockIndex> pindex(new CBlockIndex());
+            pindex->pprev = vChain.empty() ? NULL : vChain.back().get();
+            pindex->nHeight = vChain.size();
+            // Mints are rare, so the maturity goes back over many blocks
+            for (CoinDenomination denom : zerocoinDenomList) {
+                if (insecure_rand() % 40 == 0)
+                    for (int n = 1 + insecure_rand() % 2; n > 0; n--)
+                        pindex->AddMint(denom);
+            }
+            vChain.push_back(pindex);
+        } else {
+            // Disconnect a block, now and then several in a row
+            vChain.pop_back();
+        }
+        UpdateMintMaturityHeight(vChain.empty() ? NULL : vChain.back().get());
+
+        std::map<CoinDenomination, int> mapMaturity = GetMintMaturityHeight();
+        for (CoinDenomination denom : zerocoinDenomList)
+            BOOST_CHECK_EQUAL(mapMaturity.at(denom), WalkMintMaturityHeight(vChain.empty() ? NULL : vChain.back().get(), denom));
+
+        if (insecure_rand() % 200 == 0) {
+            // Reorganize past the blocks that were kept
+            for (int n = 20; n > 0 && vChain.size() > 1; n--) {
+                vChain.pop_back();
+                UpdateMintMaturityHeight(vChain.back().get());
+            }
+            mapMaturity = GetMintMaturityHeight();
+            for (CoinDenomination denom : zerocoinDenomList)
+                BOOST_CHECK_EQUAL(mapMaturity.at(denom), WalkMintMaturityHeight(vChain.back().get(), denom));
+        }
+    }
+
+    UpdateMintMaturityHeight(NULL);
+    mapArgs.erase("-maxreorg");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -18,12 +18,83 @@
 using namespace std;
 using namespace libzerocoin;
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+/**
+ * One unspent output as stored in the coin database under ('C', outpoint). It
+ * carries the fields of its transaction that CCoins keeps, so the outputs of a
+ * transaction can be written and erased independently of each other.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode): nHeight * 4 + fCoinStake * 2 + fCoinBase
+ * - the CTxOut (via CTxOutCompressor)
+ */
+class CCoinsOutputRecord
+{
+public:
+    int nVersion;
+    int nHeight;
+    bool fCoinBase;
+    bool fCoinStake;
+    CTxOut txout;
+
+    CCoinsOutputRecord() : nVersion(0), nHeight(0), fCoinBase(false), fCoinStake(false) {}
+    CCoinsOutputRecord(const CCoins& coins, unsigned int n) : nVersion(coins.nVersion), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), fCoinStake(coins.fCoinStake), txout(coins.vout[n]) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        unsigned int nCode = nHeight * 4 + (fCoinStake ? 2 : 0) + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(this->nVersion));
+        READWRITE(VARINT(nCode));
+        READWRITE(REF(CTxOutCompressor(txout)));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 4;
+            fCoinStake = (nCode & 2) != 0;
+            fCoinBase = (nCode & 1) != 0;
+        }
+    }
+};
+
+//! Add an output read from the database to the coins of its transaction
+void static AddCoinsOutput(CCoins& coins, unsigned int n, const CCoinsOutputRecord& record)
+{
+    coins.fCoinBase = record.fCoinBase;
+    coins.fCoinStake = record.fCoinStake;
+    coins.nHeight = record.nHeight;
+    coins.nVersion = record.nVersion;
+    if (n >= coins.vout.size())
+        coins.vout.resize(n + 1);
+    coins.vout[n] = record.txout;
+}
+
+/**
+ * Queue the changes that turn coinsOld, the outputs of txid currently in the
+ * database, into coins. Outputs that did not change are left alone.
+ */
+void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins, const CCoins& coinsOld, bool fLegacy, size_t& nWritten, size_t& nErased)
 {
-    if (coins.IsPruned())
+    if (fLegacy) {
+        // The outputs are all in one record; write them out one by one
         batch.Erase(make_pair('c', hash));
-    else
-        batch.Write(make_pair('c', hash), coins);
+        nErased++;
+    }
+    bool fSameTx = !fLegacy && coins.nVersion == coinsOld.nVersion && coins.nHeight == coinsOld.nHeight &&
+                   coins.fCoinBase == coinsOld.fCoinBase && coins.fCoinStake == coinsOld.fCoinStake;
+    for (unsigned int i = 0; i < std::max(coins.vout.size(), coinsOld.vout.size()); i++) {
+        bool fUnspent = i < coins.vout.size() && !coins.vout[i].IsNull();
+        bool fStored = !fLegacy && i < coinsOld.vout.size() && !coinsOld.vout[i].IsNull();
+        if (!fUnspent) {
+            if (fStored) {
+                batch.Erase(make_pair('C', COutPoint(hash, i)));
+                nErased++;
+            }
+        } else if (!fStored || !fSameTx || coins.vout[i] != coinsOld.vout[i]) {
+            batch.Write(make_pair('C', COutPoint(hash, i)), CCoinsOutputRecord(coins, i));
+            nWritten++;
+        }
+    }
 }
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
@@ -31,18 +102,162 @@ void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, GetLevelDBProfile(LEVELDB_PROFILE_CHAINSTATE)), nVersion(COINS_DB_VERSION), fLegacyCoins(false), nBatchesWritten(0)
+{
+    // Databases from before the version was recorded are in a format this version reads
+    if (!db.Read('V', nVersion))
+        db.Write('V', nVersion);
+    if (!IsVersionSupported()) {
+        LogPrintf("Coin database has version %d, this version supports up to %d\n", nVersion, COINS_DB_VERSION);
+        return;
+    }
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    pcursor->Seek(std::string(1, 'c'));
+    fLegacyCoins = pcursor->Valid() && pcursor->key().starts_with(std::string(1, 'c'));
+    if (fLegacyCoins)
+        LogPrintf("Coin database holds per-transaction records, they will be upgraded in the background\n");
+}
+
+CCoinsViewDB::~CCoinsViewDB()
+{
+    // The iterators have to go before the database they read
+    for (unsigned int i = 0; i < vCursors.size(); i++)
+        delete vCursors[i].second;
+}
+
+leveldb::Iterator* CCoinsViewDB::GetCursor(uint64_t& nCursorBatches) const
+{
+    nCursorBatches = nBatchesWritten;
+    {
+        LOCK(cs_cursors);
+        if (!vCursors.empty() && vCursors.back().first == nCursorBatches) {
+            leveldb::Iterator* pcursor = vCursors.back().second;
+            vCursors.pop_back();
+            return pcursor;
+        }
+    }
+    return const_cast<CLevelDBWrapper*>(&db)->NewIterator(true);
+}
+
+void CCoinsViewDB::ReleaseCursor(leveldb::Iterator* pcursor, uint64_t nCursorBatches) const
 {
+    {
+        LOCK(cs_cursors);
+        if (nCursorBatches == nBatchesWritten && vCursors.size() < MAX_COINS_DB_CURSORS) {
+            vCursors.push_back(make_pair(nCursorBatches, pcursor));
+            return;
+        }
+    }
+    delete pcursor;
+}
+
+/**
+ * Write a batch and retire the idle iterators, which were created before it.
+ * Lookups that already hold one finish on the old snapshot, as they would
+ * have with an iterator of their own.
+ */
+bool CCoinsViewDB::WriteBatch(CLevelDBBatch& batch)
+{
+    bool fOk = db.WriteBatch(batch);
+    nBatchesWritten++;
+    std::vector<std::pair<uint64_t, leveldb::Iterator*> > vStale;
+    {
+        LOCK(cs_cursors);
+        vStale.swap(vCursors);
+    }
+    for (unsigned int i = 0; i < vStale.size(); i++)
+        delete vStale[i].second;
+    return fOk;
+}
+
+/**
+ * Position pcursor on the per-transaction record of txid. Returns false if
+ * there is none, leaving the iterator on whatever key follows.
+ */
+bool static SeekLegacyCoins(leveldb::Iterator* pcursor, const uint256& txid)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair('c', txid);
+    leveldb::Slice slKey(&ssKey[0], ssKey.size());
+    pcursor->Seek(slKey);
+    return pcursor->Valid() && pcursor->key() == slKey;
+}
+
+/**
+ * Read the outputs of txid, from its per-transaction record if it still has
+ * one (fLegacy is set then) or else from its per-output records.
+ *
+ * Both formats are read through pcursor, so they come from the snapshot the
+ * iterator was created on. The upgrade replaces a per-transaction record with
+ * per-output records in one batch, so one or the other is always found even
+ * when that batch is committed while the lookup runs.
+ */
+bool CCoinsViewDB::ReadCoins(leveldb::Iterator* pcursor, const uint256& txid, CCoins& coins, bool& fLegacy) const
+{
+    coins.Clear();
+    fLegacy = false;
+    try {
+        if (fLegacyCoins && SeekLegacyCoins(pcursor, txid)) {
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> coins;
+            fLegacy = true;
+            return true;
+        }
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('C', COutPoint(txid, 0));
+    // 'C' followed by the txid
+    leveldb::Slice slPrefix(&ssKeySet[0], 1 + sizeof(uint256));
+    bool fFound = false;
+    try {
+        for (pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size())); pcursor->Valid() && pcursor->key().starts_with(slPrefix); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            COutPoint outpoint;
+            ssKey >> chType >> outpoint;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoinsOutputRecord record;
+            ssValue >> record;
+            AddCoinsOutput(coins, outpoint.n, record);
+            fFound = true;
+        }
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return fFound;
 }
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    uint64_t nCursorBatches;
+    leveldb::Iterator* pcursor = GetCursor(nCursorBatches);
+    bool fLegacy;
+    bool fFound = ReadCoins(pcursor, txid, coins, fLegacy);
+    ReleaseCursor(pcursor, nCursorBatches);
+    return fFound;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
-    return db.Exists(make_pair('c', txid));
+    // One iterator for both formats, see ReadCoins
+    uint64_t nCursorBatches;
+    leveldb::Iterator* pcursor = GetCursor(nCursorBatches);
+    bool fFound = fLegacyCoins && SeekLegacyCoins(pcursor, txid);
+    if (!fFound) {
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << make_pair('C', COutPoint(txid, 0));
+        pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+        fFound = pcursor->Valid() && pcursor->key().starts_with(leveldb::Slice(&ssKeySet[0], 1 + sizeof(uint256)));
+    }
+    ReleaseCursor(pcursor, nCursorBatches);
+    return fFound;
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
@@ -55,26 +270,278 @@ uint256 CCoinsViewDB::GetBestBlock() const
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
 {
+    bool fOk = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return fOk;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    if (!IsVersionSupported())
+        return error("%s : coin database version %d is newer than this version supports", __func__, nVersion);
+    LOCK(cs_upgrade);
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    size_t nWritten = 0;
+    size_t nErased = 0;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator(true));
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            // Fresh entries have nothing in the database yet; for the others
+            // the stored outputs are read back so only the changed ones are written.
+            CCoins coinsOld;
+            bool fLegacy = false;
+            if (!(it->second.flags & CCoinsCacheEntry::FRESH) && !ReadCoins(pcursor.get(), it->first, coinsOld, fLegacy))
+                coinsOld.Clear();
+            BatchWriteCoins(batch, it->first, it->second.coins, coinsOld, fLegacy, nWritten, nErased);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database: %u outputs written, %u erased...\n", (unsigned int)changed, (unsigned int)count, (unsigned int)nWritten, (unsigned int)nErased);
+    return WriteBatch(batch);
+}
+
+void CCoinsViewDB::Upgrade()
+{
+    LogPrintf("Upgrading coin database to per-output records...\n");
+    int64_t nStart = GetTimeMillis();
+    uint256 hashNext = 0;
+    size_t nTransactions = 0;
+    size_t nOutputs = 0;
+    int nLastProgress = -1;
+    while (fLegacyCoins) {
+        boost::this_thread::interruption_point();
+        {
+            LOCK(cs_upgrade);
+            CLevelDBBatch batch;
+            unsigned int nBatch = 0;
+            boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+            CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+            ssKeySet << make_pair('c', hashNext);
+            pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+            for (; pcursor->Valid() && nBatch < COINS_UPGRADE_BATCH_SIZE; pcursor->Next()) {
+                leveldb::Slice slKey = pcursor->key();
+                if (slKey.size() == 0 || slKey[0] != 'c')
+                    break;
+                try {
+                    CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                    char chType;
+                    uint256 txid;
+                    ssKey >> chType >> txid;
+                    leveldb::Slice slValue = pcursor->value();
+                    CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                    CCoins coins;
+                    ssValue >> coins;
+                    size_t nErased = 0;
+                    BatchWriteCoins(batch, txid, coins, CCoins(), true, nOutputs, nErased);
+                    hashNext = txid;
+                    nTransactions++;
+                    nBatch++;
+                } catch (std::exception& e) {
+                    LogPrintf("%s : Deserialize or I/O error - %s, coin database upgrade aborted\n", __func__, e.what());
+                    return;
+                }
+            }
+            if (!WriteBatch(batch)) {
+                LogPrintf("%s : failed to write coin database upgrade batch\n", __func__);
+                return;
+            }
+            // Only once the last records are gone can lookups skip the old layout
+            if (nBatch < COINS_UPGRADE_BATCH_SIZE)
+                fLegacyCoins = false;
+        }
+        // Transactions are visited in key order, which starts with the low byte of the txid
+        int nProgress = (hashNext.begin()[0] * 256 + hashNext.begin()[1]) * 100 / 65536;
+        if (nProgress / 10 != nLastProgress / 10) {
+            LogPrintf("Upgrading coin database... %d%%\n", nProgress);
+            nLastProgress = nProgress;
+        }
+    }
+    LogPrintf("Upgraded coin database: %u transactions, %u outputs in %dms\n", (unsigned int)nTransactions, (unsigned int)nOutputs, GetTimeMillis() - nStart);
+}
+
+CCoinsViewBackgroundWriter::CCoinsViewBackgroundWriter(CCoinsViewDB* pcoinsdbIn, CBlockTreeDB* pblocktreedbIn) : pcoinsdb(pcoinsdbIn), pblocktreedb(pblocktreedbIn), hashBlock(0), nLastBlockFile(-1), fWriting(false), fFailed(false), fStop(false), nWritesQueued(0), nWritesDone(0)
+{
+    thread = boost::thread(boost::bind(&CCoinsViewBackgroundWriter::ThreadWrite, this));
+}
+
+CCoinsViewBackgroundWriter::~CCoinsViewBackgroundWriter()
+{
+    {
+        WaitableLock lock(cs);
+        fStop = true;
+        cond.notify_all();
+    }
+    // Whatever was handed over is written before the thread exits
+    thread.join();
+}
+
+void CCoinsViewBackgroundWriter::ThreadWrite()
+{
+    RenameThread("liberty-chainwr");
+    WaitableLock lock(cs);
+    while (true) {
+        while (!fWriting && !fStop)
+            cond.wait(lock);
+        if (!fWriting)
+            return;
+
+        // Nothing hands over more state until fWriting is cleared, and the
+        // readers only look things up, so the write goes on without the lock.
+        lock.unlock();
+        int64_t nTimeStart = GetTimeMicros();
+        bool fOk = true;
+        try {
+            for (std::vector<std::pair<int, CBlockFileInfo> >::const_iterator it = vFileInfo.begin(); fOk && it != vFileInfo.end(); it++)
+                fOk = pblocktreedb->WriteBlockFileInfo(it->first, it->second);
+            if (fOk && nLastBlockFile >= 0)
+                fOk = pblocktreedb->WriteLastBlockFile(nLastBlockFile);
+            for (std::vector<CDiskBlockIndex>::const_iterator it = vBlockIndex.begin(); fOk && it != vBlockIndex.end(); it++)
+                fOk = pblocktreedb->WriteBlockIndex(*it);
+            if (!fOk)
+                LogPrintf("%s : failed to write to block index\n", __func__);
+            // The chainstate may refer to block index entries, so those go first
+            if (fOk)
+                fOk = pblocktreedb->Sync();
+            if (fOk && !(fOk = pcoinsdb->WriteCoins(mapCoins, hashBlock)))
+                LogPrintf("%s : failed to write to coin database\n", __func__);
+        } catch (const std::exception& e) {
+            LogPrintf("%s : %s\n", __func__, e.what());
+            fOk = false;
+        }
+        LogPrint("bench", "- Background chainstate write: %.2fms (%u txs, %u block index entries)\n", (GetTimeMicros() - nTimeStart) * 0.001,
+            (unsigned int)mapCoins.size(), (unsigned int)vBlockIndex.size());
+        lock.lock();
+
+        if (fOk) {
+            // Nothing is handed over while a write is in progress, so this is the one just written
+            nWritesDone = nWritesQueued;
+            mapCoins.clear();
+            hashBlock = 0;
+            vFileInfo.clear();
+            nLastBlockFile = -1;
+            vBlockIndex.clear();
+        } else {
+            // Keep serving what didn't make it to disk; the node shuts down on the next flush
+            fFailed = true;
+        }
+        fWriting = false;
+        cond.notify_all();
+    }
+}
+
+bool CCoinsViewBackgroundWriter::WaitLocked(WaitableLock& lock) const
+{
+    while (fWriting)
+        cond.wait(lock);
+    return !fFailed;
+}
+
+bool CCoinsViewBackgroundWriter::Wait() const
+{
+    WaitableLock lock(cs);
+    return WaitLocked(lock);
+}
+
+bool CCoinsViewBackgroundWriter::IsWriting() const
+{
+    WaitableLock lock(cs);
+    return fWriting;
+}
+
+uint64_t CCoinsViewBackgroundWriter::GetWritesQueued() const
+{
+    WaitableLock lock(cs);
+    return nWritesQueued;
+}
+
+bool CCoinsViewBackgroundWriter::IsWritten(uint64_t nWrite) const
+{
+    WaitableLock lock(cs);
+    return nWritesDone >= nWrite;
+}
+
+bool CCoinsViewBackgroundWriter::GetCoins(const uint256& txid, CCoins& coins) const
+{
+    {
+        WaitableLock lock(cs);
+        CCoinsMap::const_iterator it = mapCoins.find(txid);
+        if (it != mapCoins.end()) {
+            coins = it->second.coins;
+            return true;
+        }
+    }
+    return pcoinsdb->GetCoins(txid, coins);
+}
+
+bool CCoinsViewBackgroundWriter::HaveCoins(const uint256& txid) const
+{
+    {
+        WaitableLock lock(cs);
+        CCoinsMap::const_iterator it = mapCoins.find(txid);
+        if (it != mapCoins.end())
+            return !it->second.coins.IsPruned();
+    }
+    return pcoinsdb->HaveCoins(txid);
+}
+
+uint256 CCoinsViewBackgroundWriter::GetBestBlock() const
+{
+    {
+        WaitableLock lock(cs);
+        if (hashBlock != uint256(0))
+            return hashBlock;
+    }
+    return pcoinsdb->GetBestBlock();
+}
+
+bool CCoinsViewBackgroundWriter::QueueBlockIndex(std::vector<std::pair<int, CBlockFileInfo> >& vFileInfoIn, int nLastBlockFileIn, std::vector<CDiskBlockIndex>& vBlockIndexIn)
+{
+    WaitableLock lock(cs);
+    if (!WaitLocked(lock))
+        return false;
+    vFileInfo.swap(vFileInfoIn);
+    nLastBlockFile = nLastBlockFileIn;
+    vBlockIndex.swap(vBlockIndexIn);
+    return true;
+}
+
+bool CCoinsViewBackgroundWriter::BatchWrite(CCoinsMap& mapCoinsIn, const uint256& hashBlockIn)
+{
+    WaitableLock lock(cs);
+    if (!WaitLocked(lock))
+        return false;
+    mapCoins.swap(mapCoinsIn);
+    mapCoinsIn.clear();
+    // Clean entries match the database already
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            it++;
+        } else {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        }
+    }
+    hashBlock = hashBlockIn;
+    fWriting = true;
+    nWritesQueued++;
+    cond.notify_all();
+    return true;
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
+bool CCoinsViewBackgroundWriter::GetStats(CCoinsStats& stats) const
+{
+    if (!Wait())
+        return false;
+    return pcoinsdb->GetStats(stats);
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, GetLevelDBProfile(LEVELDB_PROFILE_BLOCKINDEX))
 {
 }
 
@@ -117,18 +584,46 @@ bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
     return Read('l', nFile);
 }
 
+//! Add the coins of one transaction to the statistics, in the format the per-transaction layout used
+void static AddCoinsStats(CHashWriter& ss, CCoinsStats& stats, CAmount& nTotalAmount, const uint256& txhash, const CCoins& coins)
+{
+    ss << txhash;
+    ss << VARINT(coins.nVersion);
+    ss << (coins.fCoinBase ? 'c' : 'n');
+    ss << VARINT(coins.nHeight);
+    stats.nTransactions++;
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        const CTxOut& out = coins.vout[i];
+        if (!out.IsNull()) {
+            stats.nTransactionOutputs++;
+            ss << VARINT(i + 1);
+            ss << out;
+            nTotalAmount += out.nValue;
+        }
+    }
+    ss << VARINT(0);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
 {
+    // The hash covers transactions in txid order, which a database halfway
+    // through the upgrade can't provide in one pass.
+    if (fLegacyCoins)
+        return error("%s : coin database upgrade in progress", __func__);
+
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    pcursor->Seek(std::string(1, 'C'));
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    uint256 txhash = 0;
+    CCoins coins;
+    bool fHaveCoins = false;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -136,35 +631,29 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+            if (chType != 'C')
+                break;
+            COutPoint outpoint;
+            ssKey >> outpoint;
+            if (fHaveCoins && outpoint.hash != txhash) {
+                AddCoinsStats(ss, stats, nTotalAmount, txhash, coins);
+                coins.Clear();
             }
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoinsOutputRecord record;
+            ssValue >> record;
+            AddCoinsOutput(coins, outpoint.n, record);
+            txhash = outpoint.hash;
+            fHaveCoins = true;
+            stats.nSerializedSize += slKey.size() + slValue.size();
             pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    if (fHaveCoins)
+        AddCoinsStats(ss, stats, nTotalAmount, txhash, coins);
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
@@ -208,31 +697,45 @@ bool CBlockTreeDB::ReadInt(const std::string& name, int& nValue)
     return Read(std::make_pair('I', name), nValue);
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+/**
+ * Load the block index entries whose key hash starts with a byte in [nBegin, nEnd).
+ * Deserializing an entry and checking its proof of work happen without a lock,
+ * only linking it into mapBlockIndex is serialized through csLoad.
+ */
+static bool LoadBlockIndexRange(CBlockTreeDB* pdb, unsigned int nBegin, unsigned int nEnd, boost::mutex& csLoad)
 {
-    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    boost::scoped_ptr<leveldb::Iterator> pcursor(pdb->NewIterator());
 
+    uint256 hashBegin = 0;
+    *hashBegin.begin() = nBegin;
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair('b', uint256(0));
+    ssKeySet << make_pair('b', hashBegin);
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
-    uint256 nPreviousCheckpoint;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
+            // Keys are 'b' followed by the block hash, stop at the end of the range
             leveldb::Slice slKey = pcursor->key();
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
+            if (slKey.size() < 2 || slKey[0] != 'b' || (unsigned char)slKey[1] >= nEnd)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CDiskBlockIndex diskindex;
+            ssValue >> diskindex;
+            uint256 hash = diskindex.GetBlockHash();
+
+            if (diskindex.nHeight <= Params().Last_PoW_Block()) {
+                if (!CheckProofOfWork(hash, diskindex.nBits))
+                    return error("LoadBlockIndex() : CheckProofOfWork failed: height=%d hash=%s", diskindex.nHeight, hash.ToString());
+            }
+
+            {
+                boost::lock_guard<boost::mutex> lock(csLoad);
 
                 // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
+                CBlockIndex* pindexNew = InsertBlockIndex(hash);
                 pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
                 pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
                 pindexNew->nHeight = diskindex.nHeight;
@@ -249,8 +752,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
                 //zerocoin
                 pindexNew->nAccumulatorCheckpoint = diskindex.nAccumulatorCheckpoint;
-                pindexNew->mapZerocoinSupply = diskindex.mapZerocoinSupply;
-                pindexNew->vMintDenominationsInBlock = diskindex.vMintDenominationsInBlock;
+                memcpy(pindexNew->nZerocoinSupply, diskindex.nZerocoinSupply, sizeof(pindexNew->nZerocoinSupply));
+                memcpy(pindexNew->nMintDenominationsInBlock, diskindex.nMintDenominationsInBlock, sizeof(pindexNew->nMintDenominationsInBlock));
 
                 //Proof Of Stake
                 pindexNew->nMint = diskindex.nMint;
@@ -261,27 +764,12 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nStakeTime = diskindex.nStakeTime;
                 pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
 
-                if (pindexNew->nHeight <= Params().Last_PoW_Block()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
-
                 // ppcoin: build setStakeSeen
                 if (pindexNew->IsProofOfStake())
                     setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
-                //populate accumulator checksum map in memory
-                if(pindexNew->nAccumulatorCheckpoint != 0 && pindexNew->nAccumulatorCheckpoint != nPreviousCheckpoint) {
-                    //if (pindexNew->nHeight >= Params().Zerocoin_StartHeight())
-                        LoadAccumulatorValuesFromDB(pindexNew->nAccumulatorCheckpoint);
-
-                    nPreviousCheckpoint = pindexNew->nAccumulatorCheckpoint;
-                }
-
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
             }
+
+            pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
@@ -290,7 +778,46 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
     return true;
 }
 
-CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "zerocoin", nCacheSize, fMemory, fWipe)
+static void ThreadLoadBlockIndexRange(CBlockTreeDB* pdb, unsigned int nBegin, unsigned int nEnd, boost::mutex* pcsLoad, bool* pfRet)
+{
+    RenameThread("liberty-loadidx");
+    *pfRet = LoadBlockIndexRange(pdb, nBegin, nEnd, *pcsLoad);
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    // Block hashes are evenly distributed, so splitting the keys by the first
+    // hash byte gives every thread about the same share of the index.
+    // Accumulator values are no longer read here, GetAccumulatorValueFromChecksum
+    // loads them when they are first needed.
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    boost::mutex csLoad;
+    bool vfRet[MAX_BLOCK_INDEX_LOAD_THREADS] = {};
+
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads; i++) {
+        unsigned int nBegin = 256 * i / nThreads;
+        unsigned int nEnd = 256 * (i + 1) / nThreads;
+        threadGroup.create_thread(boost::bind(&ThreadLoadBlockIndexRange, this, nBegin, nEnd, &csLoad, &vfRet[i]));
+    }
+
+    try {
+        threadGroup.join_all();
+    } catch (boost::thread_interrupted&) {
+        // Don't leave the threads running on our stack
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+        throw;
+    }
+
+    for (int i = 0; i < nThreads; i++) {
+        if (!vfRet[i])
+            return false;
+    }
+    return true;
+}
+
+CZerocoinDB::CZerocoinDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "zerocoin", nCacheSize, fMemory, fWipe, GetLevelDBProfile(LEVELDB_PROFILE_ZEROCOIN))
 {
 }
 
@@ -319,6 +846,43 @@ bool CZerocoinDB::ReadCoinMint(const uint256& hashPubcoin, uint256& hashTx)
     return Read(make_pair('m', hashPubcoin), hashTx);
 }
 
+bool CZerocoinDB::ReadCoinMints(const std::vector<uint256>& vHashPubcoin, std::map<uint256, uint256>& mapHashTx)
+{
+    // Seeking a single cursor through the keys in the order they are stored
+    // touches each table block once, instead of once per lookup
+    std::vector<std::pair<std::string, uint256> > vKeys;
+    vKeys.reserve(vHashPubcoin.size());
+    for (const uint256& hashPubcoin : vHashPubcoin) {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(ssKey.GetSerializeSize(make_pair('m', hashPubcoin)));
+        ssKey << make_pair('m', hashPubcoin);
+        vKeys.push_back(make_pair(ssKey.str(), hashPubcoin));
+    }
+    std::sort(vKeys.begin(), vKeys.end());
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    for (const std::pair<std::string, uint256>& key : vKeys) {
+        pcursor->Seek(key.first);
+        if (!pcursor->Valid())
+            break; // no keys at or after this one, nor after the ones still to do
+        if (pcursor->key() != leveldb::Slice(key.first))
+            continue;
+        try {
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            uint256 hashTx;
+            ssValue >> hashTx;
+            mapHashTx[key.second] = hashTx;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    if (!pcursor->status().ok())
+        return error("%s : %s", __func__, pcursor->status().ToString());
+    return true;
+}
+
 bool CZerocoinDB::EraseCoinMint(const CBigNum& bnPubcoin)
 {
     uint256 hash = GetPubCoinHash(bnPubcoin);
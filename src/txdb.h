@@ -11,11 +11,14 @@
 #include "main.h"
 #include "primitives/zerocoin.h"
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include <boost/thread.hpp>
+
 class CCoins;
 class uint256;
 
@@ -25,21 +28,132 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! max. number of threads loading the block index
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 8;
+
+//! max. number of transactions moved to the per-output layout in one batch
+static const unsigned int COINS_UPGRADE_BATCH_SIZE = 10000;
+//! max. number of iterators the coin database keeps around for lookups
+static const unsigned int MAX_COINS_DB_CURSORS = 4;
+//! Format of the coin database: 1 = per-output records, per-transaction ones read and upgraded
+static const int COINS_DB_VERSION = 1;
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/)
+ *
+ * Every unspent output is stored under its own ('C', outpoint) key, so spending
+ * one output of a transaction only erases that output. Databases written with
+ * one ('c', txid) record per transaction are read as they are and moved to the
+ * per-output layout by Upgrade(), which runs in the background.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
 
+    //! format the database was written in, see COINS_DB_VERSION
+    int nVersion;
+    //! whether per-transaction records may be left in the database
+    std::atomic<bool> fLegacyCoins;
+    //! serializes writes against the upgrade
+    CCriticalSection cs_upgrade;
+
+    //! number of batches written; iterators created before the last one see old data
+    std::atomic<uint64_t> nBatchesWritten;
+    //! idle iterators for lookups, with the number of batches written when they were created
+    mutable CCriticalSection cs_cursors;
+    mutable std::vector<std::pair<uint64_t, leveldb::Iterator*> > vCursors;
+
+    //! Take an iterator that sees every batch written so far, reusing an idle one if there is
+    leveldb::Iterator* GetCursor(uint64_t& nCursorBatches) const;
+    //! Hand an iterator from GetCursor back, to be reused unless a batch was written since
+    void ReleaseCursor(leveldb::Iterator* pcursor, uint64_t nCursorBatches) const;
+    bool WriteBatch(CLevelDBBatch& batch);
+
+    bool ReadCoins(leveldb::Iterator* pcursor, const uint256& txid, CCoins& coins, bool& fLegacy) const;
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Write the dirty entries of mapCoins, leaving the map as it is
+    virtual bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock);
+
+    //! Format the database was written in
+    int GetVersion() const { return nVersion; }
+    //! Whether this version can read and write the database; a newer format is left alone
+    bool IsVersionSupported() const { return nVersion <= COINS_DB_VERSION; }
+    //! Whether per-transaction records are left to be upgraded
+    bool NeedsUpgrade() const { return fLegacyCoins; }
+    //! Move per-transaction records to the per-output layout, a batch at a time
+    void Upgrade();
+};
+
+/**
+ * Coins view over the coin database that writes flushed chainstate on a
+ * background thread. A flush hands it the dirty coins and block index
+ * entries, which it serves to the caches above until they are written, so
+ * validation goes on instead of waiting for the database. One write is in
+ * flight at a time, block index first; the best block is written in the same
+ * batch as the coins, so after a crash the database holds the state of the
+ * last completed write.
+ */
+class CCoinsViewBackgroundWriter : public CCoinsView
+{
+private:
+    CCoinsViewDB* pcoinsdb;
+    CBlockTreeDB* pblocktreedb;
+
+    mutable CWaitableCriticalSection cs;
+    mutable CConditionVariable cond;
+
+    //! state handed over by the last flush, served until it is written
+    CCoinsMap mapCoins;
+    uint256 hashBlock;
+    std::vector<std::pair<int, CBlockFileInfo> > vFileInfo;
+    int nLastBlockFile;
+    std::vector<CDiskBlockIndex> vBlockIndex;
+
+    //! a write is queued or in progress
+    bool fWriting;
+    //! a write failed, the state above is kept and nothing more is written
+    bool fFailed;
+    bool fStop;
+    //! number of coin writes handed over, and how many of them are on disk
+    uint64_t nWritesQueued;
+    uint64_t nWritesDone;
+
+    boost::thread thread;
+
+    void ThreadWrite();
+    bool WaitLocked(WaitableLock& lock) const;
+
+public:
+    CCoinsViewBackgroundWriter(CCoinsViewDB* pcoinsdbIn, CBlockTreeDB* pblocktreedbIn);
+    ~CCoinsViewBackgroundWriter();
+
+    bool GetCoins(const uint256& txid, CCoins& coins) const;
+    bool HaveCoins(const uint256& txid) const;
+    uint256 GetBestBlock() const;
+    //! Hand the dirty entries over to be written and return without waiting for the write
+    bool BatchWrite(CCoinsMap& mapCoinsIn, const uint256& hashBlockIn);
+    bool GetStats(CCoinsStats& stats) const;
+
+    //! Hand block index changes over to be written ahead of the next coins
+    bool QueueBlockIndex(std::vector<std::pair<int, CBlockFileInfo> >& vFileInfoIn, int nLastBlockFileIn, std::vector<CDiskBlockIndex>& vBlockIndexIn);
+    bool IsWriting() const;
+    //! Wait until everything handed over is written, false if a write failed
+    bool Wait() const;
+    //! Number of coin writes handed over so far, to check on the last one with IsWritten
+    uint64_t GetWritesQueued() const;
+    //! Whether the nWrite-th coin write handed over (and so every one before it) is on disk
+    bool IsWritten(uint64_t nWrite) const;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -84,6 +198,8 @@ public:
     bool WriteCoinMintBatch(const std::vector<std::pair<libzerocoin::PublicCoin, uint256> >& mintInfo);
     bool ReadCoinMint(const CBigNum& bnPubcoin, uint256& txHash);
     bool ReadCoinMint(const uint256& hashPubcoin, uint256& hashTx);
+    /** Look up many mints with one cursor, in key order. Found mints are added to mapHashTx */
+    bool ReadCoinMints(const std::vector<uint256>& vHashPubcoin, std::map<uint256, uint256>& mapHashTx);
     /** Write XLIBz spends to the zerocoinDB in a batch */
     bool WriteCoinSpendBatch(const std::vector<std::pair<libzerocoin::CoinSpend, uint256> >& spendInfo);
     bool ReadCoinSpend(const CBigNum& bnSerial, uint256& txHash);
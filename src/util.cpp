@@ -677,6 +677,27 @@ void AllocateFileRange(FILE* file, unsigned int offset, unsigned int length)
 #endif
 }
 
+/**
+ * Resident set size of the process in KiB, 0 where it can't be determined.
+ * Used to report the memory taken by data structures loaded at startup.
+ */
+int64_t GetResidentMemoryKiB()
+{
+#if defined(__linux__)
+    int64_t nResident = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file) {
+        long nPages, nResidentPages;
+        if (fscanf(file, "%ld %ld", &nPages, &nResidentPages) == 2)
+            nResident = (int64_t)nResidentPages * (sysconf(_SC_PAGESIZE) / 1024);
+        fclose(file);
+    }
+    return nResident;
+#else
+    return 0;
+#endif
+}
+
 void ShrinkDebugFile()
 {
     // Scroll debug.log if it's getting too big
@@ -11,6 +11,7 @@
 #include "base58.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
+#include "coinselection.h"
 #include "kernel.h"
 #include "masternode-budget.h"
 #include "net.h"
@@ -72,6 +73,19 @@ struct CompareValueOnly {
     }
 };
 
+// Keeps coins that aren't denominated in front, using flags worked out beforehand
+struct CIsNotDenominated {
+    const COutput* pbegin;
+    const vector<char>& vfDenom;
+
+    CIsNotDenominated(const COutput* pbeginIn, const vector<char>& vfDenomIn) : pbegin(pbeginIn), vfDenom(vfDenomIn) {}
+
+    bool operator()(const COutput* poutput) const
+    {
+        return !vfDenom[poutput - pbegin];
+    }
+};
+
 std::string COutput::ToString() const
 {
     return strprintf("COutput(%s, %d, %d) [%s]", tx->GetHash().ToString(), i, nDepth, FormatMoney(tx->vout[i].nValue));
@@ -624,11 +638,135 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
-        BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet)
+        setUnspentTx.clear();
+        pindexUnspentPruned = NULL;
+        BOOST_FOREACH (PAIRTYPE(const uint256, CWalletTx) & item, mapWallet) {
             item.second.MarkDirty();
+            setUnspentTx.insert(item.first);
+        }
     }
 }
 
+/**
+ * True if every output of ours is spent by a wallet transaction in the
+ * active chain, so the transaction no longer adds to any balance.
+ */
+bool CWallet::IsSpentByConfirmed(const CWalletTx& wtx) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) == ISMINE_NO)
+            continue;
+        bool fConfirmed = false;
+        pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(hash, i));
+        for (TxSpends::const_iterator it = range.first; it != range.second && !fConfirmed; ++it) {
+            std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+            fConfirmed = mit != mapWallet.end() && mit->second.GetDepthInMainChain(false) > 0;
+        }
+        if (!fConfirmed)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * The wallet transactions that may still have unspent outputs of ours, for
+ * the balance getters and coin selection.
+ */
+std::vector<const CWalletTx*> CWallet::GetUnspentTransactions() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // Spends only get confirmed or disconnected when the tip moves, so
+    // transactions added in between are checked at the next tip
+    bool fPrune = pindexUnspentPruned != chainActive.Tip();
+    pindexUnspentPruned = chainActive.Tip();
+
+    std::vector<const CWalletTx*> vUnspent;
+    vUnspent.reserve(setUnspentTx.size());
+    for (std::set<uint256>::const_iterator it = setUnspentTx.begin(); it != setUnspentTx.end();) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(*it);
+        if (mi == mapWallet.end() || (fPrune && IsSpentByConfirmed(mi->second))) {
+            setUnspentTx.erase(it++);
+            continue;
+        }
+        vUnspent.push_back(&mi->second);
+        ++it;
+    }
+    return vUnspent;
+}
+
+void CWallet::UpdateHistoryIndex()
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // Only the blocks above the fork with the tip the index was last used at
+    // can have joined or left the active chain since
+    if (pindexHistory != chainActive.Tip()) {
+        const CBlockIndex* pindexFork = pindexHistory ? chainActive.FindFork(pindexHistory) : NULL;
+        for (std::multimap<int, uint256>::const_iterator it = mapTxByHeight.upper_bound(pindexFork ? pindexFork->nHeight : -1); it != mapTxByHeight.end(); ++it)
+            setTxHistoryDirty.insert(it->second);
+        pindexHistory = chainActive.Tip();
+    }
+
+    BOOST_FOREACH (const uint256& hash, setTxHistoryDirty) {
+        std::map<uint256, int>::iterator mi = mapTxHeight.find(hash);
+        if (mi != mapTxHeight.end()) {
+            pair<std::multimap<int, uint256>::iterator, std::multimap<int, uint256>::iterator> range = mapTxByHeight.equal_range(mi->second);
+            for (std::multimap<int, uint256>::iterator it = range.first; it != range.second; ++it) {
+                if (it->second == hash) {
+                    mapTxByHeight.erase(it);
+                    break;
+                }
+            }
+            mapTxHeight.erase(mi);
+        }
+        setTxOffChain.erase(hash);
+
+        std::map<uint256, CWalletTx>::const_iterator wi = mapWallet.find(hash);
+        if (wi == mapWallet.end())
+            continue;
+        const CWalletTx& wtx = wi->second;
+        int nHeight = -1;
+        BlockMap::const_iterator bi = mapBlockIndex.find(wtx.hashBlock);
+        if (wtx.hashBlock != 0 && bi != mapBlockIndex.end())
+            nHeight = bi->second->nHeight;
+        mapTxHeight[hash] = nHeight;
+        mapTxByHeight.insert(make_pair(nHeight, hash));
+        if (wtx.GetDepthInMainChain(false) <= 0)
+            setTxOffChain.insert(hash);
+    }
+    setTxHistoryDirty.clear();
+}
+
+/**
+ * The wallet transactions that may have fewer confirmations than a block at
+ * nHeight: the ones in blocks above it and the ones not in the active chain.
+ */
+std::vector<const CWalletTx*> CWallet::GetTransactionsSince(int nHeight)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+    UpdateHistoryIndex();
+
+    std::set<uint256> setTx(setTxOffChain);
+    for (std::multimap<int, uint256>::const_iterator it = mapTxByHeight.upper_bound(nHeight); it != mapTxByHeight.end(); ++it)
+        setTx.insert(it->second);
+
+    std::vector<const CWalletTx*> vTx;
+    vTx.reserve(setTx.size());
+    BOOST_FOREACH (const uint256& hash, setTx) {
+        std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+            vTx.push_back(&mi->second);
+    }
+    return vTx;
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
 {
     uint256 hash = wtxIn.GetHash();
@@ -639,6 +777,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         wtx.BindWallet(this);
         wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
         AddToSpends(hash);
+        setUnspentTx.insert(hash);
+        setTxHistoryDirty.insert(hash);
     } else {
         LOCK(cs_wallet);
         // Inserts only if not already there, returns tx inserted or tx found
@@ -654,6 +794,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
             wtx.nTimeSmart = ComputeTimeSmart(wtx);
             AddToSpends(hash);
         }
+        setUnspentTx.insert(hash);
+        setTxHistoryDirty.insert(hash);
 
         bool fUpdated = false;
         if (!fInsertedNew) {
@@ -723,6 +865,10 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
 {
     LOCK2(cs_main, cs_wallet);
+    // Mints and spends of our zerocoins, whether or not the transaction is ours
+    if (xlibzTracker)
+        xlibzTracker->NotifyTransaction(tx);
+
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
 
@@ -730,8 +876,10 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     // available of the outputs it spends. So force those to be
     // recomputed, also:
     BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-        if (!tx.IsZerocoinSpend() && mapWallet.count(txin.prevout.hash))
+        if (!tx.IsZerocoinSpend() && mapWallet.count(txin.prevout.hash)) {
             mapWallet[txin.prevout.hash].MarkDirty();
+            setUnspentTx.insert(txin.prevout.hash);
+        }
     }
 }
 
@@ -741,8 +889,20 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        setUnspentTx.erase(hash);
+        setTxHistoryDirty.insert(hash);
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end()) {
+            pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(mi->second.nOrderPos);
+            for (TxItems::iterator it = range.first; it != range.second; ++it) {
+                if (it->second.first == &mi->second) {
+                    wtxOrdered.erase(it);
+                    break;
+                }
+            }
+            mapWallet.erase(mi);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
     }
     return;
 }
@@ -1354,6 +1514,14 @@ void CWalletTx::GetAmounts(list<COutputEntry>& listReceived,
     listSent.clear();
     strSentAccount = strFromAccount;
 
+    std::map<isminefilter, CCachedAmounts>::const_iterator mi = mapAmountsCached.find(filter);
+    if (mi != mapAmountsCached.end() && mi->second.nGeneration == pwallet->nAmountsGeneration) {
+        listReceived = mi->second.listReceived;
+        listSent = mi->second.listSent;
+        nFee = mi->second.nFee;
+        return;
+    }
+
     // Compute fee:
     CAmount nDebit = GetDebit(filter);
     if (nDebit > 0) // debit>0 means we signed/sent this transaction
@@ -1397,6 +1565,12 @@ void CWalletTx::GetAmounts(list<COutputEntry>& listReceived,
         if (fIsMine & filter)
             listReceived.push_back(output);
     }
+
+    CCachedAmounts& cached = mapAmountsCached[filter];
+    cached.nGeneration = pwallet->nAmountsGeneration;
+    cached.listReceived = listReceived;
+    cached.listSent = listSent;
+    cached.nFee = nFee;
 }
 
 void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived, CAmount& nSent, CAmount& nFee, const isminefilter& filter) const
@@ -1434,10 +1608,151 @@ bool CWalletTx::WriteToDisk()
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
+void CWallet::GetRescanFilter(std::set<uint160>& setHashes, std::set<CScript>& setScripts) const
+{
+    LOCK(cs_KeyStore);
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    setHashes.insert(setKeys.begin(), setKeys.end());
+    for (ScriptMap::const_iterator it = mapScripts.begin(); it != mapScripts.end(); ++it)
+        setHashes.insert(it->first);
+    setScripts.insert(setWatchOnly.begin(), setWatchOnly.end());
+    setScripts.insert(setMultiSig.begin(), setMultiSig.end());
+}
+
+/**
+ * Reads the blocks of a rescan ahead of the wallet and marks the transactions
+ * with an output that may be ours, on a few threads and without holding
+ * cs_main or cs_wallet. The match is against a snapshot of the wallet keys
+ * and scripts: every key, key hash and script hash pushed by an output
+ * script is looked up, so it can give false positives but never misses an
+ * output IsMine() accepts. The wallet checks the marked transactions for real.
+ */
+class CWalletRescanWorkers
+{
+public:
+    struct CResult {
+        boost::shared_ptr<CBlock> pblock;
+        //! transactions with an output that may be ours
+        std::vector<bool> vMatch;
+        //! zerocoin mints in the block, only looked for after -zapwallettxes
+        std::list<CZerocoinMint> listMints;
+        bool fRead;
+    };
+
+    CWalletRescanWorkers(const std::vector<CBlockIndex*>& vIndexIn, const CWallet* pwallet, bool fMintsIn, int nThreads)
+        : vIndex(vIndexIn), vResult(vIndexIn.size()), vDone(vIndexIn.size(), false), fMints(fMintsIn), nNext(0), nConsumed(0), fStop(false)
+    {
+        {
+            LOCK(pwallet->cs_wallet);
+            pwallet->GetRescanFilter(setHashes, setScripts);
+        }
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CWalletRescanWorkers::Loop, this));
+    }
+
+    ~CWalletRescanWorkers()
+    {
+        {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWork.notify_all();
+        threadGroup.join_all();
+    }
+
+    //! Wait for block i to be read and matched
+    void Get(size_t i, CResult& result)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!vDone[i])
+                condDone.wait(lock);
+            std::swap(result, vResult[i]);
+            nConsumed = i + 1;
+        }
+        condWork.notify_all();
+    }
+
+private:
+    const std::vector<CBlockIndex*>& vIndex;
+    std::vector<CResult> vResult;
+    std::vector<bool> vDone;
+    bool fMints;
+    std::set<uint160> setHashes;
+    std::set<CScript> setScripts;
+
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    boost::thread_group threadGroup;
+    size_t nNext;
+    size_t nConsumed;
+    bool fStop;
+
+    bool MayBeMine(const CScript& script) const
+    {
+        if (setScripts.count(script))
+            return true;
+        CScript::const_iterator pc = script.begin();
+        opcodetype opcode;
+        std::vector<unsigned char> vch;
+        while (script.GetOp(pc, opcode, vch)) {
+            if (vch.size() == 20 && setHashes.count(uint160(vch)))
+                return true;
+            if ((vch.size() == 33 || vch.size() == 65) && setHashes.count(Hash160(vch)))
+                return true;
+        }
+        return false;
+    }
+
+    void Loop()
+    {
+        RenameThread("liberty-rescan");
+        while (true) {
+            size_t i;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNext < vIndex.size() && nNext >= nConsumed + MAX_RESCAN_READAHEAD)
+                    condWork.wait(lock);
+                if (fStop || nNext >= vIndex.size())
+                    return;
+                i = nNext++;
+            }
+
+            CResult result;
+            result.pblock.reset(new CBlock());
+            result.fRead = ReadBlockFromDisk(*result.pblock, vIndex[i]);
+            const std::vector<CTransaction>& vtx = result.pblock->vtx;
+            result.vMatch.resize(vtx.size(), false);
+            for (unsigned int j = 0; j < vtx.size(); j++) {
+                BOOST_FOREACH (const CTxOut& txout, vtx[j].vout) {
+                    if (MayBeMine(txout.scriptPubKey)) {
+                        result.vMatch[j] = true;
+                        break;
+                    }
+                }
+            }
+            if (fMints)
+                BlockToZerocoinMintList(*result.pblock, result.listMints);
+
+            {
+                boost::lock_guard<boost::mutex> lock(mutex);
+                std::swap(vResult[i], result);
+                vDone[i] = true;
+            }
+            condDone.notify_all();
+        }
+    }
+};
+
 /**
- * Scan the block chain (starting in pindexStart) for transactions
- * from or to us. If fUpdate is true, found transactions that already
- * exist in the wallet will be updated.
+ * Scan the active chain from pindexStart for wallet transactions. Blocks are
+ * read and matched against the wallet keys by CWalletRescanWorkers, and
+ * cs_main and cs_wallet are only taken to add the transactions that may be
+ * ours, so the node keeps running during long rescans. Blocks connected in
+ * the meantime reach the wallet through SyncTransaction, and the ones past
+ * the last scanned block are scanned at the end.
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
@@ -1447,36 +1762,80 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     if (fCheckZXLIB)
         xlibzTracker->Init();
 
-    CBlockIndex* pindex = pindexStart;
+    // no need to read and scan block, if block was created before
+    // our wallet birthday (as adjusted for block time variability)
+    //while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)) && pindex->nHeight <= Params().Zerocoin_StartHeight())
+    //    pindex = chainActive.Next(pindex);
+
+    std::vector<CBlockIndex*> vIndex;
+    // Transactions in the wallet, to find the ones spending from it without taking cs_wallet
+    std::set<uint256> setWalletTx;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
-
-        // no need to read and scan block, if block was created before
-        // our wallet birthday (as adjusted for block time variability)
-        //while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)) && pindex->nHeight <= Params().Zerocoin_StartHeight())
-        //    pindex = chainActive.Next(pindex);
-
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        set<uint256> setAddedToWallet;
-        while (pindex) {
+        for (CBlockIndex* pindex = pindexStart; pindex; pindex = chainActive.Next(pindex))
+            vIndex.push_back(pindex);
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            setWalletTx.insert(it->first);
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindexStart, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
+    }
+
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+    int64_t nTimeStart = GetTimeMillis();
+    unsigned int nBlocksLocked = 0;
+    CBlockIndex* pindexLast = NULL;
+    set<uint256> setAddedToWallet;
+    {
+        CWalletRescanWorkers workers(vIndex, this, fCheckZXLIB, std::max(1, nScriptCheckThreads));
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            CBlockIndex* pindex = vIndex[i];
             if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
                 ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+            CWalletRescanWorkers::CResult result;
+            workers.Get(i, result);
+            if (!result.fRead)
+                LogPrintf("%s : could not read block %d, skipping it\n", __func__, pindex->nHeight);
+            const CBlock& block = *result.pblock;
+
+            std::vector<bool> vfCandidate(block.vtx.size(), false);
+            bool fAnyCandidate = false;
+            for (unsigned int j = 0; j < block.vtx.size(); j++) {
+                const CTransaction& tx = block.vtx[j];
+                bool fCandidate = result.vMatch[j] || setWalletTx.count(tx.GetHash());
+                for (unsigned int k = 0; k < tx.vin.size() && !fCandidate; k++)
+                    fCandidate = setWalletTx.count(tx.vin[k].prevout.hash) > 0;
+                vfCandidate[j] = fCandidate;
+                fAnyCandidate |= fCandidate;
             }
 
-            //If this is a zapwallettx, need to readd xlibz
-            if (fCheckZXLIB) {
-                list<CZerocoinMint> listMints;
-                BlockToZerocoinMintList(block, listMints);
+            pindexLast = pindex;
+            if (fAnyCandidate || !result.listMints.empty()) {
+                LOCK2(cs_main, cs_wallet);
+                nBlocksLocked++;
+                // Disconnected blocks were already taken out of the wallet
+                if (!chainActive.Contains(pindex))
+                    continue;
 
-                for (auto& m : listMints) {
+                // A transaction spending one found earlier in this block was not a candidate
+                // above, as the spent one wasn't in the wallet yet. Spends come after what
+                // they spend within a block, so checking against the ones found so far is enough.
+                std::set<uint256> setFoundInBlock;
+                for (unsigned int j = 0; j < block.vtx.size(); j++) {
+                    const CTransaction& tx = block.vtx[j];
+                    bool fCandidate = vfCandidate[j];
+                    for (unsigned int k = 0; k < tx.vin.size() && !fCandidate && !setFoundInBlock.empty(); k++)
+                        fCandidate = setFoundInBlock.count(tx.vin[k].prevout.hash) > 0;
+                    if (fCandidate && AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
+                        setWalletTx.insert(tx.GetHash());
+                        setFoundInBlock.insert(tx.GetHash());
+                        ret++;
+                    }
+                }
+
+                //If this is a zapwallettx, need to readd xlibz
+                for (auto& m : result.listMints) {
                     if (IsMyMint(m.GetValue())) {
                         LogPrint("zero", "%s: found mint\n", __func__);
                         pwalletMain->UpdateMint(m.GetValue(), pindex->nHeight, m.GetTxHash(), m.GetDenomination());
@@ -1492,6 +1851,7 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
                                 wtx.SetMerkleBranch(block);
                                 pwalletMain->AddToWallet(wtx);
                                 setAddedToWallet.insert(txid);
+                                setWalletTx.insert(txid);
                             }
                         }
 
@@ -1506,25 +1866,45 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
                             CWalletTx wtx(pwalletMain, txSpend);
                             CBlockIndex* pindexSpend = chainActive[nHeightSpend];
                             CBlock blockSpend;
-                            if (ReadBlockFromDisk(blockSpend, pindexSpend))
+                            if (ReadBlockFromDiskCached(blockSpend, pindexSpend))
                                 wtx.SetMerkleBranch(blockSpend);
 
                             wtx.nTimeReceived = pindexSpend->nTime;
                             pwalletMain->AddToWallet(wtx);
                             setAddedToWallet.emplace(txidSpend);
+                            setWalletTx.insert(txidSpend);
                         }
                     }
                 }
             }
 
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+                int64_t nElapsed = std::max((int64_t)1, GetTimeMillis() - nTimeStart);
+                LogPrintf("Still rescanning. At block %d. Progress=%f (%.1f blocks/s)\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex), (i + 1) * 1000.0 / nElapsed);
+            }
+        }
+    }
+
+    {
+        // Blocks connected after the rescan started, or on a branch that
+        // replaced the last scanned block
+        LOCK2(cs_main, cs_wallet);
+        CBlockIndex* pindex = pindexLast ? chainActive.Next(chainActive.FindFork(pindexLast)) : NULL;
+        for (; pindex; pindex = chainActive.Next(pindex)) {
+            CBlock block;
+            ReadBlockFromDisk(block, pindex);
+            BOOST_FOREACH (CTransaction& tx, block.vtx) {
+                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                    ret++;
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+    int64_t nElapsed = std::max((int64_t)1, GetTimeMillis() - nTimeStart);
+    LogPrintf("Rescanned %u blocks in %dms (%.1f blocks/s), %u checked under lock, %d transactions added or updated\n",
+        vIndex.size(), nElapsed, vIndex.size() * 1000.0 / nElapsed, nBlocksLocked, ret);
     return ret;
 }
 
@@ -1634,8 +2014,7 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
 
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
@@ -1645,14 +2024,10 @@ CAmount CWallet::GetBalance() const
     return nTotal;
 }
 
-std::map<libzerocoin::CoinDenomination, int> mapMintMaturity;
-int nLastMaturityCheck = 0;
 CAmount CWallet::GetZerocoinBalance(bool fMatureOnly) const
 {
     if (fMatureOnly) {
-        if (chainActive.Height() > nLastMaturityCheck)
-            mapMintMaturity = GetMintMaturityHeight();
-        nLastMaturityCheck = chainActive.Height();
+        std::map<libzerocoin::CoinDenomination, int> mapMintMaturity = GetMintMaturityHeight();
 
         CAmount nBalance = 0;
         vector<CMintMeta> vMints = xlibzTracker->GetMints(true);
@@ -1684,8 +2059,7 @@ CAmount CWallet::GetUnlockedCoins() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
 
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetUnlockedCredit();
@@ -1702,8 +2076,7 @@ CAmount CWallet::GetLockedCoins() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
 
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetLockedCredit();
@@ -1736,8 +2109,7 @@ CAmount CWallet::GetAnonymizableBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
 
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAnonymizableCredit();
@@ -1754,8 +2126,7 @@ CAmount CWallet::GetAnonymizedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
 
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAnonymizedCredit();
@@ -1776,10 +2147,9 @@ double CWallet::GetAverageAnonymizedRounds() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
 
-            uint256 hash = (*it).first;
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 CTxIn vin = CTxIn(hash, i);
@@ -1808,10 +2178,9 @@ CAmount CWallet::GetNormalizedAnonymizedBalance() const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
 
-            uint256 hash = (*it).first;
+            uint256 hash = pcoin->GetHash();
 
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 CTxIn vin = CTxIn(hash, i);
@@ -1835,8 +2204,7 @@ CAmount CWallet::GetDenominatedBalance(bool unconfirmed) const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
 
             nTotal += pcoin->GetDenominatedCredit(unconfirmed);
         }
@@ -1850,8 +2218,7 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1864,8 +2231,7 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1877,8 +2243,7 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1892,8 +2257,7 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
             if (!IsFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1906,8 +2270,7 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1919,8 +2282,7 @@ CAmount CWallet::GetLockedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx* pcoin = &(*it).second;
+        BOOST_FOREACH (const CWalletTx* pcoin, GetUnspentTransactions()) {
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() > 0)
                 nTotal += pcoin->GetLockedWatchOnlyCredit();
         }
@@ -1937,9 +2299,23 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+
+        // When only the coin control selection may be spent, look at just those transactions
+        std::vector<const CWalletTx*> vSelectedTx;
+        bool fOnlySelected = coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs;
+        if (fOnlySelected) {
+            std::vector<COutPoint> vOutpoints;
+            coinControl->ListSelected(vOutpoints);
+            std::set<uint256> setSelectedTx;
+            BOOST_FOREACH (const COutPoint& outpoint, vOutpoints) {
+                map<uint256, CWalletTx>::const_iterator it = mapWallet.find(outpoint.hash);
+                if (it != mapWallet.end() && setSelectedTx.insert(outpoint.hash).second)
+                    vSelectedTx.push_back(&it->second);
+            }
+        }
+
+        BOOST_FOREACH (const CWalletTx* pcoin, fOnlySelected ? vSelectedTx : GetUnspentTransactions()) {
+            const uint256& wtxid = pcoin->GetHash();
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -1994,11 +2370,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
                 if (mine == ISMINE_WATCH_ONLY && nWatchonlyConfig == 1)
                     continue;
 
-                if (IsLockedCoin((*it).first, i) && nCoinType != ONLY_10000)
+                if (IsLockedCoin(wtxid, i) && nCoinType != ONLY_10000)
                     continue;
                 if (pcoin->vout[i].nValue <= 0 && !fIncludeZeroValue)
                     continue;
-                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected((*it).first, i))
+                if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs && !coinControl->IsSelected(wtxid, i))
                     continue;
 
                 bool fIsSpendable = false;
@@ -2033,63 +2409,6 @@ map<CBitcoinAddress, vector<COutput> > CWallet::AvailableCoinsByAddress(bool fCo
     return mapCoins;
 }
 
-static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > > vValue, const CAmount& nTotalLower, const CAmount& nTargetValue, vector<char>& vfBest, CAmount& nBest, int iterations = 1000)
-{
-    vector<char> vfIncluded;
-
-    vfBest.assign(vValue.size(), true);
-    nBest = nTotalLower;
-
-    seed_insecure_rand();
-
-    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++) {
-        vfIncluded.assign(vValue.size(), false);
-        CAmount nTotal = 0;
-        bool fReachedTarget = false;
-        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++) {
-            for (unsigned int i = 0; i < vValue.size(); i++) {
-                //The solver here uses a randomized algorithm,
-                //the randomness serves no real security purpose but is just
-                //needed to prevent degenerate behavior and it is important
-                //that the rng is fast. We do not use a constant random sequence,
-                //because there may be some privacy improvement by making
-                //the selection random.
-                if (nPass == 0 ? insecure_rand() & 1 : !vfIncluded[i]) {
-                    nTotal += vValue[i].first;
-                    vfIncluded[i] = true;
-                    if (nTotal >= nTargetValue) {
-                        fReachedTarget = true;
-                        if (nTotal < nBest) {
-                            nBest = nTotal;
-                            vfBest = vfIncluded;
-                        }
-                        nTotal -= vValue[i].first;
-                        vfIncluded[i] = false;
-                    }
-                }
-            }
-        }
-    }
-}
-
-
-// TODO: find appropriate place for this sort function
-// move denoms down
-bool less_then_denom(const COutput& out1, const COutput& out2)
-{
-    const CWalletTx* pcoin1 = out1.tx;
-    const CWalletTx* pcoin2 = out2.tx;
-
-    bool found1 = false;
-    bool found2 = false;
-    BOOST_FOREACH (CAmount d, obfuScationDenominations) // loop through predefined denoms
-    {
-        if (pcoin1->vout[out1.i].nValue == d) found1 = true;
-        if (pcoin2->vout[out2.i].nValue == d) found2 = true;
-    }
-    return (!found1 && found2);
-}
-
 bool CWallet::SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount)
 {
     LOCK(cs_main);
@@ -2207,7 +2526,7 @@ bool CWallet::MintableCoins()
     return false;
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins, set<pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const
 {
     setCoinsRet.clear();
     nValueRet = 0;
@@ -2219,17 +2538,26 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<pair<CAmount, pair<const CWalletTx*, unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+    // Shuffle pointers to the coins, instead of copying the coins themselves
+    vector<const COutput*> vpCoins;
+    vpCoins.reserve(vCoins.size());
+    BOOST_FOREACH (const COutput& output, vCoins)
+        vpCoins.push_back(&output);
+    random_shuffle(vpCoins.begin(), vpCoins.end(), GetRandInt);
 
     // move denoms down on the list
-    sort(vCoins.begin(), vCoins.end(), less_then_denom);
+    vector<char> vfDenom(vCoins.size());
+    for (unsigned int i = 0; i < vCoins.size(); i++)
+        vfDenom[i] = IsDenominatedAmount(vCoins[i].tx->vout[vCoins[i].i].nValue);
+    stable_partition(vpCoins.begin(), vpCoins.end(), CIsNotDenominated(vCoins.data(), vfDenom));
 
     // try to find nondenom first to prevent unneeded spending of mixed coins
     for (unsigned int tryDenom = 0; tryDenom < 2; tryDenom++) {
         if (fDebug) LogPrint("selectcoins", "tryDenom: %d\n", tryDenom);
         vValue.clear();
         nTotalLower = 0;
-        BOOST_FOREACH (const COutput& output, vCoins) {
+        BOOST_FOREACH (const COutput* poutput, vpCoins) {
+            const COutput& output = *poutput;
             if (!output.fSpendable)
                 continue;
 
@@ -2241,7 +2569,7 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
 
             int i = output.i;
             CAmount n = pcoin->vout[i].nValue;
-            if (tryDenom == 0 && IsDenominatedAmount(n)) continue; // we don't want denom values on first run
+            if (tryDenom == 0 && vfDenom[poutput - vCoins.data()]) continue; // we don't want denom values on first run
 
             pair<CAmount, pair<const CWalletTx*, unsigned int> > coin = make_pair(n, make_pair(pcoin, i));
 
@@ -2284,14 +2612,39 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         break;
     }
 
-    // Solve subset sum by stochastic approximation
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+    vector<CAmount> vAmounts(vValue.size());
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        vAmounts[i] = vValue[i].first;
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, 1000);
+    // Look for a subset that needs no change output first. Change below the dust
+    // threshold goes to the fee, so that is how far over the target it may be.
+    // Coins that cost more in fee to spend than they are worth are left out; they
+    // are the smallest ones, at the end of the list.
+    CFeeRate feeRate = std::max(payTxFee, minTxFee);
+    CAmount nInputFee = feeRate.GetFee(148);
+    CAmount nCostOfChange = 3 * ::minRelayTxFee.GetFee(34 + 148) - 1;
+    unsigned int nEffective = 0;
+    while (nEffective < vAmounts.size() && vAmounts[nEffective] > nInputFee)
+        nEffective++;
+    vector<CAmount> vEffective(vAmounts.begin(), vAmounts.begin() + nEffective);
+    if (SelectCoinsBnB(vEffective, nTargetValue, nCostOfChange, vfBest, nBest)) {
+        for (unsigned int i = 0; i < vEffective.size(); i++) {
+            if (vfBest[i]) {
+                setCoinsRet.insert(vValue[i].second);
+                nValueRet += vValue[i].first;
+            }
+        }
+        LogPrint("selectcoins", "CWallet::SelectCoinsMinConf branch and bound - total %s\n", FormatMoney(nBest));
+        return true;
+    }
+
+    // Solve subset sum by stochastic approximation
+    ApproximateBestSubset(vAmounts, nTotalLower, nTargetValue, vfBest, nBest, 1000);
     if (nBest != nTargetValue && nTotalLower >= nTargetValue + CENT)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
+        ApproximateBestSubset(vAmounts, nTotalLower, nTargetValue + CENT, vfBest, nBest, 1000);
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
@@ -3396,6 +3749,8 @@ bool CWallet::SetAddressBook(const CTxDestination& address, const string& strNam
         LOCK(cs_wallet); // mapAddressBook
         std::map<CTxDestination, CAddressBookData>::iterator mi = mapAddressBook.find(address);
         fUpdated = mi != mapAddressBook.end();
+        if (!fUpdated)
+            nAmountsGeneration++; // the address is no longer change
         mapAddressBook[address].name = strName;
         if (!strPurpose.empty()) /* update purpose only if requested */
             mapAddressBook[address].purpose = strPurpose;
@@ -3421,7 +3776,8 @@ bool CWallet::DelAddressBook(const CTxDestination& address)
                 CWalletDB(strWalletFile).EraseDestData(strAddress, item.first);
             }
         }
-        mapAddressBook.erase(address);
+        if (mapAddressBook.erase(address))
+            nAmountsGeneration++;
     }
 
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address) != ISMINE_NO, "", CT_DELETED);
@@ -4585,106 +4941,105 @@ bool CWallet::CreateZerocoinMintTransaction(const CAmount nValue, CMutableTransa
     return true;
 }
 
-bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, const uint256& hashTxOut, CTxIn& newTxIn,
-                         CZerocoinSpendReceipt& receipt, libzerocoin::SpendType spendType, CBlockIndex* pindexCheckpoint)
-{
-    // Default error status if not changed below
-    receipt.SetStatus(_("Transaction Mint Started"), ZXLIB_TXMINT_GENERAL);
-    libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params();
-
-    // 2. Get pubcoin from the private coin
-    libzerocoin::CoinDenomination denomination = zerocoinSelected.GetDenomination();
-    libzerocoin::PublicCoin pubCoinSelected(params, zerocoinSelected.GetValue(), denomination);
-    if(fDebug)
-        LogPrintf("%s : selected mint %s\n pubcoinhash=%s\n", __func__, zerocoinSelected.ToString(), GetPubCoinHash(zerocoinSelected.GetValue()).GetHex());
-    
-    if (!pubCoinSelected.validate()) {
-        receipt.SetStatus(_("The selected mint coin is an invalid coin"), ZXLIB_INVALID_COIN);
-        return false;
-    }
-
-    // 3. Compute Accumulator and Witness
-    libzerocoin::Accumulator accumulator(params, pubCoinSelected.getDenomination());
-    libzerocoin::AccumulatorWitness witness(params, accumulator, pubCoinSelected);
-    string strFailReason = "";
-    int nMintsAdded = 0;
-    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, pindexCheckpoint)) {
-        receipt.SetStatus(_("Try to spend with a higher security level to include more coins"), ZXLIB_FAILED_ACCUMULATOR_INITIALIZATION);
-        return error("%s : %s", __func__, receipt.GetStatusMessage());
-    }
-
-    // Construct the CoinSpend object. This acts like a signature on the transaction.
-    libzerocoin::PrivateCoin privateCoin(params, denomination, false);
-    privateCoin.setPublicCoin(pubCoinSelected);
-    privateCoin.setRandomness(zerocoinSelected.GetRandomness());
-    privateCoin.setSerialNumber(zerocoinSelected.GetSerialNumber());
+// The proof for one input of a zerocoin spend, built on a worker thread
+struct CZerocoinSpendProof {
+    uint32_t nChecksum;
+    std::vector<unsigned char> vchSpend;
+    bool fOK;
+    std::string strStatus;
+    int nStatus;
 
-    //Version 2 zerocoins have a privkey associated with them
-    uint8_t nVersion = zerocoinSelected.GetVersion();
-    privateCoin.setVersion(zerocoinSelected.GetVersion());
-    LogPrintf("%s: privatecoin version=%d\n", __func__, privateCoin.getVersion());
-    
-    CKey key;
-    if (!zerocoinSelected.GetKeyPair(key))
-        return error("%s: failed to set XLIBz privkey mint version=%d", __func__, nVersion);
+    CZerocoinSpendProof() : nChecksum(0), fOK(false), nStatus(ZXLIB_TXMINT_GENERAL) {}
+};
 
-    privateCoin.setPrivKey(key.GetPrivKey());
+// Construct the CoinSpend objects of the inputs, taken in turn by each worker thread
+static void ProveZerocoinSpends(const vector<libzerocoin::PrivateCoin>& vPrivateCoins, vector<libzerocoin::Accumulator>& vAccumulators,
+    const vector<libzerocoin::AccumulatorWitness>& vWitnesses, const uint256& hashTxOut, libzerocoin::SpendType spendType,
+    vector<CZerocoinSpendProof>& vProofs, std::atomic<size_t>& nNext)
+{
+    libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params();
+    for (size_t i = nNext++; i < vProofs.size(); i = nNext++) {
+        CZerocoinSpendProof& proof = vProofs[i];
+        try {
+            libzerocoin::CoinSpend spend(params, vPrivateCoins[i], vAccumulators[i], proof.nChecksum, vWitnesses[i], hashTxOut,
+                                         spendType);
+            LogPrintf("%s\n", spend.ToString());
+
+            if (!spend.Verify(vAccumulators[i])) {
+                LogPrintf("** spend.verify failed\n");
+                proof.strStatus = _("The new spend coin transaction did not verify");
+                proof.nStatus = ZXLIB_INVALID_WITNESS;
+                continue;
+            }
 
-    uint32_t nChecksum = GetChecksum(accumulator.getValue());
-    CBigNum bnValue;
-    if (!GetAccumulatorValueFromChecksum(nChecksum, false, bnValue) || bnValue == 0)
-        return error("%s: could not find checksum used for spend\n", __func__);
+            CDataStream serializedCoinSpend(SER_NETWORK, PROTOCOL_VERSION);
+            serializedCoinSpend << spend;
+            proof.vchSpend.assign(serializedCoinSpend.begin(), serializedCoinSpend.end());
+
+            // Deserialize the CoinSpend into a fresh object, and check it again
+            CDataStream serializedCoinSpendChecking(SER_NETWORK, PROTOCOL_VERSION);
+            try {
+                serializedCoinSpendChecking << spend;
+            } catch (...) {
+                proof.strStatus = _("Failed to deserialize");
+                proof.nStatus = ZXLIB_BAD_SERIALIZATION;
+                continue;
+            }
 
-    try {
-        libzerocoin::CoinSpend spend(params, privateCoin, accumulator, nChecksum, witness, hashTxOut,
-                                     spendType);
-        LogPrintf("%s\n", spend.ToString());
-
-        if (!spend.Verify(accumulator)) {
-            receipt.SetStatus(_("The new spend coin transaction did not verify"), ZXLIB_INVALID_WITNESS);
-            //return false;
-            LogPrintf("** spend.verify failed, trying with different params\n");
-
-            libzerocoin::CoinSpend spend2(params, privateCoin, accumulator,
-                                          nChecksum, witness, hashTxOut, libzerocoin::SpendType::SPEND);
-            LogPrintf("*** spend2 valid=%d\n", spend2.Verify(accumulator));
-            return false;
+            libzerocoin::CoinSpend newSpendChecking(params, serializedCoinSpendChecking);
+            if (!newSpendChecking.Verify(vAccumulators[i])) {
+                proof.strStatus = _("The transaction did not verify");
+                proof.nStatus = ZXLIB_BAD_SERIALIZATION;
+                continue;
+            }
+            proof.fOK = true;
+        } catch (const std::exception&) {
+            proof.strStatus = _("CoinSpend: Accumulator witness does not verify");
+            proof.nStatus = ZXLIB_INVALID_WITNESS;
         }
+    }
+}
 
-        // Deserialize the CoinSpend intro a fresh object
-        CDataStream serializedCoinSpend(SER_NETWORK, PROTOCOL_VERSION);
-        serializedCoinSpend << spend;
-        std::vector<unsigned char> data(serializedCoinSpend.begin(), serializedCoinSpend.end());
-
-        //Add the coin spend into a Liberty transaction
-        newTxIn.scriptSig = CScript() << OP_ZEROCOINSPEND << data.size();
-        newTxIn.scriptSig.insert(newTxIn.scriptSig.end(), data.begin(), data.end());
-        newTxIn.prevout.SetNull();
+bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, const uint256& hashTxOut, CTxIn& newTxIn,
+                         CZerocoinSpendReceipt& receipt, libzerocoin::SpendType spendType, CBlockIndex* pindexCheckpoint)
+{
+    vector<CTxIn> vNewTxIns;
+    if (!MintsToTxIns(vector<CZerocoinMint>(1, zerocoinSelected), nSecurityLevel, hashTxOut, vNewTxIns, receipt, spendType, pindexCheckpoint))
+        return false;
 
-        //use nSequence as a shorthand lookup of denomination
-        //NOTE that this should never be used in place of checking the value in the final blockchain acceptance/verification
-        //of the transaction
-        newTxIn.nSequence = denomination;
+    newTxIn = vNewTxIns[0];
+    return true;
+}
 
-        CDataStream serializedCoinSpendChecking(SER_NETWORK, PROTOCOL_VERSION);
-        try {
-            serializedCoinSpendChecking << spend;
-        } catch (...) {
-            receipt.SetStatus(_("Failed to deserialize"), ZXLIB_BAD_SERIALIZATION);
-            return false;
-        }
+bool CWallet::MintsToTxIns(const vector<CZerocoinMint>& vMints, int nSecurityLevel, const uint256& hashTxOut, vector<CTxIn>& vNewTxIns,
+                           CZerocoinSpendReceipt& receipt, libzerocoin::SpendType spendType, CBlockIndex* pindexCheckpoint)
+{
+    // Default error status if not changed below
+    receipt.SetStatus(_("Transaction Mint Started"), ZXLIB_TXMINT_GENERAL);
+    libzerocoin::ZerocoinParams* params = Params().Zerocoin_Params();
 
-        libzerocoin::CoinSpend newSpendChecking(params, serializedCoinSpendChecking);
-        if (!newSpendChecking.Verify(accumulator)) {
-            receipt.SetStatus(_("The transaction did not verify"), ZXLIB_BAD_SERIALIZATION);
+    vector<libzerocoin::PublicCoin> vPubCoins;
+    vector<libzerocoin::PrivateCoin> vPrivateCoins;
+    vector<libzerocoin::Accumulator> vAccumulators;
+    vector<libzerocoin::AccumulatorWitness> vWitnesses;
+    for (const CZerocoinMint& zerocoinSelected : vMints) {
+        // 1. Get pubcoin from the private coin
+        libzerocoin::CoinDenomination denomination = zerocoinSelected.GetDenomination();
+        libzerocoin::PublicCoin pubCoinSelected(params, zerocoinSelected.GetValue(), denomination);
+        if(fDebug)
+            LogPrintf("%s : selected mint %s\n pubcoinhash=%s\n", __func__, zerocoinSelected.ToString(), GetPubCoinHash(zerocoinSelected.GetValue()).GetHex());
+
+        if (!pubCoinSelected.validate()) {
+            receipt.SetStatus(_("The selected mint coin is an invalid coin"), ZXLIB_INVALID_COIN);
             return false;
         }
 
-        if (IsSerialKnown(spend.getCoinSerialNumber())) {
+        // 2. Check the serial before spending minutes on the proofs
+        if (IsSerialKnown(zerocoinSelected.GetSerialNumber())) {
             //Tried to spend an already spent XLIBz
             receipt.SetStatus(_("The coin spend has been used"), ZXLIB_SPENT_USED_ZXLIB);
 
-            uint256 hashSerial = GetSerialHash(spend.getCoinSerialNumber());
+            uint256 hashSerial = GetSerialHash(zerocoinSelected.GetSerialNumber());
             if (!xlibzTracker->HasSerialHash(hashSerial))
                 return error("%s: serialhash %s not found in tracker", __func__, hashSerial.GetHex());
 
@@ -4697,13 +5052,87 @@ bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, con
             return false;
         }
 
-        uint32_t nAccumulatorChecksum = GetChecksum(accumulator.getValue());
-        CZerocoinSpend zcSpend(spend.getCoinSerialNumber(), 0, zerocoinSelected.GetValue(), zerocoinSelected.GetDenomination(), nAccumulatorChecksum);
-        zcSpend.SetMintCount(nMintsAdded);
+        // 3. Set up the private coin the CoinSpend is made with
+        libzerocoin::PrivateCoin privateCoin(params, denomination, false);
+        privateCoin.setPublicCoin(pubCoinSelected);
+        privateCoin.setRandomness(zerocoinSelected.GetRandomness());
+        privateCoin.setSerialNumber(zerocoinSelected.GetSerialNumber());
+
+        //Version 2 zerocoins have a privkey associated with them
+        uint8_t nVersion = zerocoinSelected.GetVersion();
+        privateCoin.setVersion(zerocoinSelected.GetVersion());
+        LogPrintf("%s: privatecoin version=%d\n", __func__, privateCoin.getVersion());
+
+        CKey key;
+        if (!zerocoinSelected.GetKeyPair(key))
+            return error("%s: failed to set XLIBz privkey mint version=%d", __func__, nVersion);
+
+        privateCoin.setPrivKey(key.GetPrivKey());
+
+        vPubCoins.push_back(pubCoinSelected);
+        vPrivateCoins.push_back(privateCoin);
+        vAccumulators.push_back(libzerocoin::Accumulator(params, denomination));
+        vWitnesses.push_back(libzerocoin::AccumulatorWitness(params, vAccumulators.back(), pubCoinSelected));
+    }
+
+    // 4. Compute the accumulators and witnesses of all the inputs in one pass over the chain
+    int64_t nTimeStart = GetTimeMicros();
+    vector<int> vMintsAdded;
+    string strFailReason = "";
+    if (!GenerateAccumulatorWitnesses(vPubCoins, vAccumulators, vWitnesses, nSecurityLevel, vMintsAdded, strFailReason, pindexCheckpoint)) {
+        receipt.SetStatus(_("Try to spend with a higher security level to include more coins"), ZXLIB_FAILED_ACCUMULATOR_INITIALIZATION);
+        return error("%s : %s", __func__, receipt.GetStatusMessage());
+    }
+    int64_t nTimeWitness = GetTimeMicros();
+    receipt.AddTiming("witness", nTimeWitness - nTimeStart);
+
+    vector<CZerocoinSpendProof> vProofs(vMints.size());
+    for (unsigned int i = 0; i < vMints.size(); i++) {
+        vProofs[i].nChecksum = GetChecksum(vAccumulators[i].getValue());
+        CBigNum bnValue;
+        if (!GetAccumulatorValueFromChecksum(vProofs[i].nChecksum, false, bnValue) || bnValue == 0)
+            return error("%s: could not find checksum used for spend\n", __func__);
+    }
+
+    // 5. Construct the CoinSpend objects, each proof on its own worker thread. They act like a signature on the transaction.
+    std::atomic<size_t> nNext(0);
+    int nThreads = std::min(std::max(1, nScriptCheckThreads), (int)vMints.size());
+    if (nThreads <= 1) {
+        ProveZerocoinSpends(vPrivateCoins, vAccumulators, vWitnesses, hashTxOut, spendType, vProofs, nNext);
+    } else {
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&ProveZerocoinSpends, boost::cref(vPrivateCoins), boost::ref(vAccumulators), boost::cref(vWitnesses),
+                boost::cref(hashTxOut), spendType, boost::ref(vProofs), boost::ref(nNext)));
+        threadGroup.join_all();
+    }
+    receipt.AddTiming("proof", GetTimeMicros() - nTimeWitness);
+    LogPrint("bench", "%s : %u inputs, witnesses %.2fms, proofs %.2fms on %d threads\n", __func__, vMints.size(),
+        (nTimeWitness - nTimeStart) * 0.001, (GetTimeMicros() - nTimeWitness) * 0.001, nThreads);
+
+    // 6. Add the coin spends into Liberty transaction inputs
+    vNewTxIns.clear();
+    for (unsigned int i = 0; i < vMints.size(); i++) {
+        const CZerocoinSpendProof& proof = vProofs[i];
+        if (!proof.fOK) {
+            receipt.SetStatus(proof.strStatus, proof.nStatus);
+            return false;
+        }
+
+        CTxIn newTxIn;
+        newTxIn.scriptSig = CScript() << OP_ZEROCOINSPEND << proof.vchSpend.size();
+        newTxIn.scriptSig.insert(newTxIn.scriptSig.end(), proof.vchSpend.begin(), proof.vchSpend.end());
+        newTxIn.prevout.SetNull();
+
+        //use nSequence as a shorthand lookup of denomination
+        //NOTE that this should never be used in place of checking the value in the final blockchain acceptance/verification
+        //of the transaction
+        newTxIn.nSequence = vMints[i].GetDenomination();
+        vNewTxIns.push_back(newTxIn);
+
+        CZerocoinSpend zcSpend(vMints[i].GetSerialNumber(), 0, vMints[i].GetValue(), vMints[i].GetDenomination(), proof.nChecksum);
+        zcSpend.SetMintCount(vMintsAdded[i]);
         receipt.AddSpend(zcSpend);
-    } catch (const std::exception&) {
-        receipt.SetStatus(_("CoinSpend: Accumulator witness does not verify"), ZXLIB_INVALID_WITNESS);
-        return false;
     }
 
     receipt.SetStatus(_("Spend Valid"), ZXLIB_SPEND_OKAY); // Everything okay
@@ -4727,6 +5156,7 @@ bool CWallet::CreateZerocoinSpendTransaction(CAmount nValue, int nSecurityLevel,
 
     // Create transaction
     nStatus = ZXLIB_TRX_CREATE;
+    int64_t nTimeStart = GetTimeMicros();
 
     // If not already given pre-selected mints, then select mints from the wallet
     CWalletDB walletdb(pwalletMain->strWalletFile);
@@ -4841,6 +5271,8 @@ bool CWallet::CreateZerocoinSpendTransaction(CAmount nValue, int nSecurityLevel,
         return false;
     }
 
+    receipt.AddTiming("select", GetTimeMicros() - nTimeStart);
+
     // Create change if needed
     nStatus = ZXLIB_TRX_CHANGE;
 
@@ -4906,13 +5338,11 @@ bool CWallet::CreateZerocoinSpendTransaction(CAmount nValue, int nSecurityLevel,
             uint256 hashTxOut = txNew.GetHash();
 
             //add all of the mints to the transaction as inputs
-            for (CZerocoinMint mint : vSelectedMints) {
-                CTxIn newTxIn;
-                if (!MintToTxIn(mint, nSecurityLevel, hashTxOut, newTxIn, receipt, libzerocoin::SpendType::SPEND)) {
-                    return false;
-                }
-                txNew.vin.push_back(newTxIn);
-            }
+            vector<CTxIn> vNewTxIns;
+            if (!MintsToTxIns(vSelectedMints, nSecurityLevel, hashTxOut, vNewTxIns, receipt, libzerocoin::SpendType::SPEND))
+                return false;
+            txNew.vin.insert(txNew.vin.end(), vNewTxIns.begin(), vNewTxIns.end());
+            int64_t nTimeProofs = GetTimeMicros();
 
             // Limit size
             unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
@@ -4936,6 +5366,7 @@ bool CWallet::CreateZerocoinSpendTransaction(CAmount nValue, int nSecurityLevel,
             wtxNew.fFromMe = true;
             wtxNew.fTimeReceivedIsTxTime = true;
             wtxNew.nTimeReceived = GetAdjustedTime();
+            receipt.AddTiming("finalize", GetTimeMicros() - nTimeProofs);
         }
     }
 
@@ -5233,6 +5664,7 @@ bool CWallet::SpendZerocoin(CAmount nAmount, int nSecurityLevel, CWalletTx& wtxN
     if (fMintChange && fBackupMints)
         XLIBzBackupWallet();
 
+    int64_t nTimeCommit = GetTimeMicros();
     CWalletDB walletdb(pwalletMain->strWalletFile);
     if (!CommitTransaction(wtxNew, reserveKey)) {
         LogPrintf("%s: failed to commit\n", __func__);
@@ -5284,6 +5716,7 @@ bool CWallet::SpendZerocoin(CAmount nAmount, int nSecurityLevel, CWalletTx& wtxN
         dMint.SetTxHash(txidSpend);
         xlibzTracker->Add(dMint, true);
     }
+    receipt.AddTiming("commit", GetTimeMicros() - nTimeCommit);
 
     receipt.SetStatus("Spend Successful", ZXLIB_SPEND_OKAY);  // When we reach this point spending XLIBz was successful
 
@@ -58,6 +58,8 @@ static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWa
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
 //! -custombackupthreshold default
 static const int DEFAULT_CUSTOMBACKUPTHRESHOLD = 1;
+//! Maximum number of blocks a rescan reads and matches ahead of the one it adds to the wallet
+static const unsigned int MAX_RESCAN_READAHEAD = 64;
 
 // Zerocoin denomination which creates exactly one of each denominations:
 // 6666 = 1*5000 + 1*1000 + 1*500 + 1*100 + 1*50 + 1*10 + 1*5 + 1
@@ -191,6 +193,36 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Wallet transactions that may still have unspent outputs of ours, so the
+     * balance getters and coin selection don't walk all of mapWallet. A
+     * transaction is dropped once all its outputs of ours are spent by
+     * confirmed wallet transactions, and added back when one of those spends
+     * is disconnected or conflicted.
+     */
+    mutable std::set<uint256> setUnspentTx;
+    //! tip the unspent set was last pruned at
+    mutable const CBlockIndex* pindexUnspentPruned;
+
+    bool IsSpentByConfirmed(const CWalletTx& wtx) const;
+    std::vector<const CWalletTx*> GetUnspentTransactions() const;
+
+    /**
+     * Wallet transactions by the height of their block (-1 when it isn't
+     * known), and the ones that aren't in the active chain, so listsinceblock
+     * only looks at the transactions that can have fewer confirmations than
+     * its block. Brought up to date with the tip when it is used: only
+     * transactions added or changed since, and the ones in blocks above the
+     * fork with the tip it was last used at, are looked at again.
+     */
+    std::multimap<int, uint256> mapTxByHeight;
+    std::map<uint256, int> mapTxHeight;
+    std::set<uint256> setTxOffChain;
+    std::set<uint256> setTxHistoryDirty;
+    const CBlockIndex* pindexHistory;
+
+    void UpdateHistoryIndex();
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::list<std::unique_ptr<CStakeInput> >& listInputs, CAmount nTargetAmount);
@@ -207,6 +239,8 @@ public:
     bool CreateZerocoinMintTransaction(const CAmount nValue, CMutableTransaction& txNew, vector<CDeterministicMint>& vDMints, CReserveKey* reservekey, int64_t& nFeeRet, std::string& strFailReason, const CCoinControl* coinControl = NULL, const bool isZCSpendChange = false);
     bool CreateZerocoinSpendTransaction(CAmount nValue, int nSecurityLevel, CWalletTx& wtxNew, CReserveKey& reserveKey, CZerocoinSpendReceipt& receipt, vector<CZerocoinMint>& vSelectedMints, vector<CDeterministicMint>& vNewMints, bool fMintChange,  bool fMinimizeChange, CBitcoinAddress* address = NULL);
     bool MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, const uint256& hashTxOut, CTxIn& newTxIn, CZerocoinSpendReceipt& receipt, libzerocoin::SpendType spendType, CBlockIndex* pindexCheckpoint = nullptr);
+    //! Build the inputs spending vMints, with the witnesses generated in one pass over the chain and the proofs on worker threads
+    bool MintsToTxIns(const vector<CZerocoinMint>& vMints, int nSecurityLevel, const uint256& hashTxOut, vector<CTxIn>& vNewTxIns, CZerocoinSpendReceipt& receipt, libzerocoin::SpendType spendType, CBlockIndex* pindexCheckpoint = nullptr);
     std::string MintZerocoinFromOutPoint(CAmount nValue, CWalletTx& wtxNew, std::vector<CDeterministicMint>& vDMints, const vector<COutPoint> vOutpts);
     std::string MintZerocoin(CAmount nValue, CWalletTx& wtxNew, vector<CDeterministicMint>& vDMints, const CCoinControl* coinControl = NULL);
     bool SpendZerocoin(CAmount nValue, int nSecurityLevel, CWalletTx& wtxNew, CZerocoinSpendReceipt& receipt, vector<CZerocoinMint>& vMintsSelected, bool fMintChange, bool fMinimizeChange, CBitcoinAddress* addressTo = NULL);
@@ -302,6 +336,9 @@ public:
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
         fBackupMints = false;
+        pindexUnspentPruned = NULL;
+        pindexHistory = NULL;
+        nAmountsGeneration = 0;
 
         // Stake Settings
         nHashDrift = 45;
@@ -368,6 +405,8 @@ public:
     std::map<uint256, int> mapRequestCount;
 
     std::map<CTxDestination, CAddressBookData> mapAddressBook;
+    //! bumped when the address book gains or loses an entry, which changes the outputs GetAmounts counts as change
+    unsigned int nAmountsGeneration;
 
     CPubKey vchDefaultKey;
 
@@ -386,7 +425,7 @@ public:
 
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed = true, const CCoinControl* coinControl = NULL, bool fIncludeZeroValue = false, AvailableCoinsType nCoinType = ALL_COINS, bool fUseIX = false, int nWatchonlyConfig = 1) const;
     std::map<CBitcoinAddress, std::vector<COutput> > AvailableCoinsByAddress(bool fConfirmed = true, CAmount maxCoinValue = 0);
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*, unsigned int> >& setCoinsRet, CAmount& nValueRet) const;
 
     /// Get 1000DASH output and keys which can be used for the Masternode
     bool GetMasternodeVinAndKeys(CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet, std::string strTxHash = "", std::string strOutputIndex = "");
@@ -467,7 +506,11 @@ public:
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
+    //! Key and script hashes, and whole scripts, that can make an output ours, for the rescan threads
+    void GetRescanFilter(std::set<uint160>& setHashes, std::set<CScript>& setScripts) const;
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    //! Wallet transactions that may have fewer confirmations than a block at nHeight, ordered by hash
+    std::vector<const CWalletTx*> GetTransactionsSince(int nHeight);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
     CAmount GetBalance() const;
@@ -731,6 +774,14 @@ struct COutputEntry {
     int vout;
 };
 
+/** What GetAmounts reports for one filter, kept by the transaction until it is marked dirty */
+struct CCachedAmounts {
+    unsigned int nGeneration;
+    std::list<COutputEntry> listReceived;
+    std::list<COutputEntry> listSent;
+    CAmount nFee;
+};
+
 /** A transaction with a merkle branch linking it to the block chain. */
 class CMerkleTx : public CTransaction
 {
@@ -847,6 +898,7 @@ public:
     mutable CAmount nImmatureWatchCreditCached;
     mutable CAmount nAvailableWatchCreditCached;
     mutable CAmount nChangeCached;
+    mutable std::map<isminefilter, CCachedAmounts> mapAmountsCached;
 
     CWalletTx()
     {
@@ -904,6 +956,7 @@ public:
         nAvailableWatchCreditCached = 0;
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
+        mapAmountsCached.clear();
         nOrderPos = -1;
     }
 
@@ -965,6 +1018,7 @@ public:
         fImmatureWatchCreditCached = false;
         fDebitCached = false;
         fChangeCached = false;
+        mapAmountsCached.clear();
     }
 
     void BindWallet(CWallet* pwalletIn)
@@ -21,6 +21,8 @@
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
+#include <atomic>
+#include <deque>
 #include <fstream>
 
 using namespace boost;
@@ -418,6 +420,99 @@ public:
     }
 };
 
+// Deserialize and check a "tx" record, the part of loading it that doesn't touch the wallet
+static bool DecodeWalletTx(CDataStream& ssKey, CDataStream& ssValue, uint256& hash, CWalletTx& wtx, bool& fUpgrade, string& strErr)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    // false because there is no reason to go through the zerocoin checks for our own wallet
+    if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgrade = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703) {
+        if (!ssValue.empty()) {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        } else {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgrade = true;
+    }
+    return true;
+}
+
+static void LoadWalletTx(CWallet* pwallet, const uint256& hash, const CWalletTx& wtx, bool fUpgrade, CWalletScanState& wss)
+{
+    if (fUpgrade)
+        wss.vWalletUpgrade.push_back(hash);
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true);
+}
+
+// Deserialize and check a "key" or "wkey" record
+static bool DecodeKey(const string& strType, CDataStream& ssKey, CDataStream& ssValue, CPubKey& vchPubKey, CKey& key, string& strErr)
+{
+    ssKey >> vchPubKey;
+    if (!vchPubKey.IsValid()) {
+        strErr = "Error reading wallet database: CPubKey corrupt";
+        return false;
+    }
+    CPrivKey pkey;
+    uint256 hash = 0;
+
+    if (strType == "key") {
+        ssValue >> pkey;
+    } else {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        pkey = wkey.vchPrivKey;
+    }
+
+    // Old wallets store keys as "key" [pubkey] => [privkey]
+    // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
+    // using EC operations as a checksum.
+    // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
+    // remaining backwards-compatible.
+    try {
+        ssValue >> hash;
+    } catch (...) {
+    }
+
+    bool fSkipCheck = false;
+
+    if (hash != 0) {
+        // hash pubkey/privkey to accelerate wallet load
+        std::vector<unsigned char> vchKey;
+        vchKey.reserve(vchPubKey.size() + pkey.size());
+        vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
+        vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
+
+        if (Hash(vchKey.begin(), vchKey.end()) != hash) {
+            strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
+            return false;
+        }
+
+        fSkipCheck = true;
+    }
+
+    if (!key.Load(pkey, vchPubKey, fSkipCheck)) {
+        strErr = "Error reading wallet database: CPrivKey corrupt";
+        return false;
+    }
+    return true;
+}
+
 bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CWalletScanState& wss, string& strType, string& strErr)
 {
     try {
@@ -435,34 +530,11 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             ssValue >> pwallet->mapAddressBook[CBitcoinAddress(strAddress).Get()].purpose;
         } else if (strType == "tx") {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            // false because there is no reason to go through the zerocoin checks for our own wallet
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgrade;
+            if (!DecodeWalletTx(ssKey, ssValue, hash, wtx, fUpgrade, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703) {
-                if (!ssValue.empty()) {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                        wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                } else {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true);
+            LoadWalletTx(pwallet, hash, wtx, fUpgrade, wss);
         } else if (strType == "acentry") {
             string strAccount;
             ssKey >> strAccount;
@@ -501,55 +573,11 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             pwallet->nTimeFirstKey = 1;
         } else if (strType == "key" || strType == "wkey") {
             CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid()) {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
             CKey key;
-            CPrivKey pkey;
-            uint256 hash = 0;
-
-            if (strType == "key") {
+            if (strType == "key")
                 wss.nKeys++;
-                ssValue >> pkey;
-            } else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-
-            // Old wallets store keys as "key" [pubkey] => [privkey]
-            // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
-            // using EC operations as a checksum.
-            // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
-            // remaining backwards-compatible.
-            try {
-                ssValue >> hash;
-            } catch (...) {
-            }
-
-            bool fSkipCheck = false;
-
-            if (hash != 0) {
-                // hash pubkey/privkey to accelerate wallet load
-                std::vector<unsigned char> vchKey;
-                vchKey.reserve(vchPubKey.size() + pkey.size());
-                vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
-                vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
-
-                if (Hash(vchKey.begin(), vchKey.end()) != hash) {
-                    strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
-                    return false;
-                }
-
-                fSkipCheck = true;
-            }
-
-            if (!key.Load(pkey, vchPubKey, fSkipCheck)) {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
+            if (!DecodeKey(strType, ssKey, ssValue, vchPubKey, key, strErr))
                 return false;
-            }
             if (!pwallet->LoadKey(key, vchPubKey)) {
                 strErr = "Error reading wallet database: LoadKey failed";
                 return false;
@@ -666,6 +694,49 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
     return true;
 }
 
+/** Size of the buffer LoadWallet reads records from the cursor into */
+static const unsigned int WALLET_LOAD_BULK_SIZE = 1 << 20;
+
+/** A "tx", "key" or "wkey" record, decoded and checked on a LoadWallet worker thread */
+class CWalletLoadRecord
+{
+public:
+    string strType;
+    bool fDecoded;
+    bool fOK;
+    string strErr;
+    uint256 hash;
+    CWalletTx wtx;
+    bool fUpgrade;
+    CPubKey vchPubKey;
+    CKey key;
+
+    CWalletLoadRecord() : fDecoded(false), fOK(false), fUpgrade(false) {}
+};
+
+// Decode the records the wallet spends most of its load time on. The rest are
+// left to ReadKeyValue, which reads them from the start again.
+static void DecodeWalletRecords(std::deque<std::pair<CDataStream, CDataStream> >& vRecords, std::vector<CWalletLoadRecord>& vDecoded, std::atomic<size_t>& nNext)
+{
+    size_t i;
+    while ((i = nNext++) < vRecords.size()) {
+        CWalletLoadRecord& record = vDecoded[i];
+        try {
+            CDataStream ssKey(vRecords[i].first);
+            ssKey >> record.strType;
+            if (record.strType == "tx") {
+                record.fDecoded = true;
+                record.fOK = DecodeWalletTx(ssKey, vRecords[i].second, record.hash, record.wtx, record.fUpgrade, record.strErr);
+            } else if (record.strType == "key" || record.strType == "wkey") {
+                record.fDecoded = true;
+                record.fOK = DecodeKey(record.strType, ssKey, vRecords[i].second, record.vchPubKey, record.key, record.strErr);
+            }
+        } catch (...) {
+            record.fOK = false;
+        }
+    }
+}
+
 static bool IsKeyType(string strType)
 {
     return (strType == "key" || strType == "wkey" ||
@@ -695,21 +766,62 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Read all records, as many at a time as fit in the buffer
+        int64_t nTimeStart = GetTimeMicros();
+        std::deque<std::pair<CDataStream, CDataStream> > vRecords;
+        std::vector<unsigned char> vchBuffer(WALLET_LOAD_BULK_SIZE);
         while (true) {
-            // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
+            int ret = ReadAtCursorBulk(pcursor, vchBuffer, vRecords);
             if (ret == DB_NOTFOUND)
                 break;
             else if (ret != 0) {
                 LogPrintf("Error reading next record from wallet database\n");
+                pcursor->close();
                 return DB_CORRUPT;
             }
+        }
+        pcursor->close();
+        int64_t nTimeRead = GetTimeMicros();
+
+        // Deserialize and check the transactions and keys on worker threads
+        std::vector<CWalletLoadRecord> vDecoded(vRecords.size());
+        std::atomic<size_t> nNext(0);
+        int nThreads = std::min(std::max(1, nScriptCheckThreads), (int)(vRecords.size() / 1000 + 1));
+        if (nThreads <= 1) {
+            DecodeWalletRecords(vRecords, vDecoded, nNext);
+        } else {
+            boost::thread_group threadGroup;
+            for (int i = 0; i < nThreads; i++)
+                threadGroup.create_thread(boost::bind(&DecodeWalletRecords, boost::ref(vRecords), boost::ref(vDecoded), boost::ref(nNext)));
+            threadGroup.join_all();
+        }
+        int64_t nTimeDecode = GetTimeMicros();
 
+        // Load everything into the wallet, in the order it is stored
+        for (size_t i = 0; i < vRecords.size(); i++) {
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr)) {
+            bool fRead;
+            CWalletLoadRecord& record = vDecoded[i];
+            if (record.fDecoded) {
+                strType = record.strType;
+                strErr = record.strErr;
+                if (strType == "tx") {
+                    if (record.fOK)
+                        LoadWalletTx(pwallet, record.hash, record.wtx, record.fUpgrade, wss);
+                } else {
+                    if (strType == "key")
+                        wss.nKeys++;
+                    if (record.fOK && !pwallet->LoadKey(record.key, record.vchPubKey)) {
+                        strErr = "Error reading wallet database: LoadKey failed";
+                        record.fOK = false;
+                    }
+                }
+                fRead = record.fOK;
+            } else {
+                fRead = ReadKeyValue(pwallet, vRecords[i].first, vRecords[i].second, wss, strType, strErr);
+            }
+            if (!fRead) {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
                 if (IsKeyType(strType))
@@ -725,7 +837,9 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
         }
-        pcursor->close();
+
+        LogPrintf("LoadWallet : %u records, read %.2fms, decoded on %d threads %.2fms, loaded %.2fms\n", vRecords.size(),
+            (nTimeRead - nTimeStart) * 0.001, nThreads, (nTimeDecode - nTimeRead) * 0.001, (GetTimeMicros() - nTimeDecode) * 0.001);
     } catch (boost::thread_interrupted) {
         throw;
     } catch (...) {
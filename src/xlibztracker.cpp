@@ -11,6 +11,7 @@
 #include "walletdb.h"
 #include "xlibzwallet.h"
 #include "accumulators.h"
+#include "xlibzchain.h"
 
 using namespace std;
 
@@ -20,6 +21,7 @@ CXlibzTracker::CXlibzTracker(std::string strWalletFile)
     mapSerialHashes.clear();
     mapPendingSpends.clear();
     fInitialized = false;
+    fUpdateAll = true;
 }
 
 CXlibzTracker::~CXlibzTracker()
@@ -360,7 +362,35 @@ void CXlibzTracker::RemovePending(const uint256& txid)
         mapPendingSpends.erase(hashSerial);
 }
 
-bool CXlibzTracker::UpdateStatusInternal(const std::set<uint256>& setMempool, CMintMeta& mint)
+/**
+ * Remember the mints a transaction mints or spends, so the next status update
+ * looks at them. Called for every transaction the wallet is synced with: on
+ * mempool acceptance, when a block is connected or disconnected and when a
+ * transaction gets conflicted.
+ */
+void CXlibzTracker::NotifyTransaction(const CTransaction& tx)
+{
+    if (!tx.ContainsZerocoins())
+        return;
+
+    setDirty.insert(tx.GetHash());
+    for (const CTxIn& txin : tx.vin) {
+        if (!txin.scriptSig.IsZerocoinSpend())
+            continue;
+        libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txin);
+        setDirty.insert(GetSerialHash(spend.getCoinSerialNumber()));
+    }
+    for (const CTxOut& txout : tx.vout) {
+        if (!txout.IsZerocoinMint())
+            continue;
+        libzerocoin::PublicCoin pubcoin(Params().Zerocoin_Params());
+        CValidationState state;
+        if (TxOutToPublicCoin(txout, pubcoin, state))
+            setDirty.insert(GetPubCoinHash(pubcoin.getValue()));
+    }
+}
+
+bool CXlibzTracker::UpdateStatusInternal(CMintMeta& mint)
 {
     //! Check whether this mint has been spent and is considered 'pending' or 'confirmed'
     // If there is not a record of the block height, then look it up and assign it
@@ -377,7 +407,7 @@ bool CXlibzTracker::UpdateStatusInternal(const std::set<uint256>& setMempool, CM
     // Double check the mempool for pending spend
     if (isPendingSpend) {
         uint256 txidPendingSpend = mapPendingSpends.at(mint.hashSerial);
-        if (!setMempool.count(txidPendingSpend) || isConfirmedSpend) {
+        if (!mempool.exists(txidPendingSpend) || isConfirmedSpend) {
             RemovePending(txidPendingSpend);
             isPendingSpend = false;
             LogPrintf("%s : Pending txid %s removed because not in mempool\n", __func__, txidPendingSpend.GetHex());
@@ -401,7 +431,7 @@ bool CXlibzTracker::UpdateStatusInternal(const std::set<uint256>& setMempool, CM
             mint.txid = txidMint;
         }
 
-        if (setMempool.count(mint.txid))
+        if (mempool.exists(mint.txid))
             return true;
 
         // Check the transaction associated with this mint
@@ -439,7 +469,8 @@ bool CXlibzTracker::UpdateStatusInternal(const std::set<uint256>& setMempool, CM
 std::set<CMintMeta> CXlibzTracker::ListMints(bool fUnusedOnly, bool fMatureOnly, bool fUpdateStatus, bool fWrongSeed)
 {
     CWalletDB walletdb(strWalletFile);
-    if (fUpdateStatus) {
+    bool fUpdateAllNow = fUpdateStatus && fUpdateAll;
+    if (fUpdateAllNow) {
         std::list<CZerocoinMint> listMintsDB = walletdb.ListMintedCoins();
         for (auto& mint : listMintsDB)
             Add(mint);
@@ -457,11 +488,6 @@ std::set<CMintMeta> CXlibzTracker::ListMints(bool fUnusedOnly, bool fMatureOnly,
 
     std::vector<CMintMeta> vOverWrite;
     std::set<CMintMeta> setMints;
-    std::set<uint256> setMempool;
-    {
-        LOCK(mempool.cs);
-        mempool.getTransactions(setMempool);
-    }
 
     std::map<libzerocoin::CoinDenomination, int> mapMaturity = GetMintMaturityHeight();
     for (auto& it : mapSerialHashes) {
@@ -471,8 +497,12 @@ std::set<CMintMeta> CXlibzTracker::ListMints(bool fUnusedOnly, bool fMatureOnly,
         if (mint.isArchived)
             continue;
 
-        // Update the metadata of the mints if requested
-        if (fUpdateStatus && UpdateStatusInternal(setMempool, mint)) {
+        // Update the metadata of the mints if requested. Only mints touched by
+        // a transaction since the last update, with a pending spend or not yet
+        // in a block can have changed.
+        bool fUpdate = fUpdateStatus && (fUpdateAllNow || setDirty.count(mint.txid) || setDirty.count(mint.hashSerial) ||
+                                         setDirty.count(mint.hashPubcoin) || mapPendingSpends.count(mint.hashSerial) || !mint.nHeight);
+        if (fUpdate && UpdateStatusInternal(mint)) {
             if (mint.isArchived)
                 continue;
 
@@ -501,10 +531,17 @@ std::set<CMintMeta> CXlibzTracker::ListMints(bool fUnusedOnly, bool fMatureOnly,
     for (CMintMeta& meta : vOverWrite)
         UpdateState(meta);
 
+    if (fUpdateStatus) {
+        setDirty.clear();
+        fUpdateAll = false;
+    }
+
     return setMints;
 }
 
 void CXlibzTracker::Clear()
 {
     mapSerialHashes.clear();
+    setDirty.clear();
+    fUpdateAll = true;
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
 #include <list>
 
 class CDeterministicMint;
+class CTransaction;
 class CXlibzWallet;
 
 class CXlibzTracker
@@ -18,7 +19,11 @@ private:
     std::string strWalletFile;
     std::map<uint256, CMintMeta> mapSerialHashes;
     std::map<uint256, uint256> mapPendingSpends; //serialhash, txid of spend
-    bool UpdateStatusInternal(const std::set<uint256>& setMempool, CMintMeta& mint);
+    //! Txids, serial hashes and pubcoin hashes seen in transactions since the last status update
+    std::set<uint256> setDirty;
+    //! Reload every mint from the database and update them all at the next status update
+    bool fUpdateAll;
+    bool UpdateStatusInternal(CMintMeta& mint);
 public:
     CXlibzTracker(std::string strWalletFile);
     ~CXlibzTracker();
@@ -32,6 +37,8 @@ public:
     bool HasMintTx(const uint256& txid);
     bool IsEmpty() const { return mapSerialHashes.empty(); }
     void Init();
+    void NotifyTransaction(const CTransaction& tx);
+    void ScheduleReload() { fUpdateAll = true; }
     CMintMeta Get(const uint256& hashSerial);
     CMintMeta GetMetaFromPubcoin(const uint256& hashPubcoin);
     bool GetMetaFromStakeHash(const uint256& hashStake, CMintMeta& meta) const;
@@ -12,6 +12,8 @@
 #include "primitives/deterministicmint.h"
 #include "xlibzchain.h"
 
+#include <boost/thread.hpp>
+
 using namespace libzerocoin;
 
 CXlibzWallet::CXlibzWallet(std::string strWalletFile)
@@ -91,6 +93,10 @@ bool CXlibzWallet::SetMasterSeed(const uint256& seedMaster, bool fResetCount)
 
     mintPool.Reset();
 
+    // Mints are checked against the seed when they are loaded
+    if (pwalletMain->xlibzTracker)
+        pwalletMain->xlibzTracker->ScheduleReload();
+
     return true;
 }
 
@@ -105,7 +111,7 @@ void CXlibzWallet::AddToMintPool(const std::pair<uint256, uint32_t>& pMint, bool
 }
 
 //Add the next 20 mints to the mint pool
-void CXlibzWallet::GenerateMintPool(uint32_t nCountStart, uint32_t nCountEnd)
+void CXlibzWallet::GenerateMintPool(uint32_t nCountStart, uint32_t nCountEnd, int nThreads)
 {
 
     //Is locked
@@ -121,37 +127,65 @@ void CXlibzWallet::GenerateMintPool(uint32_t nCountStart, uint32_t nCountEnd)
     if (nCountEnd > 0)
         nStop = std::max(n, n + nCountEnd);
 
-    bool fFound;
+    if (nThreads <= 0)
+        nThreads = std::max(1, nScriptCheckThreads);
 
-    uint256 hashSeed = Hash(seedMaster.begin(), seedMaster.end());
-    LogPrintf("%s : n=%d nStop=%d\n", __func__, n, nStop - 1);
+    // Prevent unnecessary repeated minted
+    std::vector<uint32_t> vCounts;
     for (uint32_t i = n; i < nStop; ++i) {
-        if (ShutdownRequested())
-            return;
+        if (!mintPool.HasCount(i))
+            vCounts.push_back(i);
+    }
 
-        fFound = false;
+    uint256 hashSeed = Hash(seedMaster.begin(), seedMaster.end());
+    LogPrintf("%s : n=%d nStop=%d, %u to generate on %d threads\n", __func__, n, nStop - 1, vCounts.size(), nThreads);
+    int64_t nTimeStart = GetTimeMicros();
+    for (size_t nBatchStart = 0; nBatchStart < vCounts.size(); nBatchStart += MINT_POOL_BATCH_SIZE) {
+        std::vector<uint32_t> vBatch(vCounts.begin() + nBatchStart, vCounts.begin() + std::min(vCounts.size(), nBatchStart + MINT_POOL_BATCH_SIZE));
+        std::vector<CBigNum> vValues(vBatch.size());
+        std::atomic<size_t> nNext(0);
+        int nBatchThreads = std::min(nThreads, (int)vBatch.size());
+        if (nBatchThreads <= 1) {
+            DeriveMintValues(vBatch, vValues, nNext);
+        } else {
+            boost::thread_group threadGroup;
+            for (int i = 0; i < nBatchThreads; i++)
+                threadGroup.create_thread(boost::bind(&CXlibzWallet::DeriveMintValues, this, boost::cref(vBatch), boost::ref(vValues), boost::ref(nNext)));
+            threadGroup.join_all();
+        }
+        // Stop if the wallet got locked, the values may be derived from a cleared seed
+        if (ShutdownRequested() || Hash(seedMaster.begin(), seedMaster.end()) != hashSeed)
+            return;
 
-        // Prevent unnecessary repeated minted
-        for (auto& pair : mintPool) {
-            if(pair.second == i) {
-                fFound = true;
-                break;
-            }
+        CWalletDB walletdb(strWalletFile);
+        walletdb.TxnBegin();
+        for (unsigned int i = 0; i < vBatch.size(); i++) {
+            uint256 hashPubcoin = GetPubCoinHash(vValues[i]);
+            mintPool.Add(make_pair(hashPubcoin, vBatch[i]));
+            walletdb.WriteMintPoolPair(hashSeed, hashPubcoin, vBatch[i]);
+            LogPrint("zero", "%s : %s count=%d\n", __func__, vValues[i].GetHex().substr(0, 6), vBatch[i]);
         }
+        walletdb.TxnCommit();
 
-        if(fFound)
-            continue;
+        size_t nDone = nBatchStart + vBatch.size();
+        int64_t nElapsed = std::max((int64_t)1, GetTimeMicros() - nTimeStart);
+        LogPrintf("%s : %u/%u mints added to the pool, %.1f mints/s\n", __func__, nDone, vCounts.size(), nDone * 1000000.0 / nElapsed);
+    }
+}
+
+// Derive the pubcoin values for vCounts, the next one to do is taken from nNext
+void CXlibzWallet::DeriveMintValues(const std::vector<uint32_t>& vCounts, std::vector<CBigNum>& vValues, std::atomic<size_t>& nNext)
+{
+    size_t i;
+    while ((i = nNext++) < vCounts.size()) {
+        if (ShutdownRequested())
+            return;
 
-        uint512 seedZerocoin = GetZerocoinSeed(i);
-        CBigNum bnValue;
+        uint512 seedZerocoin = GetZerocoinSeed(vCounts[i]);
         CBigNum bnSerial;
         CBigNum bnRandomness;
         CKey key;
-        SeedToZXLIB(seedZerocoin, bnValue, bnSerial, bnRandomness, key);
-
-        mintPool.Add(bnValue, i);
-        CWalletDB(strWalletFile).WriteMintPoolPair(hashSeed, GetPubCoinHash(bnValue), i);
-        LogPrintf("%s : %s count=%d\n", __func__, bnValue.GetHex().substr(0, 6), i);
+        SeedToZXLIB(seedZerocoin, vValues[i], bnSerial, bnRandomness, key);
     }
 }
 
@@ -180,105 +214,155 @@ void CXlibzWallet::GetState(int& nCount, int& nLastGenerated)
 }
 
 //Catch the counter up with the chain
-void CXlibzWallet::SyncWithChain(bool fGenerateMintPool)
+void CXlibzWallet::SyncWithChain(bool fGenerateMintPool, bool fRecover)
 {
-    uint32_t nLastCountUsed = 0;
-    bool found = true;
-    CWalletDB walletdb(strWalletFile);
+    // Each pool entry is probed once. Mints found move the count up, the pool is
+    // extended past it and the next round only probes the entries just added.
+    std::set<uint256> setProbed;
+    std::set<uint256> setAddedTx;
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nFound = 0;
+    if (fRecover)
+        pwalletMain->ShowProgress(_("Recovering zerocoin mints..."), 0);
+
+    // The mint pool and the tracker are shared with SyncTransaction and staking, which use
+    // them under cs_wallet. The chain is only probed between the locked sections.
+    while (!ShutdownRequested()) {
+        if (fGenerateMintPool) {
+            LOCK(pwalletMain->cs_wallet);
+            GenerateMintPool(0, fRecover ? MINT_POOL_RECOVERY_LOOKAHEAD : 0);
+        }
 
-    set<uint256> setAddedTx;
-    while (found) {
-        found = false;
-        if (fGenerateMintPool)
-            GenerateMintPool();
-        LogPrintf("%s: Mintpool size=%d\n", __func__, mintPool.size());
-
-        std::set<uint256> setChecked;
-        list<pair<uint256,uint32_t> > listMints = mintPool.List();
-        for (pair<uint256, uint32_t> pMint : listMints) {
-            LOCK(cs_main);
-            if (setChecked.count(pMint.first))
-                return;
-            setChecked.insert(pMint.first);
-
-            if (ShutdownRequested())
-                return;
-
-            if (pwalletMain->xlibzTracker->HasPubcoinHash(pMint.first)) {
-                mintPool.Remove(pMint.first);
-                continue;
+        std::vector<uint256> vProbe;
+        {
+            LOCK2(cs_main, pwalletMain->cs_wallet);
+            LogPrintf("%s: Mintpool size=%d\n", __func__, mintPool.size());
+            std::vector<uint256> vKnown;
+            for (const pair<uint256, uint32_t>& pMint : mintPool.List()) {
+                if (!setProbed.insert(pMint.first).second)
+                    continue;
+                if (pwalletMain->xlibzTracker->HasPubcoinHash(pMint.first))
+                    vKnown.push_back(pMint.first);
+                else
+                    vProbe.push_back(pMint.first);
             }
+            RemoveMintsFromPool(vKnown);
+        }
+        if (vProbe.empty())
+            break;
 
-            uint256 txHash;
-            CZerocoinMint mint;
-            if (zerocoinDB->ReadCoinMint(pMint.first, txHash)) {
-                //this mint has already occurred on the chain, increment counter's state to reflect this
-                LogPrintf("%s : Found wallet coin mint=%s count=%d tx=%s\n", __func__, pMint.first.GetHex(), pMint.second, txHash.GetHex());
-                found = true;
+        std::map<uint256, uint256> mapHashTx;
+        if (!zerocoinDB->ReadCoinMints(vProbe, mapHashTx)) {
+            LogPrintf("%s : failed to read mints from the zerocoin database\n", __func__);
+            break;
+        }
+        LogPrintf("%s : %u of %u pool mints found on chain\n", __func__, mapHashTx.size(), vProbe.size());
+        if (mapHashTx.empty())
+            break;
 
-                uint256 hashBlock;
+        AddMintsFound(mapHashTx, setAddedTx, fRecover);
+        nFound += mapHashTx.size();
+    }
+
+    if (fRecover) {
+        pwalletMain->ShowProgress(_("Recovering zerocoin mints..."), 100);
+        LogPrintf("%s : recovered %u mints, count=%d, %.2fs\n", __func__, nFound, nCountLastUsed, (GetTimeMicros() - nTimeStart) * 0.000001);
+    }
+}
+
+// Add the mints of mapHashTx (pubcoin hash, txid) to the wallet, reading each block they are in once
+void CXlibzWallet::AddMintsFound(const std::map<uint256, uint256>& mapHashTx, std::set<uint256>& setAddedTx, bool fShowProgress)
+{
+    std::map<uint256, std::set<uint256> > mapTxMints;
+    for (const pair<uint256, uint256>& hit : mapHashTx)
+        mapTxMints[hit.second].insert(hit.first);
+
+    // Group the transactions by the position of their block, so blocks are read in the order they are stored
+    std::map<pair<int, unsigned int>, std::vector<uint256> > mapBlockTxes;
+    {
+        LOCK(cs_main);
+        for (const pair<uint256, std::set<uint256> >& txMints : mapTxMints) {
+            CDiskBlockPos pos;
+            CDiskTxPos postx;
+            if (fTxIndex && pblocktree->ReadTxIndex(txMints.first, postx)) {
+                pos = postx;
+            } else {
                 CTransaction tx;
-                if (!GetTransaction(txHash, tx, hashBlock, true)) {
-                    LogPrintf("%s : failed to get transaction for mint %s!\n", __func__, pMint.first.GetHex());
-                    found = false;
-                    nLastCountUsed = std::max(pMint.second, nLastCountUsed);
-                    continue;
-                }
+                uint256 hashBlock;
+                if (GetTransaction(txMints.first, tx, hashBlock, true) && mapBlockIndex.count(hashBlock))
+                    pos = mapBlockIndex.at(hashBlock)->GetBlockPos();
+            }
+            if (pos.IsNull()) {
+                LogPrintf("%s : failed to get transaction %s\n", __func__, txMints.first.GetHex());
+                continue;
+            }
+            mapBlockTxes[make_pair(pos.nFile, pos.nPos)].push_back(txMints.first);
+        }
+    }
 
-                //Find the denomination
-                CoinDenomination denomination = CoinDenomination::ZQ_ERROR;
-                bool fFoundMint = false;
-                CBigNum bnValue = 0;
-                for (const CTxOut& out : tx.vout) {
-                    if (!out.scriptPubKey.IsZerocoinMint())
-                        continue;
-
-                    PublicCoin pubcoin(Params().Zerocoin_Params());
-                    CValidationState state;
-                    if (!TxOutToPublicCoin(out, pubcoin, state)) {
-                        LogPrintf("%s : failed to get mint from txout for %s!\n", __func__, pMint.first.GetHex());
-                        continue;
-                    }
-
-                    // See if this is the mint that we are looking for
-                    uint256 hashPubcoin = GetPubCoinHash(pubcoin.getValue());
-                    if (pMint.first == hashPubcoin) {
-                        denomination = pubcoin.getDenomination();
-                        bnValue = pubcoin.getValue();
-                        fFoundMint = true;
-                        break;
-                    }
-                }
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nBlocks = 0;
+    for (const pair<pair<int, unsigned int>, std::vector<uint256> >& blockTxes : mapBlockTxes) {
+        if (ShutdownRequested())
+            return;
 
-                if (!fFoundMint || denomination == ZQ_ERROR) {
-                    LogPrintf("%s : failed to get mint %s from tx %s!\n", __func__, pMint.first.GetHex(), tx.GetHash().GetHex());
-                    found = false;
-                    break;
-                }
+        CBlock block;
+        if (!ReadBlockFromDisk(block, CDiskBlockPos(blockTxes.first.first, blockTxes.first.second))) {
+            LogPrintf("%s : failed to read block of transaction %s\n", __func__, blockTxes.second.front().GetHex());
+            continue;
+        }
+
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+        if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+            LogPrintf("%s : block %s is not in the active chain\n", __func__, block.GetHash().GetHex());
+            continue;
+        }
+        CBlockIndex* pindex = mi->second;
+
+        for (const CTransaction& tx : block.vtx) {
+            uint256 txHash = tx.GetHash();
+            if (std::find(blockTxes.second.begin(), blockTxes.second.end(), txHash) == blockTxes.second.end())
+                continue;
 
-                CBlockIndex* pindex = nullptr;
-                if (mapBlockIndex.count(hashBlock))
-                    pindex = mapBlockIndex.at(hashBlock);
+            if (!setAddedTx.count(txHash)) {
+                //Fill out wtx so that a transaction record can be created
+                CWalletTx wtx(pwalletMain, tx);
+                wtx.SetMerkleBranch(block);
+                wtx.nTimeReceived = pindex->GetBlockTime();
+                pwalletMain->AddToWallet(wtx);
+                setAddedTx.insert(txHash);
+            }
 
-                if (!setAddedTx.count(txHash)) {
-                    CBlock block;
-                    CWalletTx wtx(pwalletMain, tx);
-                    if (pindex && ReadBlockFromDisk(block, pindex))
-                        wtx.SetMerkleBranch(block);
+            const std::set<uint256>& setMints = mapTxMints[txHash];
+            for (const CTxOut& out : tx.vout) {
+                if (!out.scriptPubKey.IsZerocoinMint())
+                    continue;
 
-                    //Fill out wtx so that a transaction record can be created
-                    wtx.nTimeReceived = pindex->GetBlockTime();
-                    pwalletMain->AddToWallet(wtx);
-                    setAddedTx.insert(txHash);
+                PublicCoin pubcoin(Params().Zerocoin_Params());
+                CValidationState state;
+                if (!TxOutToPublicCoin(out, pubcoin, state)) {
+                    LogPrintf("%s : failed to get mint from txout of %s!\n", __func__, txHash.GetHex());
+                    continue;
                 }
 
-                SetMintSeen(bnValue, pindex->nHeight, txHash, denomination);
-                nLastCountUsed = std::max(pMint.second, nLastCountUsed);
-                nCountLastUsed = std::max(nLastCountUsed, nCountLastUsed);
+                uint256 hashPubcoin = GetPubCoinHash(pubcoin.getValue());
+                if (!setMints.count(hashPubcoin))
+                    continue;
+
+                LogPrintf("%s : Found wallet coin mint=%s tx=%s\n", __func__, hashPubcoin.GetHex(), txHash.GetHex());
+                SetMintSeen(pubcoin.getValue(), pindex->nHeight, txHash, pubcoin.getDenomination());
                 LogPrint("zero", "%s: updated count to %d\n", __func__, nCountLastUsed);
             }
         }
+
+        ++nBlocks;
+        if (fShowProgress)
+            pwalletMain->ShowProgress(_("Recovering zerocoin mints..."), std::max(1, std::min(99, (int)(nBlocks * 100 / mapBlockTxes.size()))));
     }
+
+    int64_t nElapsed = std::max((int64_t)1, GetTimeMicros() - nTimeStart);
+    LogPrintf("%s : %u mints found in %u blocks, %.1f blocks/s\n", __func__, mapHashTx.size(), nBlocks, nBlocks * 1000000.0 / nElapsed);
 }
 
 bool CXlibzWallet::SetMintSeen(const CBigNum& bnValue, const int& nHeight, const uint256& txid, const CoinDenomination& denom)
@@ -320,7 +404,7 @@ bool CXlibzWallet::SetMintSeen(const CBigNum& bnValue, const int& nHeight, const
         CWalletTx wtx(pwalletMain, txSpend);
         CBlockIndex* pindex = chainActive[nHeightTx];
         CBlock block;
-        if (ReadBlockFromDisk(block, pindex))
+        if (ReadBlockFromDiskCached(block, pindex))
             wtx.SetMerkleBranch(block);
 
         wtx.nTimeReceived = pindex->nTime;
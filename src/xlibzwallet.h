@@ -6,7 +6,9 @@
 #ifndef LIBERTY_XLIBZWALLET_H
 #define LIBERTY_XLIBZWALLET_H
 
+#include <atomic>
 #include <map>
+#include <set>
 #include "libzerocoin/Coin.h"
 #include "mintpool.h"
 #include "uint256.h"
@@ -14,6 +16,11 @@
 
 class CDeterministicMint;
 
+/** Number of mint pool entries derived, then written to the wallet database in one transaction */
+static const unsigned int MINT_POOL_BATCH_SIZE = 1000;
+/** Number of mints derived past the last one used in each round of a recovery from seed */
+static const unsigned int MINT_POOL_RECOVERY_LOOKAHEAD = 2000;
+
 class CXlibzWallet
 {
 private:
@@ -28,12 +35,12 @@ public:
     void AddToMintPool(const std::pair<uint256, uint32_t>& pMint, bool fVerbose);
     bool SetMasterSeed(const uint256& seedMaster, bool fResetCount = false);
     uint256 GetMasterSeed() { return seedMaster; }
-    void SyncWithChain(bool fGenerateMintPool = true);
+    void SyncWithChain(bool fGenerateMintPool = true, bool fRecover = false);
     void GenerateDeterministicZXLIB(libzerocoin::CoinDenomination denom, libzerocoin::PrivateCoin& coin, CDeterministicMint& dMint, bool fGenerateOnly = false);
     void GenerateMint(const uint32_t& nCount, const libzerocoin::CoinDenomination denom, libzerocoin::PrivateCoin& coin, CDeterministicMint& dMint);
     void GetState(int& nCount, int& nLastGenerated);
     bool RegenerateMint(const CDeterministicMint& dMint, CZerocoinMint& mint);
-    void GenerateMintPool(uint32_t nCountStart = 0, uint32_t nCountEnd = 0);
+    void GenerateMintPool(uint32_t nCountStart = 0, uint32_t nCountEnd = 0, int nThreads = 0);
     bool LoadMintPoolFromDB();
     void RemoveMintsFromPool(const std::vector<uint256>& vPubcoinHashes);
     bool SetMintSeen(const CBigNum& bnValue, const int& nHeight, const uint256& txid, const libzerocoin::CoinDenomination& denom);
@@ -45,6 +52,8 @@ public:
 
 private:
     uint512 GetZerocoinSeed(uint32_t n);
+    void DeriveMintValues(const std::vector<uint32_t>& vCounts, std::vector<CBigNum>& vValues, std::atomic<size_t>& nNext);
+    void AddMintsFound(const std::map<uint256, uint256>& mapHashTx, std::set<uint256>& setAddedTx, bool fShowProgress);
 };
 
 #endif //LIBERTY_XLIBZWALLET_H